@@ -38,17 +38,22 @@
 
 #include "asn_index.h"
 #include "xmalloc.h"
-#include "hashtbl.h"
+#include "label_dict.h"
 #include "syslog_debug.h"
+#include "geo_cache.h"
 
 #include "geoip.h"
 #if defined(HAVE_LIBGEOIP) && defined(HAVE_GEOIP_H)
 #define HAVE_GEOIP 1
 #include <GeoIP.h>
+#ifdef HAVE_GEOIP_COUNTRY_CODE_BY_ADDR_GL
+#define HAVE_GEOIP_GL 1
+#endif
 #endif
 #if defined(HAVE_LIBMAXMINDDB) && defined(HAVE_MAXMINDDB_H)
 #define HAVE_MAXMINDDB 1
-#include <maxminddb.h>
+#include "geo_mmdb.h"
+#include "geo_flat.h"
 #endif
 
 #ifdef HAVE_MAXMINDDB
@@ -69,20 +74,22 @@ extern char*              geoip_asn_v6_dat;
 extern int                geoip_asn_v6_options;
 extern enum geoip_backend asn_indexer_backend;
 extern char*              maxminddb_asn;
+extern int                maxminddb_flatten;
 static hashfunc           asn_hashfunc;
 static hashkeycmp         asn_cmpfunc;
+static hashfree           asn_free;
 
-#define MAX_ARRAY_SZ 65536
-static hashtbl* theHash  = NULL;
-static int      next_idx = 0;
+static label_dict dict = LABEL_DICT_INIT(asn_hashfunc, asn_cmpfunc, asn_free);
 #ifdef HAVE_GEOIP
 static GeoIP* geoip  = NULL;
 static GeoIP* geoip6 = NULL;
 #endif
 #ifdef HAVE_MAXMINDDB
-static MMDB_s mmdb;
-static char   _mmasn[32];
-static int    have_mmdb = 0;
+static MMDB_s* mmdb = NULL;
+static char    _mmasn[32];
+#ifdef HAVE_GEO_FLAT
+static geo_flat_db* flat = NULL;
+#endif
 #endif
 static char ipstr[81];
 #ifdef HAVE_GEOIP
@@ -93,16 +100,70 @@ static char* unknown_v4 = "?4";
 static char* unknown_v6 = "?6";
 static char* _asn       = NULL;
 
+static geo_cache* cache = NULL;
+
 typedef struct {
-    char* asn;
-    int   index;
+    label_dict_entry e;
+    char*            asn;
 } asnobj;
 
-const char*
-asn_get_from_message(dns_message* m)
+#ifdef HAVE_MAXMINDDB
+/*
+ * The AS number of a MaxMind DB entry, or NULL if it has none
+ */
+static const char*
+asn_mmdb_value(MMDB_entry_s* entry, char* buf, size_t len)
+{
+    MMDB_entry_data_s entry_data;
+
+    if (MMDB_get_value(entry, &entry_data, "autonomous_system_number", 0) != MMDB_SUCCESS)
+        return NULL;
+
+    switch (entry_data.type) {
+    case MMDB_DATA_TYPE_UINT16:
+        snprintf(buf, len, "%" PRIu16, entry_data.uint16);
+        return buf;
+    case MMDB_DATA_TYPE_UINT32:
+        snprintf(buf, len, "%" PRIu32, entry_data.uint32);
+        return buf;
+    case MMDB_DATA_TYPE_INT32:
+        snprintf(buf, len, "%" PRId32, entry_data.int32);
+        return buf;
+    case MMDB_DATA_TYPE_UINT64:
+        snprintf(buf, len, "%" PRIu64, entry_data.uint64);
+        return buf;
+    default:
+        dfprintf(1, "asn_index: found entry in MMDB but unknown type %u", entry_data.type);
+    }
+    return NULL;
+}
+
+static const char*
+asn_mmdb_lookup(transport_message* tm, int* bits)
+{
+    MMDB_lookup_result_s r;
+
+#ifdef HAVE_GEO_FLAT
+    if (flat)
+        return geo_flat_lookup(flat, &tm->src_ip_addr);
+#endif
+    if (mmdb && geo_mmdb_lookup(mmdb, &tm->src_ip_addr, &r, bits) && r.found_entry)
+        return asn_mmdb_value(&r.entry, _mmasn, sizeof(_mmasn));
+    return NULL;
+}
+#endif
+
+/*
+ * Look up the address in the database, bits is set to the length of the
+ * network the result is valid for if it can be cached
+ */
+static const char*
+asn_lookup(transport_message* tm, int* bits)
 {
-    transport_message* tm  = m->tm;
-    const char*        asn = unknown;
+    const char* asn = unknown;
+#ifdef HAVE_GEOIP_GL
+    GeoIPLookup gl;
+#endif
 
     if (asn_indexer_backend == geoip_backend_libgeoip) {
         if (!inXaddr_ntop(&tm->src_ip_addr, ipstr, sizeof(ipstr) - 1)) {
@@ -122,7 +183,14 @@ asn_get_from_message(dns_message* m)
         case geoip_backend_libgeoip:
 #ifdef HAVE_GEOIP
             if (geoip) {
-                if ((_asn = GeoIP_name_by_addr(geoip, ipstr))) {
+#ifdef HAVE_GEOIP_GL
+                _asn  = GeoIP_name_by_addr_gl(geoip, ipstr, &gl);
+                *bits = gl.netmask;
+#else
+                _asn  = GeoIP_name_by_addr(geoip, ipstr);
+                *bits = 24;
+#endif
+                if (_asn) {
                     /* libgeoip reports for networks with the same ASN different network names.
                      * Probably it uses the network description, not the AS description. Therefore,
                      * we truncate after the first space and only use the AS number. Mappings
@@ -143,45 +211,8 @@ asn_get_from_message(dns_message* m)
             break;
         case geoip_backend_libmaxminddb:
 #ifdef HAVE_MAXMINDDB
-            if (have_mmdb) {
-                struct sockaddr_in   s;
-                int                  ret;
-                MMDB_lookup_result_s r;
-
-                s.sin_family = AF_INET;
-                s.sin_addr   = tm->src_ip_addr.in4;
-
-                r = MMDB_lookup_sockaddr(&mmdb, (struct sockaddr*)&s, &ret);
-                if (ret == MMDB_SUCCESS && r.found_entry) {
-                    MMDB_entry_data_s entry_data;
-
-                    if (MMDB_get_value(&r.entry, &entry_data, "autonomous_system_number", 0) == MMDB_SUCCESS) {
-                        switch (entry_data.type) {
-                        case MMDB_DATA_TYPE_UINT16:
-                            snprintf(_mmasn, sizeof(_mmasn), "%" PRIu16, entry_data.uint16);
-                            asn = _mmasn;
-                            break;
-                        case MMDB_DATA_TYPE_UINT32:
-                            snprintf(_mmasn, sizeof(_mmasn), "%" PRIu32, entry_data.uint32);
-                            asn = _mmasn;
-                            break;
-                        case MMDB_DATA_TYPE_INT32:
-                            snprintf(_mmasn, sizeof(_mmasn), "%" PRId32, entry_data.int32);
-                            asn = _mmasn;
-                            break;
-                        case MMDB_DATA_TYPE_UINT64:
-                            snprintf(_mmasn, sizeof(_mmasn), "%" PRIu64, entry_data.uint64);
-                            asn = _mmasn;
-                            break;
-                        default:
-                            dfprintf(1, "asn_index: found entry in MMDB but unknown type %u", entry_data.type);
-                            asn = unknown_v4;
-                        }
-                        break;
-                    }
-                }
-            }
-            asn = unknown_v4;
+            if (!(asn = asn_mmdb_lookup(tm, bits)))
+                asn = unknown_v4;
 #endif
             break;
         default:
@@ -194,7 +225,14 @@ asn_get_from_message(dns_message* m)
         case geoip_backend_libgeoip:
 #ifdef HAVE_GEOIP
             if (geoip6) {
-                if ((_asn = GeoIP_name_by_addr_v6(geoip6, ipstr))) {
+#ifdef HAVE_GEOIP_GL
+                _asn  = GeoIP_name_by_addr_v6_gl(geoip6, ipstr, &gl);
+                *bits = gl.netmask;
+#else
+                _asn  = GeoIP_name_by_addr_v6(geoip6, ipstr);
+                *bits = 48;
+#endif
+                if (_asn) {
                     /* libgeoip reports for networks with the same ASN different network names.
                      * Probably it uses the network description, not the AS description. Therefore,
                      * we truncate after the first space and only use the AS number. Mappings
@@ -215,45 +253,8 @@ asn_get_from_message(dns_message* m)
             break;
         case geoip_backend_libmaxminddb:
 #ifdef HAVE_MAXMINDDB
-            if (have_mmdb) {
-                struct sockaddr_in6  s;
-                int                  ret;
-                MMDB_lookup_result_s r;
-
-                s.sin6_family = AF_INET;
-                s.sin6_addr   = tm->src_ip_addr.in6;
-
-                r = MMDB_lookup_sockaddr(&mmdb, (struct sockaddr*)&s, &ret);
-                if (ret == MMDB_SUCCESS && r.found_entry) {
-                    MMDB_entry_data_s entry_data;
-
-                    if (MMDB_get_value(&r.entry, &entry_data, "autonomous_system_number", 0) == MMDB_SUCCESS) {
-                        switch (entry_data.type) {
-                        case MMDB_DATA_TYPE_UINT16:
-                            snprintf(_mmasn, sizeof(_mmasn), "%" PRIu16, entry_data.uint16);
-                            asn = _mmasn;
-                            break;
-                        case MMDB_DATA_TYPE_UINT32:
-                            snprintf(_mmasn, sizeof(_mmasn), "%" PRIu32, entry_data.uint32);
-                            asn = _mmasn;
-                            break;
-                        case MMDB_DATA_TYPE_INT32:
-                            snprintf(_mmasn, sizeof(_mmasn), "%" PRId32, entry_data.int32);
-                            asn = _mmasn;
-                            break;
-                        case MMDB_DATA_TYPE_UINT64:
-                            snprintf(_mmasn, sizeof(_mmasn), "%" PRIu64, entry_data.uint64);
-                            asn = _mmasn;
-                            break;
-                        default:
-                            dfprintf(1, "asn_index: found entry in MMDB but unknown type %u", entry_data.type);
-                            asn = unknown_v6;
-                        }
-                        break;
-                    }
-                }
-            }
-            asn = unknown_v6;
+            if (!(asn = asn_mmdb_lookup(tm, bits)))
+                asn = unknown_v6;
 #endif
             break;
         default:
@@ -265,14 +266,34 @@ asn_get_from_message(dns_message* m)
         break;
     }
 
+    return asn;
+}
+
+const char*
+asn_get_from_message(dns_message* m)
+{
+    const char* asn;
+    int         bits = -1;
+
+    if (m->asn)
+        return m->asn;
+
+    if (!(asn = geo_cache_find(cache, &m->tm->src_ip_addr))) {
+        asn = asn_lookup(m->tm, &bits);
+        if (bits >= 0)
+            geo_cache_add(cache, &m->tm->src_ip_addr, bits, asn);
+    }
+    m->asn = asn;
+
     dfprintf(1, "asn_index: network name: %s", asn);
     return asn;
 }
 
 int asn_indexer(const dns_message* m)
 {
-    const char* asn;
-    asnobj*     obj;
+    const char*  asn;
+    asnobj*      obj;
+    unsigned int hv;
 
     if (m->malformed)
         return -1;
@@ -281,66 +302,60 @@ int asn_indexer(const dns_message* m)
     if (asn == NULL)
         return -1;
 
-    if (NULL == theHash) {
-        theHash = hash_create(MAX_ARRAY_SZ, asn_hashfunc, asn_cmpfunc, 1, afree, afree);
-        if (NULL == theHash)
-            return -1;
-    }
-
-    if ((obj = hash_find(asn, theHash))) {
-        return obj->index;
+    hv = asn_hashfunc(asn);
+    if ((obj = (asnobj*)label_dict_find(&dict, asn, hv))) {
+        return obj->e.index;
     }
 
-    obj = acalloc(1, sizeof(*obj));
+    obj = label_dict_alloc(&dict, sizeof(*obj));
     if (NULL == obj)
         return -1;
 
-    obj->asn = astrdup(asn);
+    obj->asn = label_dict_strdup(&dict, asn);
     if (NULL == obj->asn) {
-        afree(obj);
+        label_dict_free(&dict, obj);
         return -1;
     }
 
-    obj->index = next_idx;
-    if (0 != hash_add(obj->asn, obj, theHash)) {
-        afree(obj->asn);
-        afree(obj);
+    if (label_dict_add(&dict, obj->asn, hv, &obj->e) < 0) {
+        label_dict_free(&dict, obj->asn);
+        label_dict_free(&dict, obj);
         return -1;
     }
 
-    next_idx++;
-
-    return obj->index;
+    return obj->e.index;
 }
 
 int asn_iterator(const char** label)
 {
     asnobj*     obj;
     static char label_buf[128];
-    if (0 == next_idx)
+    if (0 == dict.next_idx)
         return -1;
     if (NULL == label) {
         /* initialize and tell caller how big the array is */
-        hash_iter_init(theHash);
-        return next_idx;
+        return label_dict_iter_init(&dict);
     }
-    if ((obj = hash_iterate(theHash)) == NULL)
+    if ((obj = (asnobj*)label_dict_iterate(&dict)) == NULL)
         return -1;
     snprintf(label_buf, sizeof(label_buf), "%s", obj->asn);
     *label = label_buf;
-    return obj->index;
+    return obj->e.index;
 }
 
 void asn_reset()
 {
-    theHash  = NULL;
-    next_idx = 0;
+    geo_cache_report(cache);
+#ifdef HAVE_GEO_FLAT
+    geo_flat_check(flat);
+#endif
+    label_dict_reset(&dict);
 }
 
 static unsigned int
 asn_hashfunc(const void* key)
 {
-    return hashendian(key, strlen(key), 0);
+    return hash_keyed(key, strlen(key));
 }
 
 static int
@@ -349,7 +364,19 @@ asn_cmpfunc(const void* a, const void* b)
     return strcasecmp(a, b);
 }
 
-void asn_init(void)
+static void
+asn_free(void* p)
+{
+    asnobj* obj = p;
+    xfree(obj->asn);
+    xfree(obj);
+}
+
+/*
+ * Open the configured databases, returns zero if one of them can not be
+ * opened
+ */
+static int asn_open(void)
 {
     switch (asn_indexer_backend) {
     case geoip_backend_libgeoip:
@@ -358,18 +385,19 @@ void asn_init(void)
             geoip = GeoIP_open(geoip_asn_v4_dat, geoip_asn_v4_options);
             if (geoip == NULL) {
                 dsyslog(LOG_ERR, "asn_index: Error opening IPv4 ASNum DB. Make sure libgeoip's GeoIPASNum.dat file is available");
-                exit(1);
+                return 0;
             }
         }
         if (geoip_asn_v6_dat) {
             geoip6 = GeoIP_open(geoip_asn_v6_dat, geoip_asn_v6_options);
             if (geoip6 == NULL) {
                 dsyslog(LOG_ERR, "asn_index: Error opening IPv6 ASNum DB. Make sure libgeoip's GeoIPASNumv6.dat file is available");
-                exit(1);
+                return 0;
             }
         }
         memset(ipstr, 0, sizeof(ipstr));
         if (geoip || geoip6) {
+            cache = geo_cache_create("asn_index");
             dsyslog(LOG_INFO, "asn_index: Sucessfully initialized GeoIP ASN");
         } else {
             dsyslog(LOG_INFO, "asn_index: No database loaded for GeoIP ASN");
@@ -382,16 +410,22 @@ void asn_init(void)
             int  ret;
             char errbuf[512];
 
-            ret = MMDB_open(maxminddb_asn, 0, &mmdb);
+#ifdef HAVE_GEO_FLAT
+            if (maxminddb_flatten)
+                flat = geo_flat_open(maxminddb_asn, asn_mmdb_value, &ret);
+            else
+#endif
+                mmdb = geo_mmdb_open(maxminddb_asn, &ret);
             if (ret == MMDB_IO_ERROR) {
                 dsyslogf(LOG_ERR, "asn_index: Error opening MaxMind ASN, IO error: %s", dsc_strerror(errno, errbuf, sizeof(errbuf)));
-                exit(1);
+                return 0;
             } else if (ret != MMDB_SUCCESS) {
                 dsyslogf(LOG_ERR, "asn_index: Error opening MaxMind ASN: %s", MMDB_strerror(ret));
-                exit(1);
+                return 0;
             }
             dsyslog(LOG_INFO, "asn_index: Sucessfully initialized MaxMind ASN");
-            have_mmdb = 1;
+            if (mmdb)
+                cache = geo_cache_create("asn_index");
         } else {
             dsyslog(LOG_INFO, "asn_index: No database loaded for MaxMind ASN");
         }
@@ -400,4 +434,108 @@ void asn_init(void)
     default:
         break;
     }
+    return 1;
+}
+
+struct asn_dbs {
+#ifdef HAVE_GEOIP
+    GeoIP* geoip;
+    GeoIP* geoip6;
+#endif
+#ifdef HAVE_MAXMINDDB
+    MMDB_s* mmdb;
+#ifdef HAVE_GEO_FLAT
+    geo_flat_db* flat;
+#endif
+#endif
+    geo_cache* cache;
+};
+
+static void asn_save(struct asn_dbs* d)
+{
+#ifdef HAVE_GEOIP
+    d->geoip  = geoip;
+    d->geoip6 = geoip6;
+    geoip = geoip6 = NULL;
+#endif
+#ifdef HAVE_MAXMINDDB
+    d->mmdb = mmdb;
+    mmdb    = NULL;
+#ifdef HAVE_GEO_FLAT
+    d->flat = flat;
+    flat    = NULL;
+#endif
+#endif
+    d->cache = cache;
+    cache    = NULL;
+}
+
+static void asn_restore(const struct asn_dbs* d)
+{
+#ifdef HAVE_GEOIP
+    geoip  = d->geoip;
+    geoip6 = d->geoip6;
+#endif
+#ifdef HAVE_MAXMINDDB
+    mmdb = d->mmdb;
+#ifdef HAVE_GEO_FLAT
+    flat = d->flat;
+#endif
+#endif
+    cache = d->cache;
+}
+
+static void asn_close(void)
+{
+#ifdef HAVE_GEOIP
+    if (geoip)
+        GeoIP_delete(geoip);
+    if (geoip6)
+        GeoIP_delete(geoip6);
+    geoip = geoip6 = NULL;
+#endif
+#ifdef HAVE_MAXMINDDB
+    if (mmdb)
+        geo_mmdb_close(mmdb);
+    mmdb = NULL;
+#ifdef HAVE_GEO_FLAT
+    if (flat)
+        geo_flat_close(flat);
+    flat = NULL;
+#endif
+#endif
+    geo_cache_free(cache);
+    cache = NULL;
+}
+
+void asn_init(void)
+{
+    /* results cached for the previous database are no longer valid */
+    geo_cache_free(cache);
+    cache = NULL;
+
+    if (!asn_open())
+        exit(1);
+}
+
+/*
+ * Open the databases again after the configuration has been reloaded, the
+ * databases in use are kept if any of the new ones can not be opened
+ */
+int asn_reload(void)
+{
+    struct asn_dbs old, new;
+
+    asn_save(&old);
+    if (!asn_open()) {
+        asn_close();
+        asn_restore(&old);
+        dsyslog(LOG_ERR, "asn_index: Keeping the ASN databases in use");
+        return 0;
+    }
+    asn_save(&new);
+    asn_restore(&old);
+    asn_close();
+    asn_restore(&new);
+    return 1;
 }
@@ -43,5 +43,6 @@ int  asn_indexer(const dns_message*);
 int  asn_iterator(const char** label);
 void asn_reset(void);
 void asn_init(void);
+int  asn_reload(void);
 
 #endif /* __dsc_asn_index_h */
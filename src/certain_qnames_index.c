@@ -38,19 +38,20 @@
 
 #include "certain_qnames_index.h"
 
-#include <string.h>
-
 #define QNAME_LOCALHOST 0
 #define QNAME_RSN 1
 #define QNAME_OTHER 2
 
 int certain_qnames_indexer(const dns_message* m)
 {
+    unsigned int c;
+
     if (m->malformed)
         return -1;
-    if (0 == strcmp(m->qname, "localhost"))
+    c = dns_message_qname_class((dns_message*)m);
+    if (c & QNAME_CLASS_LOCALHOST)
         return QNAME_LOCALHOST;
-    if (0 == strcmp(m->qname + 1, ".root-servers.net"))
+    if (c & QNAME_CLASS_RSN)
         return QNAME_RSN;
     return QNAME_OTHER;
 }
@@ -0,0 +1,301 @@
+/*
+ * Copyright (c) 2008-2023, OARC, Inc.
+ * Copyright (c) 2007-2008, Internet Systems Consortium, Inc.
+ * Copyright (c) 2003-2007, The Measurement Factory, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include "checkpoint.h"
+#include "response_time_index.h"
+#include "pcap.h"
+#include "xmalloc.h"
+#include "syslog_debug.h"
+#include "compat.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+typedef struct checkpoint_part checkpoint_part;
+struct checkpoint_part {
+    uint32_t    type;
+    const char* name;
+    void (*save)(checkpoint* c);
+    int (*verify)(const void* data, size_t size);
+    void (*load)(const void* data, size_t size);
+};
+
+static const checkpoint_part parts[] = {
+    { CHECKPOINT_RESPONSE_TIME, "response_time", response_time_checkpoint, response_time_verify, response_time_restore },
+    { CHECKPOINT_TCP, "tcp", pcap_checkpoint, pcap_verify, pcap_restore },
+    { 0 }
+};
+
+static const checkpoint_part* checkpoint_part_find(uint32_t type)
+{
+    const checkpoint_part* p;
+
+    for (p = parts; p->type && p->type != type; p++)
+        ;
+    return p->type ? p : 0;
+}
+
+static uint32_t checkpoint_checksum(uint32_t h, const unsigned char* data, size_t len)
+{
+    size_t i;
+    for (i = 0; i < len; i++) {
+        h ^= data[i];
+        h *= 16777619U;
+    }
+    return h;
+}
+
+void checkpoint_write(checkpoint* c, const void* data, size_t len)
+{
+    if (c->error || !len)
+        return;
+    if (fwrite(data, 1, len, c->fp) != len) {
+        c->error = errno ? errno : EIO;
+        return;
+    }
+    c->size += len;
+}
+
+/*
+ * Checksum everything after the header and write the final header
+ */
+static void checkpoint_finish(checkpoint* c, checkpoint_header* h)
+{
+    static unsigned char buf[64 * 1024];
+    size_t               n;
+    uint32_t             sum = 2166136261U;
+
+    if (c->error)
+        return;
+    if (fseeko(c->fp, sizeof(*h), SEEK_SET)) {
+        c->error = errno;
+        return;
+    }
+    while ((n = fread(buf, 1, sizeof(buf), c->fp)) > 0)
+        sum = checkpoint_checksum(sum, buf, n);
+    if (ferror(c->fp)) {
+        c->error = errno ? errno : EIO;
+        return;
+    }
+    h->checksum = sum;
+    if (fseeko(c->fp, 0, SEEK_SET) || fwrite(h, sizeof(*h), 1, c->fp) != 1)
+        c->error = errno ? errno : EIO;
+}
+
+/*
+ * Write the checkpoint to a temporary file and move it in place, returns
+ * 1 on success, 0 on error after logging why
+ */
+int checkpoint_save(const char* file)
+{
+    checkpoint             c;
+    checkpoint_header      h;
+    checkpoint_section     s;
+    const checkpoint_part* p;
+    off_t                  pos;
+    char*                  tname;
+    char                   errbuf[512];
+
+    if (!(tname = xmalloc(strlen(file) + sizeof(".tmp")))) {
+        dsyslogf(LOG_ERR, "unable to save checkpoint %s: out of memory", file);
+        return 0;
+    }
+    sprintf(tname, "%s.tmp", file);
+
+    memset(&c, 0, sizeof(c));
+    if (!(c.fp = fopen(tname, "w+"))) {
+        dsyslogf(LOG_ERR, "unable to save checkpoint %s: %s", tname, dsc_strerror(errno, errbuf, sizeof(errbuf)));
+        xfree(tname);
+        return 0;
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    h.byte_order = CHECKPOINT_BYTE_ORDER;
+    h.version    = CHECKPOINT_VERSION;
+    h.saved      = time(NULL);
+    checkpoint_write(&c, &h, sizeof(h));
+
+    for (p = parts; p->type && !c.error; p++) {
+        pos = ftello(c.fp);
+        memset(&s, 0, sizeof(s));
+        s.type = p->type;
+        checkpoint_write(&c, &s, sizeof(s));
+        c.size = 0;
+        p->save(&c);
+        if (c.error)
+            break;
+
+        // the size is known once the data is written
+        s.size = c.size;
+        if (fseeko(c.fp, pos, SEEK_SET) || fwrite(&s, sizeof(s), 1, c.fp) != 1 || fseeko(c.fp, 0, SEEK_END))
+            c.error = errno ? errno : EIO;
+        dfprintf(0, "checkpoint: %s %" PRIu64 " bytes", p->name, s.size);
+        h.sections++;
+    }
+    checkpoint_finish(&c, &h);
+
+    if (fclose(c.fp) && !c.error)
+        c.error = errno;
+    if (c.error) {
+        dsyslogf(LOG_ERR, "unable to save checkpoint %s: %s", tname, dsc_strerror(c.error, errbuf, sizeof(errbuf)));
+        unlink(tname);
+        xfree(tname);
+        return 0;
+    }
+    if (rename(tname, file)) {
+        dsyslogf(LOG_ERR, "unable to move checkpoint from %s to %s: %s", tname, file, dsc_strerror(errno, errbuf, sizeof(errbuf)));
+        unlink(tname);
+        xfree(tname);
+        return 0;
+    }
+    xfree(tname);
+    dsyslogf(LOG_INFO, "checkpoint saved to %s", file);
+    return 1;
+}
+
+/*
+ * Map a checkpoint, verify it and restore the state in it. Every section
+ * is verified before any is restored, so a bad checkpoint restores
+ * nothing. Returns 1 on success, 0 if there was none or on error after
+ * logging why
+ */
+int checkpoint_load(const char* file)
+{
+    int                      fd;
+    struct stat              st;
+    void*                    map;
+    const unsigned char*     data;
+    const checkpoint_header* h;
+    checkpoint_section       s;
+    const checkpoint_part*   p;
+    size_t                   size, off;
+    uint32_t                 i;
+    char                     errbuf[512];
+    int                      ret = 0;
+
+    if ((fd = open(file, O_RDONLY)) < 0) {
+        if (errno == ENOENT) {
+            dsyslogf(LOG_INFO, "no checkpoint %s to restore", file);
+        } else {
+            dsyslogf(LOG_ERR, "unable to open checkpoint %s: %s", file, dsc_strerror(errno, errbuf, sizeof(errbuf)));
+        }
+        return 0;
+    }
+    if (fstat(fd, &st)) {
+        dsyslogf(LOG_ERR, "unable to stat checkpoint %s: %s", file, dsc_strerror(errno, errbuf, sizeof(errbuf)));
+        close(fd);
+        return 0;
+    }
+    if (st.st_size < (off_t)sizeof(checkpoint_header)) {
+        dsyslogf(LOG_ERR, "checkpoint %s: invalid size", file);
+        close(fd);
+        return 0;
+    }
+    map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        dsyslogf(LOG_ERR, "unable to mmap checkpoint %s: %s", file, dsc_strerror(errno, errbuf, sizeof(errbuf)));
+        return 0;
+    }
+
+    h    = map;
+    data = map;
+    size = st.st_size;
+    if (memcmp(h->magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC))) {
+        dsyslogf(LOG_ERR, "checkpoint %s: not a checkpoint", file);
+    } else if (h->byte_order != CHECKPOINT_BYTE_ORDER) {
+        dsyslogf(LOG_ERR, "checkpoint %s: created on a host with different byte order", file);
+    } else if (h->version != CHECKPOINT_VERSION) {
+        dsyslogf(LOG_ERR, "checkpoint %s: unsupported version %u", file, h->version);
+    } else if (h->checksum != checkpoint_checksum(2166136261U, data + sizeof(*h), size - sizeof(*h))) {
+        dsyslogf(LOG_ERR, "checkpoint %s: checksum mismatch", file);
+    } else {
+        ret = 1;
+        off = sizeof(*h);
+        for (i = 0; i < h->sections; i++) {
+            if (size - off < sizeof(s)) {
+                dsyslogf(LOG_ERR, "checkpoint %s: invalid section size", file);
+                ret = 0;
+                break;
+            }
+            memcpy(&s, data + off, sizeof(s));
+            off += sizeof(s);
+            if (s.size > size - off) {
+                dsyslogf(LOG_ERR, "checkpoint %s: invalid section size", file);
+                ret = 0;
+                break;
+            }
+            if ((p = checkpoint_part_find(s.type)) && !p->verify(data + off, s.size)) {
+                dsyslogf(LOG_ERR, "checkpoint %s: invalid %s section", file, p->name);
+                ret = 0;
+                break;
+            }
+            off += s.size;
+        }
+        if (ret && off != size) {
+            dsyslogf(LOG_ERR, "checkpoint %s: data after the last section", file);
+            ret = 0;
+        }
+    }
+
+    if (ret) {
+        off = sizeof(*h);
+        for (i = 0; i < h->sections; i++) {
+            memcpy(&s, data + off, sizeof(s));
+            off += sizeof(s);
+            if ((p = checkpoint_part_find(s.type))) {
+                p->load(data + off, s.size);
+            } else {
+                dsyslogf(LOG_NOTICE, "checkpoint %s: skipping unknown section %u", file, s.type);
+            }
+            off += s.size;
+        }
+        dsyslogf(LOG_INFO, "checkpoint %s restored, saved %ld seconds ago", file, (long)(time(NULL) - h->saved));
+    }
+
+    munmap(map, size);
+    return ret;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2008-2023, OARC, Inc.
+ * Copyright (c) 2007-2008, Internet Systems Consortium, Inc.
+ * Copyright (c) 2003-2007, The Measurement Factory, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __dsc_checkpoint_h
+#define __dsc_checkpoint_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Checkpoint of the state that is carried between statistics intervals,
+ * written on exit and optionally on a timer and read back at start so a
+ * restart does not lose pending response_time queries or TCP reassembly.
+ *
+ * The header is followed by sections, each a checkpoint_section and its
+ * data. All values are in the byte order of the host that wrote it.
+ */
+
+#define CHECKPOINT_MAGIC "DSC-CKP"
+#define CHECKPOINT_BYTE_ORDER 0x01020304
+#define CHECKPOINT_VERSION 1
+
+#define CHECKPOINT_RESPONSE_TIME 1
+#define CHECKPOINT_TCP 2
+
+typedef struct checkpoint_header checkpoint_header;
+struct checkpoint_header {
+    char     magic[8];
+    uint32_t byte_order;
+    uint32_t version;
+    uint32_t checksum; /* 32 bit FNV-1a of everything after the header */
+    uint32_t sections;
+    int64_t  saved; /* time() when written */
+};
+
+typedef struct checkpoint_section checkpoint_section;
+struct checkpoint_section {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t size; /* of the data following */
+};
+
+typedef struct checkpoint checkpoint;
+struct checkpoint {
+    FILE*    fp;
+    uint64_t size; /* written to the current section */
+    int      error;
+};
+
+void checkpoint_write(checkpoint* c, const void* data, size_t len);
+int  checkpoint_save(const char* file);
+int  checkpoint_load(const char* file);
+
+#endif /* __dsc_checkpoint_h */
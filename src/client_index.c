@@ -38,65 +38,67 @@
 
 #include "client_index.h"
 #include "xmalloc.h"
-#include "hashtbl.h"
+#include "label_dict.h"
 #include "inX_addr.h"
-
-#define MAX_ARRAY_SZ 65536
-static hashtbl* theHash  = NULL;
-static int      next_idx = 0;
+#include "v4_table.h"
 
 typedef struct
 {
-    inX_addr addr;
-    int      index;
+    label_dict_entry e;
+    inX_addr         addr;
 } ipaddrobj;
 
+static label_dict dict = LABEL_DICT_INIT((hashfunc*)inXaddr_hash, (hashkeycmp*)inXaddr_cmp, xfree);
+static v4_table   v4   = V4_TABLE_INIT;
+
 int client_indexer(const dns_message* m)
 {
-    ipaddrobj* obj;
-    inX_addr*  client_ip_addr = m->qr ? &m->tm->dst_ip_addr : &m->tm->src_ip_addr;
+    ipaddrobj*   obj;
+    inX_addr*    client_ip_addr = m->qr ? &m->tm->dst_ip_addr : &m->tm->src_ip_addr;
+    unsigned int hv;
+    void**       slot;
 
     if (m->malformed)
         return -1;
-    if (NULL == theHash) {
-        theHash = hash_create(MAX_ARRAY_SZ, (hashfunc*)inXaddr_hash, (hashkeycmp*)inXaddr_cmp, 1, NULL, afree);
-        if (NULL == theHash)
-            return -1;
+    /* the table is rebuilt each interval so its objects are already seen */
+    if ((slot = v4_table_slot(&v4, client_ip_addr)) && *slot)
+        return ((ipaddrobj*)*slot)->e.index;
+    hv = inXaddr_hash(client_ip_addr);
+    if ((obj = (ipaddrobj*)label_dict_find(&dict, client_ip_addr, hv))) {
+        if (slot)
+            *slot = obj;
+        return obj->e.index;
     }
-    if ((obj = hash_find(client_ip_addr, theHash)))
-        return obj->index;
-    obj = acalloc(1, sizeof(*obj));
+    obj = label_dict_alloc(&dict, sizeof(*obj));
     if (NULL == obj)
         return -1;
-    obj->addr  = *client_ip_addr;
-    obj->index = next_idx;
-    if (0 != hash_add(&obj->addr, obj, theHash)) {
-        afree(obj);
+    obj->addr = *client_ip_addr;
+    if (label_dict_add(&dict, &obj->addr, hv, &obj->e) < 0) {
+        label_dict_free(&dict, obj);
         return -1;
     }
-    next_idx++;
-    return obj->index;
+    if (slot)
+        *slot = obj;
+    return obj->e.index;
 }
 
 int client_iterator(const char** label)
 {
     ipaddrobj*  obj;
     static char label_buf[128];
-    if (0 == next_idx)
+    if (0 == dict.next_idx)
         return -1;
-    if (NULL == label) {
-        hash_iter_init(theHash);
-        return next_idx;
-    }
-    if ((obj = hash_iterate(theHash)) == NULL)
+    if (NULL == label)
+        return label_dict_iter_init(&dict);
+    if ((obj = (ipaddrobj*)label_dict_iterate(&dict)) == NULL)
         return -1;
     inXaddr_ntop(&obj->addr, label_buf, 128);
     *label = label_buf;
-    return obj->index;
+    return obj->e.index;
 }
 
 void client_reset()
 {
-    theHash  = NULL;
-    next_idx = 0;
+    v4_table_reset(&v4);
+    label_dict_reset(&dict);
 }
@@ -46,6 +46,11 @@
 #include "input_mode.h"
 #include "dnstap.h"
 #include "tld_list.h"
+#include "tld_snapshot.h"
+#include "parse_conf.h"
+#include "dns_message.h"
+#include "country_index.h"
+#include "asn_index.h"
 
 #include "knowntlds.inc"
 
@@ -96,6 +101,9 @@ int             pcap_buffer_size     = 0;
 int             no_wait_interval     = 0;
 int             pt_timeout           = 100;
 int             drop_ip_fragments    = 0;
+char*           checkpoint_file      = NULL;
+uint64_t        checkpoint_interval  = 0;
+int             persistent_labels    = 0;
 #ifdef HAVE_GEOIP
 enum geoip_backend asn_indexer_backend     = geoip_backend_libgeoip;
 enum geoip_backend country_indexer_backend = geoip_backend_libgeoip;
@@ -110,8 +118,11 @@ enum geoip_backend country_indexer_backend = geoip_backend_none;
 #endif
 char* maxminddb_asn     = NULL;
 char* maxminddb_country = NULL;
+int   maxminddb_flatten = 0;
 
 extern int  ip_local_address(const char*, const char*);
+extern void ip_local_reload_start(void);
+extern void ip_local_reload_finish(int);
 extern void pcap_set_match_vlan(int);
 
 int open_interface(const char* interface)
@@ -231,7 +242,7 @@ int set_pid_file(const char* s)
 static unsigned int
 dataset_hashfunc(const void* key)
 {
-    return hashendian(key, strlen(key), 0);
+    return hash_keyed(key, strlen(key));
 }
 
 static int
@@ -273,7 +284,7 @@ int add_dataset(const char* name, const char* layer_ignored,
     }
 
     if (!dataset_hash) {
-        if (!(dataset_hash = hash_create(MAX_HASH_SIZE, dataset_hashfunc, dataset_cmpfunc, 0, xfree, xfree))) {
+        if (!(dataset_hash = hash_create(MAX_HASH_SIZE, dataset_hashfunc, dataset_cmpfunc, 0, xfree, 0))) {
             dsyslogf(LOG_ERR, "unable to create dataset %s due to internal error", name);
             return 0;
         }
@@ -486,6 +497,13 @@ int set_maxminddb_country(const char* file)
     return 0;
 }
 
+void set_maxminddb_flatten(void)
+{
+    dsyslog(LOG_INFO, "flattening Maxmind databases");
+
+    maxminddb_flatten = 1;
+}
+
 int set_pcap_buffer_size(const char* s)
 {
     dsyslogf(LOG_INFO, "Setting pcap buffer size to: %s", s);
@@ -543,6 +561,8 @@ int set_response_time_mode(const char* s)
         response_time_set_mode(response_time_log10);
     } else if (!strcmp(s, "log2")) {
         response_time_set_mode(response_time_log2);
+    } else if (!strcmp(s, "hdr")) {
+        response_time_set_mode(response_time_hdr);
     } else {
         dsyslogf(LOG_ERR, "invalid response time mode %s", s);
         return 0;
@@ -615,9 +635,124 @@ int set_response_time_bucket_size(const char* s)
     return 1;
 }
 
+int set_response_time_significant_digits(const char* s)
+{
+    int digits = atoi(s);
+    if (digits < 1 || digits > 3) {
+        dsyslogf(LOG_ERR, "invalid response time significant digits %s", s);
+        return 0;
+    }
+    response_time_set_significant_digits(digits);
+    dsyslogf(LOG_INFO, "set response time significant digits to %d", digits);
+    return 1;
+}
+
+void set_response_time_percentiles(void)
+{
+    response_time_set_percentiles(1);
+    dsyslog(LOG_INFO, "enabled response time percentiles");
+}
+
 const char** KnownTLDS = KnownTLDS_static;
 
-int load_knowntlds(const char* file)
+/*
+ * Hash set over KnownTLDS, open addressing on the same hash as
+ * dns_message_nld_hash() so lookups can use the hash of the message's TLD
+ */
+typedef struct
+{
+    unsigned int hv;
+    unsigned int idx; // index in KnownTLDS plus one, zero if empty
+} knowntld_slot;
+
+static knowntld_slot* knowntlds_set  = 0;
+static unsigned int   knowntlds_mask = 0;
+
+static int build_knowntlds_set(void)
+{
+    size_t       n, i, size = 1;
+    unsigned int h;
+
+    for (n = 0; KnownTLDS[n]; n++)
+        ;
+    while (size < n * 2)
+        size <<= 1;
+
+    xfree(knowntlds_set);
+    if (!(knowntlds_set = xcalloc(size, sizeof(*knowntlds_set)))) {
+        dsyslog(LOG_ERR, "out of memory");
+        return 0;
+    }
+    knowntlds_mask = size - 1;
+    for (i = 0; i < n; i++) {
+        unsigned int hv = hash_keyed(KnownTLDS[i], strlen(KnownTLDS[i]));
+        for (h = hv & knowntlds_mask; knowntlds_set[h].idx; h = (h + 1) & knowntlds_mask)
+            ;
+        knowntlds_set[h].hv  = hv;
+        knowntlds_set[h].idx = i + 1;
+    }
+    return 1;
+}
+
+/*
+ * Check if tld is a known TLD, hv must be the hash_keyed() of tld
+ */
+int is_known_tld(const char* tld, unsigned int hv)
+{
+    unsigned int h;
+
+    if (!knowntlds_set && !build_knowntlds_set()) {
+        size_t i;
+        for (i = 0; KnownTLDS[i]; i++)
+            if (0 == strcmp(KnownTLDS[i], tld))
+                return 1;
+        return 0;
+    }
+    for (h = hv & knowntlds_mask; knowntlds_set[h].idx; h = (h + 1) & knowntlds_mask) {
+        if (knowntlds_set[h].hv == hv && 0 == strcmp(KnownTLDS[knowntlds_set[h].idx - 1], tld))
+            return 1;
+    }
+    return 0;
+}
+
+static int load_knowntlds_snapshot(const char* snapshot)
+{
+    tld_snapshot s;
+    const char*  p;
+    const char** new_KnownTLDS;
+    size_t       i;
+
+    if (!tld_snapshot_open(snapshot, &s))
+        return 0;
+    if (!s.knowntlds || s.knowntlds[s.knowntlds_size - 1]) {
+        dsyslogf(LOG_ERR, "snapshot %s: no known TLDs", snapshot);
+        return 0;
+    }
+    if (!(new_KnownTLDS = xmalloc((s.knowntlds_count + 2) * sizeof(char*)))) {
+        dsyslog(LOG_ERR, "out of memory");
+        return 0;
+    }
+    new_KnownTLDS[0] = ".";
+    for (i = 0, p = s.knowntlds; i < s.knowntlds_count; i++) {
+        if (p >= s.knowntlds + s.knowntlds_size) {
+            dsyslogf(LOG_ERR, "snapshot %s: invalid known TLDs", snapshot);
+            xfree(new_KnownTLDS);
+            return 0;
+        }
+        new_KnownTLDS[i + 1] = p;
+        p += strlen(p) + 1;
+    }
+    new_KnownTLDS[i + 1] = 0;
+
+    KnownTLDS = new_KnownTLDS;
+    if (!build_knowntlds_set())
+        return 0;
+    dsyslogf(LOG_INFO, "loaded %zd known TLDs from snapshot %s", s.knowntlds_count, snapshot);
+
+    return 1;
+}
+
+int load_knowntlds(const char* file, const char* snapshot)
 {
     FILE*  fp;
     char * buffer        = 0, *p;
@@ -630,6 +765,12 @@ int load_knowntlds(const char* file)
         return 0;
     }
 
+    if (snapshot) {
+        if (load_knowntlds_snapshot(snapshot))
+            return 1;
+        dsyslogf(LOG_INFO, "falling back to loading known TLDs from %s", file);
+    }
+
     if (!(fp = fopen(file, "r"))) {
         dsyslogf(LOG_ERR, "unable to open %s", file);
         return 0;
@@ -675,17 +816,33 @@ int load_knowntlds(const char* file)
     new_KnownTLDS[new_size] = 0;
 
     KnownTLDS = (const char**)new_KnownTLDS;
+    if (!build_knowntlds_set())
+        return 0;
     dsyslogf(LOG_INFO, "loaded %zd known TLDs from %s", new_size - 1, file);
 
     return 1;
 }
 
-int load_tld_list(const char* file)
+int load_tld_list(const char* file, const char* snapshot)
 {
     FILE*  fp;
     char * buffer  = 0, *p;
     size_t bufsize = 0;
 
+    if (snapshot) {
+        tld_snapshot s;
+
+        if (tld_snapshot_open(snapshot, &s)) {
+            if (!s.trie) {
+                dsyslogf(LOG_ERR, "snapshot %s: no TLD list", snapshot);
+            } else if (tld_list_load_snapshot(s.trie, s.trie_size)) {
+                dsyslogf(LOG_INFO, "loaded TLD list from snapshot %s", snapshot);
+                return 1;
+            }
+        }
+        dsyslogf(LOG_INFO, "falling back to loading TLD list from %s", file);
+    }
+
     if (!(fp = fopen(file, "r"))) {
         dsyslogf(LOG_ERR, "unable to open %s", file);
         return 0;
@@ -706,6 +863,8 @@ int load_tld_list(const char* file)
     }
     free(buffer);
     fclose(fp);
+    if (!tld_list_compile())
+        return 0;
 
     dsyslogf(LOG_INFO, "loaded TLD list from %s", file);
 
@@ -754,3 +913,109 @@ int set_output_mod(const char* mod)
 
     return 1;
 }
+
+int set_checkpoint_file(const char* file)
+{
+    char errbuf[512];
+
+    if (checkpoint_file)
+        xfree(checkpoint_file);
+    if ((checkpoint_file = xstrdup(file))) {
+        dsyslogf(LOG_INFO, "checkpoint file %s", checkpoint_file);
+        return 1;
+    }
+
+    dsyslogf(LOG_ERR, "unable to set checkpoint file, strdup: %s", dsc_strerror(errno, errbuf, sizeof(errbuf)));
+    return 0;
+}
+
+int set_checkpoint_interval(const char* s)
+{
+    dsyslogf(LOG_INFO, "Setting checkpoint interval to: %s", s);
+    checkpoint_interval = strtoull(s, NULL, 10);
+    if (checkpoint_interval == ULLONG_MAX) {
+        char errbuf[512];
+        dsyslogf(LOG_ERR, "strtoull: %s", dsc_strerror(errno, errbuf, sizeof(errbuf)));
+        return 0;
+    }
+    return 1;
+}
+
+int set_persistent_labels(const char* s)
+{
+    dsyslogf(LOG_INFO, "Setting persistent labels to: %s", s);
+    persistent_labels = atoi(s);
+    if (persistent_labels < 0) {
+        dsyslog(LOG_ERR, "persistent_labels can not be negative");
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Read the configuration again between statistics intervals, the datasets,
+ * filters, local addresses and GeoIP databases are replaced and everything
+ * else keeps the value it got at start. Returns zero and keeps the current
+ * configuration if the new one has errors.
+ */
+int reload_conf(const char* file)
+{
+    char**   geo[]      = { &geoip_v4_dat, &geoip_v6_dat, &geoip_asn_v4_dat, &geoip_asn_v6_dat, &maxminddb_asn, &maxminddb_country };
+    int*     geo_opts[] = { &geoip_v4_options, &geoip_v6_options, &geoip_asn_v4_options, &geoip_asn_v6_options };
+    char*    old_geo[sizeof(geo) / sizeof(*geo)];
+    int      old_geo_opts[sizeof(geo_opts) / sizeof(*geo_opts)];
+    hashtbl* old_datasets = dataset_hash;
+    int      old_rt_used  = response_time_indexer_used;
+    int      ok, reopen_country = 0;
+    size_t   i;
+
+    dsyslogf(LOG_INFO, "reloading configuration %s", file);
+
+    for (i = 0; i < sizeof(geo) / sizeof(*geo); i++) {
+        old_geo[i] = *geo[i];
+        *geo[i]    = NULL;
+    }
+    for (i = 0; i < sizeof(geo_opts) / sizeof(*geo_opts); i++)
+        old_geo_opts[i] = *geo_opts[i];
+    dataset_hash               = NULL;
+    response_time_indexer_used = 0;
+    dns_message_reload_start();
+    ip_local_reload_start();
+
+    ok = !parse_conf_reload(file);
+    if (ok && !country_reload()) {
+        ok = 0;
+    } else if (ok && !asn_reload()) {
+        // the country databases are already replaced, open the old again
+        ok             = 0;
+        reopen_country = 1;
+    }
+
+    if (!ok) {
+        if (dataset_hash)
+            hash_destroy(dataset_hash);
+        dataset_hash               = old_datasets;
+        response_time_indexer_used = old_rt_used;
+        for (i = 0; i < sizeof(geo) / sizeof(*geo); i++) {
+            xfree(*geo[i]);
+            *geo[i] = old_geo[i];
+        }
+        for (i = 0; i < sizeof(geo_opts) / sizeof(*geo_opts); i++)
+            *geo_opts[i] = old_geo_opts[i];
+        dns_message_reload_finish(0);
+        ip_local_reload_finish(0);
+        if (reopen_country)
+            country_reload();
+        dsyslogf(LOG_ERR, "unable to reload configuration %s, keeping the current configuration", file);
+        return 0;
+    }
+
+    if (old_datasets)
+        hash_destroy(old_datasets);
+    for (i = 0; i < sizeof(geo) / sizeof(*geo); i++)
+        xfree(old_geo[i]);
+    dns_message_reload_finish(1);
+    ip_local_reload_finish(1);
+    dsyslog(LOG_INFO, "configuration reloaded, changes to options other than datasets, filters, local_address and GeoIP databases need a restart");
+    return 1;
+}
@@ -47,6 +47,8 @@ enum dnstap_via {
 
 extern const char** KnownTLDS;
 
+int is_known_tld(const char* tld, unsigned int hv);
+
 int  open_interface(const char* interface);
 int  open_dnstap(enum dnstap_via via, const char* file_or_ip, const char* port, const char* user, const char* group, const char* umask);
 int  set_bpf_program(const char* s);
@@ -68,6 +70,7 @@ int  set_asn_indexer_backend(enum geoip_backend backend);
 int  set_country_indexer_backend(enum geoip_backend backend);
 int  set_maxminddb_asn(const char* file);
 int  set_maxminddb_country(const char* file);
+void set_maxminddb_flatten(void);
 int  set_pcap_buffer_size(const char* s);
 void set_no_wait_interval(void);
 int  set_pt_timeout(const char* s);
@@ -79,10 +82,16 @@ int  set_response_time_full_mode(const char* s);
 int  set_response_time_max_seconds(const char* s);
 int  set_response_time_max_sec_mode(const char* s);
 int  set_response_time_bucket_size(const char* s);
-int  load_knowntlds(const char* file);
-int  load_tld_list(const char* file);
+int  set_response_time_significant_digits(const char* s);
+void set_response_time_percentiles(void);
+int  load_knowntlds(const char* file, const char* snapshot);
+int  load_tld_list(const char* file, const char* snapshot);
 int  set_output_user(const char* user);
 int  set_output_group(const char* group);
 int  set_output_mod(const char* mod);
+int  set_checkpoint_file(const char* file);
+int  set_checkpoint_interval(const char* s);
+int  set_persistent_labels(const char* s);
+int  reload_conf(const char* file);
 
 #endif /* __dsc_config_hooks_h */
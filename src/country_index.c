@@ -40,14 +40,19 @@
 #include "xmalloc.h"
 #include "hashtbl.h"
 #include "syslog_debug.h"
+#include "geo_cache.h"
 #include "geoip.h"
 #if defined(HAVE_LIBGEOIP) && defined(HAVE_GEOIP_H)
 #define HAVE_GEOIP 1
 #include <GeoIP.h>
+#ifdef HAVE_GEOIP_COUNTRY_CODE_BY_ADDR_GL
+#define HAVE_GEOIP_GL 1
+#endif
 #endif
 #if defined(HAVE_LIBMAXMINDDB) && defined(HAVE_MAXMINDDB_H)
 #define HAVE_MAXMINDDB 1
-#include <maxminddb.h>
+#include "geo_mmdb.h"
+#include "geo_flat.h"
 #endif
 
 #ifdef HAVE_MAXMINDDB
@@ -68,6 +73,7 @@ extern char*              geoip_v6_dat;
 extern int                geoip_v6_options;
 extern enum geoip_backend country_indexer_backend;
 extern char*              maxminddb_country;
+extern int                maxminddb_flatten;
 static hashfunc           country_hashfunc;
 static hashkeycmp         country_cmpfunc;
 
@@ -79,26 +85,71 @@ static GeoIP* geoip  = NULL;
 static GeoIP* geoip6 = NULL;
 #endif
 #ifdef HAVE_MAXMINDDB
-static MMDB_s mmdb;
-static char   _mmcountry[32];
-static int    have_mmdb = 0;
+static MMDB_s* mmdb = NULL;
+static char    _mmcountry[32];
+#ifdef HAVE_GEO_FLAT
+static geo_flat_db* flat = NULL;
+#endif
 #endif
 static char  ipstr[81];
 static char* unknown    = "??";
 static char* unknown_v4 = "?4";
 static char* unknown_v6 = "?6";
 
+static geo_cache* cache = NULL;
+
 typedef struct
 {
     char* country;
     int   index;
 } countryobj;
 
-const char*
-country_get_from_message(dns_message* m)
+#ifdef HAVE_MAXMINDDB
+/*
+ * The country code of a MaxMind DB entry, or NULL if it has none
+ */
+static const char*
+country_mmdb_value(MMDB_entry_s* entry, char* buf, size_t len)
+{
+    MMDB_entry_data_s entry_data;
+    size_t            n;
+
+    if (MMDB_get_value(entry, &entry_data, "country", "iso_code", 0) != MMDB_SUCCESS
+        || entry_data.type != MMDB_DATA_TYPE_UTF8_STRING)
+        return NULL;
+
+    n = entry_data.data_size > (len - 1) ? (len - 1) : entry_data.data_size;
+    memcpy(buf, entry_data.utf8_string, n);
+    buf[n] = 0;
+    return buf;
+}
+
+static const char*
+country_mmdb_lookup(transport_message* tm, int* bits)
 {
-    transport_message* tm = m->tm;
-    const char*        cc = unknown;
+    MMDB_lookup_result_s r;
+
+#ifdef HAVE_GEO_FLAT
+    if (flat)
+        return geo_flat_lookup(flat, &tm->src_ip_addr);
+#endif
+    if (mmdb && geo_mmdb_lookup(mmdb, &tm->src_ip_addr, &r, bits) && r.found_entry)
+        return country_mmdb_value(&r.entry, _mmcountry, sizeof(_mmcountry));
+    return NULL;
+}
+#endif
+
+/*
+ * Look up the address in the database, bits is set to the length of the
+ * network the result is valid for if it can be cached
+ */
+static const char*
+country_lookup(transport_message* tm, int* bits)
+{
+    const char* cc = unknown;
+#ifdef HAVE_GEOIP_GL
+    GeoIPLookup gl;
+#endif
 
     if (country_indexer_backend == geoip_backend_libgeoip) {
         if (!inXaddr_ntop(&tm->src_ip_addr, ipstr, sizeof(ipstr) - 1)) {
@@ -113,7 +164,13 @@ country_get_from_message(dns_message* m)
         case geoip_backend_libgeoip:
 #ifdef HAVE_GEOIP
             if (geoip) {
-                cc = GeoIP_country_code_by_addr(geoip, ipstr);
+#ifdef HAVE_GEOIP_GL
+                cc    = GeoIP_country_code_by_addr_gl(geoip, ipstr, &gl);
+                *bits = gl.netmask;
+#else
+                cc    = GeoIP_country_code_by_addr(geoip, ipstr);
+                *bits = 24;
+#endif
                 if (cc == NULL) {
                     cc = unknown_v4;
                 }
@@ -122,29 +179,8 @@ country_get_from_message(dns_message* m)
             break;
         case geoip_backend_libmaxminddb:
 #ifdef HAVE_MAXMINDDB
-            if (have_mmdb) {
-                struct sockaddr_in   s;
-                int                  ret;
-                MMDB_lookup_result_s r;
-
-                s.sin_family = AF_INET;
-                s.sin_addr   = tm->src_ip_addr.in4;
-
-                r = MMDB_lookup_sockaddr(&mmdb, (struct sockaddr*)&s, &ret);
-                if (ret == MMDB_SUCCESS && r.found_entry) {
-                    MMDB_entry_data_s entry_data;
-
-                    if (MMDB_get_value(&r.entry, &entry_data, "country", "iso_code", 0) == MMDB_SUCCESS
-                        && entry_data.type == MMDB_DATA_TYPE_UTF8_STRING) {
-                        size_t len = entry_data.data_size > (sizeof(_mmcountry) - 1) ? (sizeof(_mmcountry) - 1) : entry_data.data_size;
-                        memcpy(_mmcountry, entry_data.utf8_string, len);
-                        _mmcountry[len] = 0;
-                        cc              = _mmcountry;
-                        break;
-                    }
-                }
-            }
-            cc = unknown_v4;
+            if (!(cc = country_mmdb_lookup(tm, bits)))
+                cc = unknown_v4;
 #endif
             break;
         default:
@@ -157,7 +193,13 @@ country_get_from_message(dns_message* m)
         case geoip_backend_libgeoip:
 #ifdef HAVE_GEOIP
             if (geoip6) {
-                cc = GeoIP_country_code_by_addr_v6(geoip6, ipstr);
+#ifdef HAVE_GEOIP_GL
+                cc    = GeoIP_country_code_by_addr_v6_gl(geoip6, ipstr, &gl);
+                *bits = gl.netmask;
+#else
+                cc    = GeoIP_country_code_by_addr_v6(geoip6, ipstr);
+                *bits = 48;
+#endif
                 if (cc == NULL) {
                     cc = unknown_v6;
                 }
@@ -166,29 +208,8 @@ country_get_from_message(dns_message* m)
             break;
         case geoip_backend_libmaxminddb:
 #ifdef HAVE_MAXMINDDB
-            if (have_mmdb) {
-                struct sockaddr_in6  s;
-                int                  ret;
-                MMDB_lookup_result_s r;
-
-                s.sin6_family = AF_INET;
-                s.sin6_addr   = tm->src_ip_addr.in6;
-
-                r = MMDB_lookup_sockaddr(&mmdb, (struct sockaddr*)&s, &ret);
-                if (ret == MMDB_SUCCESS && r.found_entry) {
-                    MMDB_entry_data_s entry_data;
-
-                    if (MMDB_get_value(&r.entry, &entry_data, "country", "iso_code", 0) == MMDB_SUCCESS
-                        && entry_data.type == MMDB_DATA_TYPE_UTF8_STRING) {
-                        size_t len = entry_data.data_size > (sizeof(_mmcountry) - 1) ? (sizeof(_mmcountry) - 1) : entry_data.data_size;
-                        memcpy(_mmcountry, entry_data.utf8_string, len);
-                        _mmcountry[len] = 0;
-                        cc              = _mmcountry;
-                        break;
-                    }
-                }
-            }
-            cc = unknown_v6;
+            if (!(cc = country_mmdb_lookup(tm, bits)))
+                cc = unknown_v6;
 #endif
             break;
         default:
@@ -200,6 +221,25 @@ country_get_from_message(dns_message* m)
         break;
     }
 
+    return cc;
+}
+
+const char*
+country_get_from_message(dns_message* m)
+{
+    const char* cc;
+    int         bits = -1;
+
+    if (m->country)
+        return m->country;
+
+    if (!(cc = geo_cache_find(cache, &m->tm->src_ip_addr))) {
+        cc = country_lookup(m->tm, &bits);
+        if (bits >= 0)
+            geo_cache_add(cache, &m->tm->src_ip_addr, bits, cc);
+    }
+    m->country = cc;
+
     dfprintf(1, "country_index: country code: %s", cc);
     return cc;
 }
@@ -256,6 +296,10 @@ int country_iterator(const char** label)
 
 void country_reset()
 {
+    geo_cache_report(cache);
+#ifdef HAVE_GEO_FLAT
+    geo_flat_check(flat);
+#endif
     theHash  = NULL;
     next_idx = 0;
 }
@@ -263,7 +307,7 @@ void country_reset()
 static unsigned int
 country_hashfunc(const void* key)
 {
-    return hashendian(key, strlen(key), 0);
+    return hash_keyed(key, strlen(key));
 }
 
 static int
@@ -272,7 +316,11 @@ country_cmpfunc(const void* a, const void* b)
     return strcasecmp(a, b);
 }
 
-void country_init(void)
+/*
+ * Open the configured databases, returns zero if one of them can not be
+ * opened
+ */
+static int country_open(void)
 {
     switch (country_indexer_backend) {
     case geoip_backend_libgeoip:
@@ -281,18 +329,19 @@ void country_init(void)
             geoip = GeoIP_open(geoip_v4_dat, geoip_v4_options);
             if (geoip == NULL) {
                 dsyslog(LOG_ERR, "country_index: Error opening IPv4 Country DB. Make sure libgeoip's GeoIP.dat file is available");
-                exit(1);
+                return 0;
             }
         }
         if (geoip_v6_dat) {
             geoip6 = GeoIP_open(geoip_v6_dat, geoip_v6_options);
             if (geoip6 == NULL) {
                 dsyslog(LOG_ERR, "country_index: Error opening IPv6 Country DB. Make sure libgeoip's GeoIPv6.dat file is available");
-                exit(1);
+                return 0;
             }
         }
         memset(ipstr, 0, sizeof(ipstr));
         if (geoip || geoip6) {
+            cache = geo_cache_create("country_index");
             dsyslog(LOG_INFO, "country_index: Sucessfully initialized GeoIP");
         } else {
             dsyslog(LOG_INFO, "country_index: No database loaded for GeoIP");
@@ -305,16 +354,22 @@ void country_init(void)
             int  ret;
             char errbuf[512];
 
-            ret = MMDB_open(maxminddb_country, 0, &mmdb);
+#ifdef HAVE_GEO_FLAT
+            if (maxminddb_flatten)
+                flat = geo_flat_open(maxminddb_country, country_mmdb_value, &ret);
+            else
+#endif
+                mmdb = geo_mmdb_open(maxminddb_country, &ret);
             if (ret == MMDB_IO_ERROR) {
                 dsyslogf(LOG_ERR, "country_index: Error opening MaxMind Country, IO error: %s", dsc_strerror(errno, errbuf, sizeof(errbuf)));
-                exit(1);
+                return 0;
             } else if (ret != MMDB_SUCCESS) {
                 dsyslogf(LOG_ERR, "country_index: Error opening MaxMind Country: %s", MMDB_strerror(ret));
-                exit(1);
+                return 0;
             }
             dsyslog(LOG_INFO, "country_index: Sucessfully initialized MaxMind Country");
-            have_mmdb = 1;
+            if (mmdb)
+                cache = geo_cache_create("country_index");
         } else {
             dsyslog(LOG_INFO, "country_index: No database loaded for MaxMind Country");
         }
@@ -323,4 +378,110 @@ void country_init(void)
     default:
         break;
     }
+    return 1;
+}
+
+struct country_dbs {
+#ifdef HAVE_GEOIP
+    GeoIP* geoip;
+    GeoIP* geoip6;
+#endif
+#ifdef HAVE_MAXMINDDB
+    MMDB_s* mmdb;
+#ifdef HAVE_GEO_FLAT
+    geo_flat_db* flat;
+#endif
+#endif
+    geo_cache* cache;
+};
+
+static void country_save(struct country_dbs* d)
+{
+#ifdef HAVE_GEOIP
+    d->geoip  = geoip;
+    d->geoip6 = geoip6;
+    geoip = geoip6 = NULL;
+#endif
+#ifdef HAVE_MAXMINDDB
+    d->mmdb = mmdb;
+    mmdb    = NULL;
+#ifdef HAVE_GEO_FLAT
+    d->flat = flat;
+    flat    = NULL;
+#endif
+#endif
+    d->cache = cache;
+    cache    = NULL;
+}
+
+static void country_restore(const struct country_dbs* d)
+{
+#ifdef HAVE_GEOIP
+    geoip  = d->geoip;
+    geoip6 = d->geoip6;
+#endif
+#ifdef HAVE_MAXMINDDB
+    mmdb = d->mmdb;
+#ifdef HAVE_GEO_FLAT
+    flat = d->flat;
+#endif
+#endif
+    cache = d->cache;
+}
+
+static void country_close(void)
+{
+#ifdef HAVE_GEOIP
+    if (geoip)
+        GeoIP_delete(geoip);
+    if (geoip6)
+        GeoIP_delete(geoip6);
+    geoip = geoip6 = NULL;
+#endif
+#ifdef HAVE_MAXMINDDB
+    if (mmdb)
+        geo_mmdb_close(mmdb);
+    mmdb = NULL;
+#ifdef HAVE_GEO_FLAT
+    if (flat)
+        geo_flat_close(flat);
+    flat = NULL;
+#endif
+#endif
+    geo_cache_free(cache);
+    cache = NULL;
+}
+
+void country_init(void)
+{
+    /* results cached for the previous database are no longer valid */
+    geo_cache_free(cache);
+    cache = NULL;
+
+    if (!country_open())
+        exit(1);
+}
+
+/*
+ * Open the databases again after the configuration has been reloaded, the
+ * databases in use are kept if any of the new ones can not be opened
+ */
+int country_reload(void)
+{
+    struct country_dbs old, new;
+
+    country_save(&old);
+    if (!country_open()) {
+        country_close();
+        country_restore(&old);
+        dsyslog(LOG_ERR, "country_index: Keeping the country databases in use");
+        return 0;
+    }
+    country_save(&new);
+    country_restore(&old);
+    country_close();
+    country_restore(&new);
+    theHash  = NULL;
+    next_idx = 0;
+    return 1;
 }
@@ -43,5 +43,6 @@ int  country_indexer(const dns_message*);
 int  country_iterator(const char** label);
 void country_reset(void);
 void country_init(void);
+int  country_reload(void);
 
 #endif /* __dsc_country_index_h */
@@ -40,11 +40,14 @@
 #include "pcap.h"
 #include "syslog_debug.h"
 #include "parse_conf.h"
+#include "config_hooks.h"
 #include "compat.h"
 #include "pcap-thread/pcap_thread.h"
 
 #include "input_mode.h"
 #include "dnstap.h"
+#include "checkpoint.h"
+#include "hashtbl.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -55,6 +58,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <limits.h>
 #if HAVE_STATVFS
 #if HAVE_SYS_STATVFS_H
 #include <sys/statvfs.h>
@@ -107,6 +111,8 @@ extern mode_t           output_mod;
 extern int              dump_reports_on_exit;
 extern uint64_t         statistics_interval;
 extern int              no_wait_interval;
+extern char*            checkpoint_file;
+extern uint64_t         checkpoint_interval;
 extern pcap_thread_t    pcap_thread;
 
 void daemonize(void)
@@ -294,7 +300,6 @@ dump_report(md_array_printer* printer)
 
     fputs(printer->start_file, fp);
 
-    /* amalloc_report(); */
     pcap_report(fp, printer);
     dns_message_report(fp, printer);
 
@@ -338,12 +343,28 @@ sig_exit(int signum)
     exit(0);
 }
 
+/*
+ * Only called by the main loop, the state in the checkpoint is changed by
+ * it
+ */
+static void
+exit_checkpoint(void)
+{
+    if (checkpoint_file)
+        checkpoint_save(checkpoint_file);
+    exit(0);
+}
+
 int sig_while_processing = 0;
 static void
 sig_exit_dumping(int signum)
 {
-    if (have_reports) {
-        dsyslogf(LOG_INFO, "Received signal %d while dumping reports, exiting later", signum);
+    if (have_reports || checkpoint_file) {
+        if (have_reports) {
+            dsyslogf(LOG_INFO, "Received signal %d while dumping reports, exiting later", signum);
+        } else {
+            dsyslogf(LOG_INFO, "Received signal %d, exiting after writing the checkpoint", signum);
+        }
         sig_while_processing = signum;
         switch (input_mode) {
         case INPUT_PCAP:
@@ -361,6 +382,19 @@ sig_exit_dumping(int signum)
     }
 }
 
+/*
+ * SIGHUP reloads the configuration, which is done between statistics
+ * intervals
+ */
+static volatile sig_atomic_t sig_reload = 0;
+static char*                 conf_file  = NULL;
+
+static void
+sig_reload_conf(int signum)
+{
+    sig_reload = 1;
+}
+
 #if HAVE_PTHREAD
 static void*
 sig_thread(void* arg)
@@ -368,12 +402,18 @@ sig_thread(void* arg)
     sigset_t* set = (sigset_t*)arg;
     int       sig, err;
 
-    if ((err = sigwait(set, &sig))) {
-        dsyslogf(LOG_DEBUG, "Error sigwait(): %d", err);
-        return 0;
+    for (;;) {
+        if ((err = sigwait(set, &sig))) {
+            dsyslogf(LOG_DEBUG, "Error sigwait(): %d", err);
+            return 0;
+        }
+        if (sig != SIGHUP)
+            break;
+        dsyslog(LOG_INFO, "Received SIGHUP, reloading configuration after this interval");
+        sig_reload = 1;
     }
 
-    if (dump_reports_on_exit)
+    if (dump_reports_on_exit || checkpoint_file)
         sig_exit_dumping(sig);
     else
         sig_exit(sig);
@@ -398,11 +438,13 @@ int main(int argc, char* argv[])
     struct timeval now;
     run_func       runf;
     close_func     closef;
+    time_t         last_checkpoint;
 
     progname = xstrdup(strrchr(argv[0], '/') ? strrchr(argv[0], '/') + 1 : argv[0]);
     if (NULL == progname)
         return 1;
     openlog(progname, LOG_PID | LOG_NDELAY, LOG_DAEMON);
+    hash_seed();
 
     while ((x = getopt(argc, argv, "fpdvmiTD")) != -1) {
         switch (x) {
@@ -452,11 +494,18 @@ int main(int argc, char* argv[])
 
     pcap_thread_set_activate_mode(&pcap_thread, PCAP_THREAD_ACTIVATE_MODE_DELAYED);
 
+    {
+        /* read again on SIGHUP, when run_dir may have changed the current directory */
+        char path[PATH_MAX];
+        conf_file = xstrdup(realpath(argv[0], path) ? path : argv[0]);
+    }
     dns_message_filters_init();
     if (parse_conf(argv[0])) {
         return 1;
     }
     dns_message_indexers_init();
+    if (checkpoint_file)
+        checkpoint_load(checkpoint_file);
     if (!output_format_xml && !output_format_json) {
         output_format_xml = 1;
     }
@@ -478,7 +527,8 @@ int main(int argc, char* argv[])
 
 #if HAVE_PTHREAD
     if (threads_flag) {
-        sigset_t set;
+        // waited on by the signal thread for as long as it runs
+        static sigset_t set;
 
         sigfillset(&set);
         if ((err = pthread_sigmask(SIG_BLOCK, &set, 0))) {
@@ -489,6 +539,7 @@ int main(int argc, char* argv[])
         sigemptyset(&set);
         sigaddset(&set, SIGTERM);
         sigaddset(&set, SIGQUIT);
+        sigaddset(&set, SIGHUP);
         if (nodaemon_flag)
             sigaddset(&set, SIGINT);
 
@@ -509,6 +560,7 @@ int main(int argc, char* argv[])
         sigfillset(&set);
         sigdelset(&set, SIGTERM);
         sigdelset(&set, SIGQUIT);
+        sigdelset(&set, SIGHUP);
         if (nodaemon_flag)
             sigdelset(&set, SIGINT);
 
@@ -518,7 +570,7 @@ int main(int argc, char* argv[])
         memset(&action, 0, sizeof(action));
         sigfillset(&action.sa_mask);
 
-        if (dump_reports_on_exit)
+        if (dump_reports_on_exit || checkpoint_file)
             action.sa_handler = sig_exit_dumping;
         else
             action.sa_handler = sig_exit;
@@ -529,6 +581,10 @@ int main(int argc, char* argv[])
             dsyslogf(LOG_ERR, "Unable to install signal handler for SIGQUIT: %s", dsc_strerror(errno, errbuf, sizeof(errbuf)));
         if (nodaemon_flag && sigaction(SIGINT, &action, NULL))
             dsyslogf(LOG_ERR, "Unable to install signal handler for SIGINT: %s", dsc_strerror(errno, errbuf, sizeof(errbuf)));
+
+        action.sa_handler = sig_reload_conf;
+        if (sigaction(SIGHUP, &action, NULL))
+            dsyslogf(LOG_ERR, "Unable to install signal handler for SIGHUP: %s", dsc_strerror(errno, errbuf, sizeof(errbuf)));
     }
 
     if (!debug_flag && 0 == n_pcap_offline && !no_wait_interval) {
@@ -574,8 +630,15 @@ int main(int argc, char* argv[])
     }
 
     dsyslog(LOG_INFO, "Running");
+    last_checkpoint = time(NULL);
 
     do {
+        if (sig_while_processing) {
+            // signaled between intervals
+            dsyslogf(LOG_INFO, "Received signal %d before, exiting now", sig_while_processing);
+            exit_checkpoint();
+        }
+
         useArena(); /* Initialize a memory arena for data collection. */
         if (debug_flag && break_start.tv_sec > 0) {
             gettimeofday(&now, NULL);
@@ -592,6 +655,12 @@ int main(int argc, char* argv[])
 
         dns_message_flush_arrays();
 
+        if (sig_while_processing && !dump_reports_on_exit) {
+            /* stopped only to write the checkpoint, the partial interval is not reported */
+            dsyslogf(LOG_INFO, "Received signal %d before, exiting now", sig_while_processing);
+            exit_checkpoint();
+        }
+
         if (0 == fork()) {
             struct sigaction action;
 
@@ -638,15 +707,29 @@ int main(int argc, char* argv[])
 
         if (sig_while_processing) {
             dsyslogf(LOG_INFO, "Received signal %d before, exiting now", sig_while_processing);
-            exit(0);
+            exit_checkpoint();
         }
         have_reports = 0;
 
         /* Parent quickly frees and clears its copy of the data so it can
          * resume processing packets. */
+        amalloc_report();
         freeArena();
         dns_message_clear_arrays();
 
+        if (sig_reload) {
+            sig_reload = 0;
+            reload_conf(conf_file);
+        }
+
+        if (checkpoint_file && checkpoint_interval) {
+            time_t t = time(NULL);
+            if (t - last_checkpoint >= (time_t)checkpoint_interval) {
+                checkpoint_save(checkpoint_file);
+                last_checkpoint = t;
+            }
+        }
+
         {
             /* Reap children. (Most recent probably has not exited yet, but
              * older ones should have.) */
@@ -662,6 +745,8 @@ int main(int argc, char* argv[])
 
     } while (result > 0 && (debug_flag == 0 || dont_exit));
 
+    if (checkpoint_file)
+        checkpoint_save(checkpoint_file);
     closef();
 
     return 0;
@@ -40,6 +40,10 @@
 #include "xmalloc.h"
 #include "syslog_debug.h"
 #include "tld_list.h"
+#include "hashtbl.h"
+#include "label_dict.h"
+#include "qname_filter.h"
+#include "filter_expr.h"
 
 #include "null_index.h"
 #include "qtype_index.h"
@@ -115,7 +119,7 @@ static indexer indexers[] = {
     { "dns_source_port", 0, dns_source_port_indexer, dns_source_port_iterator, dns_source_port_reset },
     { "dns_sport_range", 0, dns_sport_range_indexer, dns_sport_range_iterator, dns_sport_range_reset },
     { "qr_aa_bits", 0, qr_aa_bits_indexer, qr_aa_bits_iterator },
-    { "response_time", 0, response_time_indexer, response_time_iterator, response_time_reset, response_time_flush },
+    { "response_time", 0, response_time_indexer, response_time_iterator, response_time_reset, response_time_flush, response_time_summary },
     { "ip_direction", 0, ip_direction_indexer, ip_direction_iterator },
     { "ip_proto", 0, ip_proto_indexer, ip_proto_iterator, ip_proto_reset },
     { "ip_version", 0, ip_version_indexer, ip_version_iterator, ip_version_reset },
@@ -176,12 +180,12 @@ static int aaaa_or_a6_filter(const dns_message* m, const void* ctx)
 
 static int idn_qname_filter(const dns_message* m, const void* ctx)
 {
-    return !strncmp(m->qname, "xn--", 4);
+    return !!(dns_message_qname_class((dns_message*)m) & QNAME_CLASS_IDN);
 }
 
 static int root_servers_net_filter(const dns_message* m, const void* ctx)
 {
-    return !strcmp(m->qname + 1, ".root-servers.net");
+    return !!(dns_message_qname_class((dns_message*)m) & QNAME_CLASS_RSN);
 }
 
 static int chaos_class_filter(const dns_message* m, const void* ctx)
@@ -203,9 +207,50 @@ static int replies_only_filter(const dns_message* m, const void* ctx)
     return m->qr ? 1 : 0;
 }
 
+typedef struct
+{
+    regex_t re;
+    int     bit; // bit in the qname_filter_match() mask or -1 to use regexec()
+    char*   pat;
+} qname_filter_ctx;
+
 static int qname_filter(const dns_message* m, const void* ctx)
 {
-    return !regexec((const regex_t*)ctx, m->qname, 0, 0, 0);
+    const qname_filter_ctx* f = (const qname_filter_ctx*)ctx;
+    dns_message*            w = (dns_message*)m;
+
+    if (f->bit < 0)
+        return !regexec(&f->re, m->qname, 0, 0, 0);
+    if (!w->qname_filtered) {
+        w->qname_filters  = qname_filter_match(m->qname, m->qname_len);
+        w->qname_filtered = 1;
+    }
+    return !!(w->qname_filters & (1U << f->bit));
+}
+
+typedef struct
+{
+    filter_expr* expr;
+    int          bit; // bit in expr_filters or -1 to not cache the result
+} expr_filter_ctx;
+
+static int expr_filter_bits = 0;
+
+static int expr_filter(const dns_message* m, const void* ctx)
+{
+    const expr_filter_ctx* f = (const expr_filter_ctx*)ctx;
+    dns_message*           w = (dns_message*)m;
+    unsigned int           b;
+
+    if (f->bit < 0)
+        return filter_expr_eval(f->expr, m);
+    b = 1U << f->bit;
+    if (!(w->expr_filtered & b)) {
+        if (filter_expr_eval(f->expr, m))
+            w->expr_filters |= b;
+        w->expr_filtered |= b;
+    }
+    return !!(w->expr_filters & b);
 }
 
 static int servfail_filter(const dns_message* m, const void* ctx)
@@ -275,18 +320,14 @@ static int dns_message_find_filters(const char* fn, filter_list** fl)
     char*        tok = 0;
     char*        t;
     char*        copy = xstrdup(fn);
-    filter_list* f;
+    filter_defn* f;
     if (NULL == copy)
         return 0;
     for (t = strtok_r(copy, ",", &tok); t; t = strtok_r(NULL, ",", &tok)) {
         if (0 == strcmp(t, "any"))
             continue;
-        for (f = DNSFilters; f; f = f->next) {
-            if (0 == strcmp(t, f->filter->name))
-                break;
-        }
-        if (f) {
-            fl = md_array_filter_list_append(fl, f->filter);
+        if ((f = dns_message_find_filter(t))) {
+            fl = md_array_filter_list_append(fl, f);
             continue;
         }
         dsyslogf(LOG_ERR, "unknown filter '%s'", t);
@@ -301,6 +342,16 @@ static int dns_message_find_filters(const char* fn, filter_list** fl)
  * Public
  */
 
+filter_defn* dns_message_find_filter(const char* name)
+{
+    filter_list* f;
+    for (f = DNSFilters; f; f = f->next) {
+        if (0 == strcmp(name, f->filter->name))
+            return f->filter;
+    }
+    return NULL;
+}
+
 void dns_message_handle(dns_message* m)
 {
     md_array_list* a;
@@ -361,10 +412,100 @@ void dns_message_report(FILE* fp, md_array_printer* printer)
 void dns_message_clear_arrays(void)
 {
     md_array_list* a;
+    label_dict_next_interval();
     for (a = Arrays; a; a = a->next)
         md_array_clear(a->theArray);
 }
 
+/*
+ * Reload
+ *
+ * The arrays and filters in use are put aside while the configuration is
+ * read again, then either the old or the new ones are freed
+ */
+
+static md_array_list* OldArrays;
+static filter_list*   OldFilters;
+static int            old_expr_filter_bits;
+
+static void free_arrays(md_array_list* a)
+{
+    while (a) {
+        md_array_list* next = a->next;
+        filter_list*   fl   = a->theArray->filter_list;
+
+        while (fl) {
+            filter_list* fnext = fl->next;
+            xfree(fl);
+            fl = fnext;
+        }
+        md_array_free(a->theArray);
+        xfree(a);
+        a = next;
+    }
+}
+
+static void free_filters(filter_list* fl)
+{
+    while (fl) {
+        filter_list* next = fl->next;
+        filter_defn* f    = fl->filter;
+
+        if (f->func == qname_filter) {
+            qname_filter_ctx* r = (qname_filter_ctx*)f->context;
+            regfree(&r->re);
+            xfree(r->pat);
+            xfree(r);
+        } else if (f->func == expr_filter) {
+            expr_filter_ctx* r = (expr_filter_ctx*)f->context;
+            filter_expr_free(r->expr);
+            xfree(r);
+        }
+        xfree((char*)f->name);
+        xfree(f);
+        xfree(fl);
+        fl = next;
+    }
+}
+
+void dns_message_reload_start(void)
+{
+    OldArrays            = Arrays;
+    OldFilters           = DNSFilters;
+    old_expr_filter_bits = expr_filter_bits;
+    Arrays               = 0;
+    DNSFilters           = 0;
+    expr_filter_bits     = 0;
+    qname_filter_reset();
+    dns_message_filters_init();
+}
+
+void dns_message_reload_finish(int keep)
+{
+    filter_list* fl;
+
+    if (keep) {
+        free_arrays(OldArrays);
+        free_filters(OldFilters);
+    } else {
+        free_arrays(Arrays);
+        free_filters(DNSFilters);
+        Arrays           = OldArrays;
+        DNSFilters       = OldFilters;
+        expr_filter_bits = old_expr_filter_bits;
+
+        // the qname filters get the same bits when added in the same order
+        qname_filter_reset();
+        for (fl = DNSFilters; fl; fl = fl->next) {
+            const qname_filter_ctx* r = fl->filter->context;
+            if (fl->filter->func == qname_filter && r->bit >= 0)
+                qname_filter_add(r->pat);
+        }
+    }
+    OldArrays  = 0;
+    OldFilters = 0;
+}
+
 /*
  * QnameToNld
  *
@@ -392,12 +533,19 @@ void dns_message_clear_arrays(void)
  *        assert(0 == strcmp(QnameToNld("a.b..c..d", 2), "c..d"));
  *        assert(0 == strcmp(QnameToNld("a.b................c..d", 3), "b................c..d"));
  */
-const char* dns_message_QnameToNld(const char* qname, int nld)
+static const char* qname_to_nld(const char* qname, size_t len, int nld, const char** levels)
 {
-    const char* e = qname + strlen(qname) - 1;
+    const char* e = qname + len - 1;
     const char* t;
-    int         dotcount = 0;
+    int         dotcount = 0, level;
     int         state    = 0; /* 0 = not in dots, 1 = in dots */
+    if (!len) {
+        if (levels) {
+            for (level = 1; level <= nld; level++)
+                levels[level] = qname;
+        }
+        return qname;
+    }
     while (*e == '.' && e > qname)
         e--;
     t = e;
@@ -405,13 +553,19 @@ const char* dns_message_QnameToNld(const char* qname, int nld)
         dotcount--;
     if (have_tld_list) {
         // Use TLD list to find labels that are the "TLD"
-        const char *lt = 0, *ot = t;
-        int done = 0;
+        const char * lt = 0, *ot = t, *le = qname + len;
+        unsigned int node = TLD_LIST_ROOT;
+        int          done = 0;
+        // Walk the compiled TLD list one label at a time, trailing dots
+        // are empty labels at the end of every suffix
+        while (le - 1 > e)
+            tld_list_walk(&node, --le, 0);
         while (t > qname) {
             t--;
             if ('.' == *t) {
+                int r = tld_list_walk(&node, t + 1, le - (t + 1));
+                le    = t;
                 if (0 == state) {
-                    int r = tld_list_find(t + 1);
                     if (r & 1) {
                         // this is a tld
                         lt = t;
@@ -442,14 +596,26 @@ const char* dns_message_QnameToNld(const char* qname, int nld)
             t = e;
         }
     }
-    while (t > qname && dotcount < nld) {
-        t--;
-        if ('.' == *t) {
-            if (0 == state)
-                dotcount++;
-            state = 1;
-        } else {
-            state = 0;
+    /*
+     * Walk towards the start of qname only once, a lower level is found on
+     * the way to a higher one
+     */
+    for (level = levels ? 1 : nld; level <= nld; level++) {
+        while (t > qname && dotcount < level) {
+            t--;
+            if ('.' == *t) {
+                if (0 == state)
+                    dotcount++;
+                state = 1;
+            } else {
+                state = 0;
+            }
+        }
+        if (levels) {
+            const char* l = t;
+            while (*l == '.' && l < e)
+                l++;
+            levels[level] = l;
         }
     }
     while (*t == '.' && t < e)
@@ -457,11 +623,113 @@ const char* dns_message_QnameToNld(const char* qname, int nld)
     return t;
 }
 
+const char* dns_message_QnameToNld(const char* qname, int nld)
+{
+    return qname_to_nld(qname, strlen(qname), nld, 0);
+}
+
+/*
+ * Return the given domain level of the message's qname, all levels up to
+ * MAX_QNAME_NLD are found on first use and cached in the message
+ */
+const char* dns_message_nld(dns_message* m, int nld)
+{
+    if (nld < 1 || nld > MAX_QNAME_NLD)
+        return dns_message_QnameToNld(m->qname, nld);
+    if (NULL == m->nld[nld])
+        (void)qname_to_nld(m->qname, m->qname_len, MAX_QNAME_NLD, m->nld);
+    return m->nld[nld];
+}
+
+/*
+ * Return the hash of the given domain level, same as hashing the string
+ * returned by dns_message_nld() with hash_keyed()
+ */
+unsigned int dns_message_nld_hash(dns_message* m, int nld)
+{
+    const char* l = dns_message_nld(m, nld);
+    if (nld < 1 || nld > MAX_QNAME_NLD)
+        return hash_keyed(l, strlen(l));
+    if (!(m->nld_hashed & (1 << nld))) {
+        m->nld_hash[nld] = hash_keyed(l, m->qname_len - (l - m->qname));
+        m->nld_hashed |= 1 << nld;
+    }
+    return m->nld_hash[nld];
+}
+
 const char* dns_message_tld(dns_message* m)
 {
-    if (NULL == m->tld)
-        m->tld = dns_message_QnameToNld(m->qname, 1);
-    return m->tld;
+    return dns_message_nld(m, 1);
+}
+
+#define qname_ends_with(m, s) ((m)->qname_len >= sizeof(s) - 1 && !memcmp((m)->qname + (m)->qname_len - (sizeof(s) - 1), s, sizeof(s) - 1))
+
+/*
+ * Decode the address of a reverse name, the labels before ".in-addr.arpa"
+ * are shifted in as numbers (like atoi()) so that the last four make up
+ * the address
+ */
+static unsigned int in_addr_arpa(const char* q, const char* e)
+{
+    unsigned int i = 0;
+
+    while (q < e) {
+        unsigned int v   = 0;
+        int          neg = 0;
+
+        if ('.' == *q) {
+            q++;
+            continue;
+        }
+        while (q < e && isspace((unsigned char)*q))
+            q++;
+        if (q < e && ('-' == *q || '+' == *q))
+            neg = '-' == *q++;
+        while (q < e && *q >= '0' && *q <= '9')
+            v = v * 10 + (*q++ - '0');
+        while (q < e && '.' != *q)
+            q++;
+        i >>= 8;
+        i |= (((neg ? -v : v) & 0xff) << 24);
+    }
+    return i;
+}
+
+/*
+ * Classify the message's qname once and cache the result, returns a
+ * bitmask of QNAME_CLASS_* so the indexers and filters that look for
+ * certain names don't each do their own string work
+ */
+unsigned int dns_message_qname_class(dns_message* m)
+{
+    unsigned int c = QNAME_CLASS_DONE;
+    const char*  t;
+
+    if (m->qname_class & QNAME_CLASS_DONE)
+        return m->qname_class;
+
+    if (qname_ends_with(m, "localhost")) {
+        c |= QNAME_CLASS_LOCALHOST_SUFFIX;
+        if (m->qname_len == sizeof("localhost") - 1)
+            c |= QNAME_CLASS_LOCALHOST;
+    } else if (qname_ends_with(m, "root-servers.net")) {
+        c |= QNAME_CLASS_RSN_SUFFIX;
+        if (m->qname_len == sizeof("X.root-servers.net") - 1 && '.' == m->qname[1])
+            c |= QNAME_CLASS_RSN;
+    }
+    if (m->qname_len == 1 && '.' == m->qname[0])
+        c |= QNAME_CLASS_ROOT;
+    if (!strncmp(m->qname, "xn--", 4))
+        c |= QNAME_CLASS_IDN;
+    if (m->qname_len >= sizeof(".in-addr.arpa") - 1 && (t = strstr(m->qname, ".in-addr.arpa"))) {
+        unsigned int i = in_addr_arpa(m->qname, t);
+        if ((i & 0xff000000) == 0x0a000000 /* 10.0.0.0/8 */
+            || (i & 0xfff00000) == 0xac100000 /* 172.16.0.0/12 */
+            || (i & 0xffff0000) == 0xc0a80000) /* 192.168.0.0/16 */
+            c |= QNAME_CLASS_RFC1918_PTR;
+    }
+
+    return m->qname_class = c;
 }
 
 void dns_message_filters_init(void)
@@ -493,21 +761,49 @@ void dns_message_indexers_init(void)
 
 int add_qname_filter(const char* name, const char* pat)
 {
-    filter_list** fl = &DNSFilters;
-    regex_t*      r;
-    int           x;
+    filter_list**     fl = &DNSFilters;
+    qname_filter_ctx* r;
+    int               x;
     while ((*fl))
         fl = &((*fl)->next);
     r = xcalloc(1, sizeof(*r));
-    if (NULL == r) {
+    if (NULL == r || NULL == (r->pat = xstrdup(pat))) {
         dsyslogf(LOG_ERR, "Cant allocate memory for '%s' qname filter", name);
+        xfree(r);
         return 0;
     }
-    if (0 != (x = regcomp(r, pat, REG_EXTENDED | REG_ICASE))) {
+    if (0 != (x = regcomp(&r->re, pat, REG_EXTENDED | REG_ICASE))) {
         char errbuf[512];
-        regerror(x, r, errbuf, 512);
+        regerror(x, &r->re, errbuf, 512);
         dsyslogf(LOG_ERR, "regcomp: %s", errbuf);
+        r->bit = -1;
+    } else if ((r->bit = qname_filter_add(pat)) < 0) {
+        dfprintf(1, "qname_filter: %s will use regexec()", name);
     }
     (void)md_array_filter_list_append(fl, md_array_create_filter(name, qname_filter, r));
     return 1;
 }
+
+int add_expr_filter(const char* name, const char* expr)
+{
+    filter_list**    fl = &DNSFilters;
+    expr_filter_ctx* r;
+    if (dns_message_find_filter(name)) {
+        dsyslogf(LOG_ERR, "filter '%s' already exists", name);
+        return 0;
+    }
+    while ((*fl))
+        fl = &((*fl)->next);
+    r = xcalloc(1, sizeof(*r));
+    if (NULL == r) {
+        dsyslogf(LOG_ERR, "Cant allocate memory for '%s' filter", name);
+        return 0;
+    }
+    if (!(r->expr = filter_expr_compile(name, expr))) {
+        xfree(r);
+        return 0;
+    }
+    r->bit = expr_filter_bits < 32 ? expr_filter_bits++ : -1;
+    (void)md_array_filter_list_append(fl, md_array_create_filter(name, expr_filter, r));
+    return 1;
+}
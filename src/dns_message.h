@@ -57,6 +57,17 @@ typedef struct dns_message       dns_message;
 #endif
 
 #define MAX_QNAME_SZ 512
+#define MAX_QNAME_NLD 3
+
+/* qname classes, see dns_message_qname_class() */
+#define QNAME_CLASS_LOCALHOST 0x01 /* qname is "localhost" */
+#define QNAME_CLASS_LOCALHOST_SUFFIX 0x02 /* qname ends with "localhost" */
+#define QNAME_CLASS_RSN 0x04 /* qname is "X.root-servers.net" */
+#define QNAME_CLASS_RSN_SUFFIX 0x08 /* qname ends with "root-servers.net" */
+#define QNAME_CLASS_IDN 0x10 /* qname begins with "xn--" */
+#define QNAME_CLASS_RFC1918_PTR 0x20 /* qname is a reverse name in RFC1918 space */
+#define QNAME_CLASS_ROOT 0x40 /* qname is "." */
+#define QNAME_CLASS_DONE 0x80000000 /* qname has been classified */
 
 enum transport_encryption {
     TRANSPORT_ENCRYPTION_UNENCRYPTED = 0,
@@ -75,6 +86,7 @@ struct transport_message {
     unsigned char             ip_version;
     unsigned char             proto;
     enum transport_encryption encryption;
+    struct timeval            query_ts; /* time of the query for a response if known, e.g. from dnstap, otherwise zero */
 };
 
 struct dns_message {
@@ -84,10 +96,23 @@ struct dns_message {
     unsigned short     qclass;
     unsigned short     msglen;
     char               qname[MAX_QNAME_SZ];
-    const char*        tld;
+    unsigned short     qname_len; /* length of qname, same as strlen() */
+    unsigned short     label_count; /* number of labels in qname, 0 for root */
+    const char*        nld[MAX_QNAME_NLD + 1]; /* cached domain levels of qname, see dns_message_nld() */
+    unsigned int       nld_hash[MAX_QNAME_NLD + 1]; /* hash of each cached domain level */
+    unsigned int       nld_hashed; /* bitmask of nld_hash entries that are set */
+    const void*        qname_node[MAX_QNAME_NLD]; /* cached qname trie nodes, see qname_index.c */
+    unsigned int       qname_node_gen; /* generation of the trie the nodes are from */
+    unsigned int       qname_class; /* bitmask of QNAME_CLASS_*, see dns_message_qname_class() */
+    unsigned int       qname_filters; /* bitmask of matching qname filters, see qname_filter() */
+    unsigned int       expr_filters; /* bitmask of matching filter expressions, see expr_filter() */
+    unsigned int       expr_filtered; /* bitmask of expr_filters that are set */
+    const char*        country; /* country of the source address once looked up, see country_get_from_message() */
+    const char*        asn; /* ASN of the source address once looked up, see asn_get_from_message() */
     unsigned char      opcode;
     unsigned char      rcode;
     unsigned int       malformed : 1;
+    unsigned int       qname_filtered : 1; /* set if qname_filters is set */
     unsigned int       qr : 1;
     unsigned int       rd : 1; /* set if RECUSION DESIRED bit is set */
     unsigned int       aa : 1; /* set if AUTHORITATIVE ANSWER bit is set */
@@ -107,11 +132,18 @@ int         dns_message_add_array(const char* name, const char* fn, const char*
 void        dns_message_flush_arrays(void);
 void        dns_message_report(FILE* fp, md_array_printer* printer);
 void        dns_message_clear_arrays(void);
+void        dns_message_reload_start(void);
+void        dns_message_reload_finish(int keep);
 const char* dns_message_QnameToNld(const char* qname, int nld);
 const char* dns_message_tld(dns_message* m);
+const char* dns_message_nld(dns_message* m, int nld);
+unsigned int dns_message_nld_hash(dns_message* m, int nld);
+unsigned int dns_message_qname_class(dns_message* m);
 void        dns_message_filters_init(void);
 void        dns_message_indexers_init(void);
 int         add_qname_filter(const char* name, const char* pat);
+int         add_expr_filter(const char* name, const char* expr);
+filter_defn* dns_message_find_filter(const char* name);
 
 #include <arpa/nameser.h>
 #ifdef HAVE_ARPA_NAMESER_COMPAT_H
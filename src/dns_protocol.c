@@ -43,96 +43,204 @@
 
 #include <string.h>
 #include <assert.h>
-#include <ctype.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define DNS_MSG_HDR_SZ 12
 #define RFC1035_MAXLABELSZ 63
 
-static int rfc1035NameUnpack(const u_char* buf, size_t sz, off_t* off, char* name, int ns)
+static inline void qname_add_label(dns_message* m)
 {
-    off_t         no = 0;
+    m->label_count++;
+}
+
+/*
+ * Recount the labels from the qname string, used when the decoded
+ * name does not match its wire form (embedded NUL or the single "." label).
+ */
+static void qname_recount(dns_message* m)
+{
+    size_t i;
+
+    m->qname_len   = strlen(m->qname);
+    m->label_count = 0;
+    if (m->qname_len == 0 || (m->qname_len == 1 && m->qname[0] == '.'))
+        return;
+    qname_add_label(m);
+    for (i = 0; i < m->qname_len; i++)
+        if (m->qname[i] == '.')
+            qname_add_label(m);
+}
+
+/*
+ * Copy a label while lowercasing it and replacing CR/LF with a space,
+ * dots inside the label starts a new label in the presentation format
+ * and are recorded as such. Returns non-zero if the label contained
+ * a NUL.
+ */
+static int label_copy(char* dst, const u_char* src, size_t len, dns_message* m)
+{
+    size_t i   = 0;
+    int    nul = 0;
+    u_char c;
+
+#ifdef __SSE2__
+    const __m128i upper_lo = _mm_set1_epi8('A' - 1);
+    const __m128i upper_hi = _mm_set1_epi8('Z' + 1);
+    const __m128i to_lower = _mm_set1_epi8(0x20);
+    const __m128i lf       = _mm_set1_epi8('\n');
+    const __m128i cr       = _mm_set1_epi8('\r');
+    const __m128i space    = _mm_set1_epi8(' ');
+    const __m128i dot      = _mm_set1_epi8('.');
+    const __m128i zero     = _mm_setzero_si128();
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i u = _mm_and_si128(_mm_cmpgt_epi8(v, upper_lo), _mm_cmplt_epi8(v, upper_hi));
+        __m128i s = _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr));
+        int     special;
+
+        v = _mm_add_epi8(v, _mm_and_si128(u, to_lower));
+        v = _mm_or_si128(_mm_andnot_si128(s, v), _mm_and_si128(s, space));
+        _mm_storeu_si128((__m128i*)(dst + i), v);
+
+        special = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, dot), _mm_cmpeq_epi8(v, zero)));
+        while (special) {
+            int b = __builtin_ctz(special);
+            if (dst[i + b] == '.') {
+                if (m)
+                    qname_add_label(m);
+            } else
+                nul = 1;
+            special &= special - 1;
+        }
+    }
+#endif
+
+    for (; i < len; i++) {
+        c = src[i];
+        if (c >= 'A' && c <= 'Z')
+            c += 0x20;
+        else if (c == '\n' || c == '\r')
+            c = ' ';
+        else if (c == '.') {
+            if (m)
+                qname_add_label(m);
+        } else if (!c)
+            nul = 1;
+        dst[i] = c;
+    }
+
+    return nul;
+}
+
+/*
+ * Unpack a DNS name into presentation format, lowercased and with CR/LF
+ * replaced by space. If m is given then the name length and label count
+ * are recorded in it.
+ */
+static int rfc1035NameUnpack(const u_char* buf, size_t sz, off_t* off, char* name, int ns, dns_message* m)
+{
+    off_t         no = 0, base = 0;
+    off_t         pos   = *off;
+    int           jumps = 0, nul = 0;
     unsigned char c;
     size_t        len;
-    static int    loop_detect = 0;
-    if (loop_detect > 2)
-        return 4; /* compression loop */
-    if (ns <= 0)
-        return 4; /* probably compression loop */
-    do {
-        if ((*off) >= sz)
+
+    if (m)
+        m->label_count = 0;
+    for (;;) {
+        if (pos >= sz)
             break;
-        c = *(buf + (*off));
+        c = *(buf + pos);
         if (c > 191) {
             /* blasted compression */
-            int            rc;
             unsigned short s;
             off_t          ptr;
-            s = nptohs(buf + (*off));
-            (*off) += sizeof(s);
+            s = nptohs(buf + pos);
+            pos += sizeof(s);
             /* Sanity check */
-            if ((*off) >= sz)
+            if (pos >= sz)
                 return 1; /* message too short */
+            if (!jumps)
+                *off = pos;
             ptr = s & 0x3FFF;
             /* Make sure the pointer is inside this message */
             if (ptr >= sz)
                 return 2; /* bad compression ptr */
             if (ptr < DNS_MSG_HDR_SZ)
                 return 2; /* bad compression ptr */
-            loop_detect++;
-            rc = rfc1035NameUnpack(buf, sz, &ptr, name + no, ns - no);
-            loop_detect--;
-            return rc;
+            if (++jumps > 2)
+                return 4; /* compression loop */
+            if (no >= ns)
+                return 4; /* probably compression loop */
+            pos  = ptr;
+            base = no;
+            continue;
         } else if (c > RFC1035_MAXLABELSZ) {
             /*
              * "(The 10 and 01 combinations are reserved for future use.)"
              */
             return 3; /* reserved label/compression flags */
-        } else {
-            (*off)++;
-            len = (size_t)c;
-            if (len == 0)
-                break;
-            if (len > (ns - 1))
-                len = ns - 1;
-            if ((*off) + len > sz)
-                return 4; /* message is too short */
-            if (no + len + 1 > ns)
-                return 5; /* qname would overflow name buffer */
-            memcpy(name + no, buf + (*off), len);
-            (*off) += len;
-            no += len;
-            *(name + (no++)) = '.';
         }
-    } while (c > 0);
-    if (no > 0)
+        pos++;
+        len = (size_t)c;
+        if (len == 0)
+            break;
+        if (len > (ns - 1))
+            len = ns - 1;
+        if (pos + len > sz)
+            return 4; /* message is too short */
+        if (no + len + 1 > ns)
+            return 5; /* qname would overflow name buffer */
+        if (m)
+            qname_add_label(m);
+        nul |= label_copy(name + no, buf + pos, len, m);
+        pos += len;
+        no += len;
+        *(name + (no++)) = '.';
+    }
+    if (!jumps)
+        *off = pos;
+    /*
+     * Only terminate over the trailing dot if the last name segment added
+     * labels, a compression pointer to the root leaves it as is
+     */
+    if (no > base)
         *(name + no - 1) = '\0';
+    else
+        *(name + no) = '\0';
     /* make sure we didn't allow someone to overflow the name buffer */
     assert(no <= ns);
+    if (m) {
+        if (nul || (no && no == base))
+            qname_recount(m);
+        else
+            m->qname_len = no > 0 ? no - 1 : 0;
+    }
     return 0;
 }
 
-static off_t grok_question(const u_char* buf, int len, off_t offset, char* qname, unsigned short* qtype, unsigned short* qclass)
+static off_t grok_question(const u_char* buf, int len, off_t offset, dns_message* m)
 {
-    char* t;
-    int   x;
-    x = rfc1035NameUnpack(buf, len, &offset, qname, MAX_QNAME_SZ);
+    int x;
+    x = rfc1035NameUnpack(buf, len, &offset, m->qname, MAX_QNAME_SZ, m);
     if (0 != x)
         return 0;
-    if ('\0' == *qname) {
-        *qname       = '.';
-        *(qname + 1) = 0;
+    if ('\0' == *m->qname) {
+        *m->qname       = '.';
+        *(m->qname + 1) = 0;
+        m->qname_len    = 1;
+        m->label_count  = 0;
+    } else if (m->qname_len == 1 && *m->qname == '.') {
+        /* a single label of "." is treated as the root */
+        m->label_count = 0;
     }
-    /* XXX remove special characters from QNAME */
-    while ((t = strchr(qname, '\n')))
-        *t = ' ';
-    while ((t = strchr(qname, '\r')))
-        *t = ' ';
-    for (t = qname; *t; t++)
-        *t = tolower(*t);
     if (offset + 4 > len)
         return 0;
-    *qtype  = nptohs(buf + offset);
-    *qclass = nptohs(buf + offset + 2);
+    m->qtype  = nptohs(buf + offset);
+    m->qclass = nptohs(buf + offset + 2);
     offset += 4;
     return offset;
 }
@@ -144,7 +252,7 @@ static off_t grok_additional_for_opt_rr(const u_char* buf, int len, off_t offset
     unsigned short someclass;
     unsigned short us;
     char           somename[MAX_QNAME_SZ];
-    x = rfc1035NameUnpack(buf, len, &offset, somename, MAX_QNAME_SZ);
+    x = rfc1035NameUnpack(buf, len, &offset, somename, MAX_QNAME_SZ, 0);
     if (0 != x)
         return 0;
     if (offset + 10 > len)
@@ -213,7 +321,7 @@ int dns_protocol_handler(const u_char* buf, int len, void* udata)
      */
     if (qdcount > 0 && offset < len) {
         off_t new_offset;
-        new_offset = grok_question(buf, len, offset, m.qname, &m.qtype, &m.qclass);
+        new_offset = grok_question(buf, len, offset, &m);
         if (0 == new_offset) {
             m.malformed = 1;
             return 0;
@@ -226,11 +334,9 @@ int dns_protocol_handler(const u_char* buf, int len, void* udata)
      * Gobble up subsequent questions, if any
      */
     while (qdcount > 0 && offset < len) {
-        off_t          new_offset;
-        char           t_qname[MAX_QNAME_SZ] = { 0 };
-        unsigned short t_qtype;
-        unsigned short t_qclass;
-        new_offset = grok_question(buf, len, offset, t_qname, &t_qtype, &t_qclass);
+        off_t       new_offset;
+        dns_message t_m;
+        new_offset = grok_question(buf, len, offset, &t_m);
         if (0 == new_offset) {
             /*
              * point offset to the end of the buffer to avoid any subsequent processing
@@ -47,6 +47,7 @@
 char* dnstap_network_ip4  = 0;
 char* dnstap_network_ip6  = 0;
 int   dnstap_network_port = -1;
+int   dnstap_threads      = 0;
 
 #include <string.h>
 #include <stdlib.h>
@@ -70,8 +71,13 @@ static struct timeval start_ts, finish_ts;
 #include <ctype.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#include <errno.h>
 
 #define BUF_SIZE 4096
+#define BUF_MAX_SIZE (256 * 1024)
 
 #if 1
 #define _dsyslog(x...)
@@ -199,6 +205,8 @@ enum client_state {
 };
 
 struct client;
+struct worker;
+struct file_part;
 struct client {
     struct client*    next;
     size_t            id;
@@ -208,57 +216,125 @@ struct client {
     uv_udp_t          udp_conn;
     uv_stream_t*      stream;
 
-    char    rbuf[BUF_SIZE];
-    ssize_t read;
-    size_t  pushed;
+    struct worker*    worker; // handling the connection, or 0 for the main loop
+    struct file_part* part; // decoding part of a file instead of a connection
+    enum dnstap_via   via;
+    int               fd; // accepted by the main loop, until opened by the worker
+    uint64_t          frames, reported_frames;
+
+    char*  rbuf; // doubled up to BUF_MAX_SIZE while reads fill it
+    size_t rbuf_size;
 
-    uv_write_t            wreq;
-    uv_buf_t              wbuf;
     uint8_t               _wbuf[BUF_SIZE];
     struct dnswire_reader reader;
 
     int finished;
 };
 
+/*
+ * With dnstap_threads the connections are handed out to worker threads
+ * which each run their own loop to read and decode the frames. The DNS
+ * messages are queued in batches to the main loop which parses and counts
+ * them, since the datasets and indexers are shared by all connections.
+ */
+#define DNSTAP_BATCH_SIZE (64 * 1024)
+#define DNSTAP_MAX_BACKLOG (256 * 1024)
+
+struct frame {
+    transport_message tm;
+    size_t            len; // of the DNS message following
+};
+
+#define FRAME_SIZE(len) ((sizeof(struct frame) + (len) + 7) & ~(size_t)7)
+
+struct batch {
+    struct batch*  next;
+    struct worker* worker;
+    size_t         frames, used, size;
+    uint64_t       data[]; // frames, each 8 byte aligned
+};
+
+struct worker {
+    size_t         id;
+    uv_thread_t    thread;
+    uv_loop_t      loop;
+    uv_async_t     wakeup;
+    uv_check_t     flush;
+    uv_mutex_t     lock; // protects clients, accepted and load
+    struct client* clients;
+    struct client* accepted; // waiting to be opened on the loop
+    size_t         load; // connections
+    struct batch*  batch; // being filled
+    size_t         backlog; // frames queued to the main loop, protected by batches_lock
+    int            stop; // protected by batches_lock
+};
+
+static struct worker* workers     = 0;
+static size_t         next_worker = 0;
+static uv_async_t     batches_ready;
+static uv_mutex_t     batches_lock;
+static uv_cond_t      batches_drained;
+static struct batch * batches = 0, *batches_last = 0;
+
 static struct client* clients   = 0;
 static size_t         client_id = 1;
 
-static struct client* client_new()
+/*
+ * Clients of a worker are linked when opened on its loop
+ */
+static struct client* client_new(struct worker* w)
 {
     struct client* c = xmalloc(sizeof(struct client));
     if (c) {
-        c->unix_conn.data = c;
-        c->tcp_conn.data  = c;
-        c->udp_conn.data  = c;
-        c->next           = clients;
-        c->id             = client_id++;
-        c->state          = no_state;
-        c->wbuf.base      = (void*)c->_wbuf;
-        c->finished       = 0;
+        c->unix_conn.data  = c;
+        c->tcp_conn.data   = c;
+        c->udp_conn.data   = c;
+        c->next            = 0;
+        c->id              = client_id++;
+        c->state           = no_state;
+        c->rbuf_size       = BUF_SIZE;
+        c->finished        = 0;
+        c->worker          = w;
+        c->part            = 0;
+        c->fd              = -1;
+        c->frames          = 0;
+        c->reported_frames = 0;
+        if (!(c->rbuf = xmalloc(c->rbuf_size))) {
+            xfree(c);
+            return 0;
+        }
         if (dnswire_reader_init(&c->reader) != dnswire_ok) {
+            xfree(c->rbuf);
             xfree(c);
             return 0;
         }
         if (dnswire_reader_allow_bidirectional(&c->reader, true) != dnswire_ok) {
             dnswire_reader_destroy(c->reader);
+            xfree(c->rbuf);
             xfree(c);
             return 0;
         }
-        clients = c;
+        if (!w) {
+            c->next = clients;
+            clients = c;
+        }
     }
     return c;
 }
 
 static void client_close(uv_handle_t* handle)
 {
-    struct client* c = handle->data;
+    struct client*  c    = handle->data;
+    struct client** list = c->worker ? &c->worker->clients : &clients;
 
     _dsyslogf(LOG_DEBUG, "DNSTAP: client %zu closed/freed", c->id);
 
-    if (clients == c) {
-        clients = c->next;
+    if (c->worker)
+        uv_mutex_lock(&c->worker->lock);
+    if (*list == c) {
+        *list = c->next;
     } else {
-        struct client* prev = clients;
+        struct client* prev = *list;
 
         while (prev) {
             if (prev->next == c) {
@@ -268,41 +344,101 @@ static void client_close(uv_handle_t* handle)
             prev = prev->next;
         }
     }
+    if (c->worker) {
+        c->worker->load--;
+        uv_mutex_unlock(&c->worker->lock);
+    }
 
     dnswire_reader_destroy(c->reader);
+    xfree(c->rbuf);
     xfree(c);
 }
 
 static void client_alloc_buffer(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf)
 {
-    buf->base = ((struct client*)handle->data)->rbuf;
-    buf->len  = BUF_SIZE;
+    struct client* c = handle->data;
+
+    buf->base = c->rbuf;
+    buf->len  = c->rbuf_size;
 }
 
-static int dnstap_handler(const struct dnstap* m);
+static int dnstap_handler(const struct dnstap* m, struct client* c);
 
-static void client_write(uv_write_t* req, int status);
+/*
+ * Control frames are written from their own buffer so reading carries on
+ * while they are sent
+ */
+struct client_wreq {
+    uv_write_t req;
+    uv_buf_t   buf;
+    uint8_t    data[];
+};
 
-static int process_rbuf(uv_stream_t* handle, struct client* c)
+static void client_write(uv_write_t* req, int status)
 {
-    int done = 0;
-    _dsyslogf(LOG_DEBUG, "DNSTAP: client %zu pushing %zu of %zd", c->id, c->pushed, c->read);
-    if (c->pushed >= c->read) {
-        done = 1;
+    uv_stream_t*   handle = req->handle;
+    struct client* c      = handle->data;
+
+    xfree(req);
+
+    if (uv_is_closing((uv_handle_t*)handle))
+        return;
+    if (status) {
+        dsyslogf(LOG_ERR, "DNSTAP: Unable to write to client %zu, closing connection: %s", c->id, uv_strerror(status));
+        uv_close((uv_handle_t*)handle, client_close);
+        return;
+    }
+    if (c->finished) {
+        dsyslogf(LOG_INFO, "DNSTAP: Client %zu is finished, disconnecting", c->id);
+        uv_close((uv_handle_t*)handle, client_close);
     }
+}
+
+static int client_send(uv_stream_t* handle, struct client* c, size_t len)
+{
+    struct client_wreq* w = xmalloc(sizeof(*w) + len);
+    int                 r;
+
+    _dsyslogf(LOG_DEBUG, "DNSTAP: client %zu writing %zu", c->id, len);
+
+    if (!w) {
+        dsyslogf(LOG_ERR, "DNSTAP: Out of memory writing to client %zu, closing connection", c->id);
+        uv_close((uv_handle_t*)handle, client_close);
+        return -1;
+    }
+    memcpy(w->data, c->_wbuf, len);
+    w->buf.base = (char*)w->data;
+    w->buf.len  = len;
+    if ((r = uv_write(&w->req, handle, &w->buf, 1, client_write))) {
+        dsyslogf(LOG_ERR, "DNSTAP: Unable to write to client %zu, closing connection: %s", c->id, uv_strerror(r));
+        xfree(w);
+        uv_close((uv_handle_t*)handle, client_close);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Decode all frames of what was read, returns zero if the connection is
+ * being closed
+ */
+static int process_rbuf(uv_stream_t* handle, struct client* c, size_t len)
+{
+    size_t pushed = 0;
+    int    done   = !len;
+
     while (!done) {
         size_t              out_len = sizeof(c->_wbuf);
-        enum dnswire_result res     = dnswire_reader_push(&c->reader, (uint8_t*)&c->rbuf[c->pushed], c->read - c->pushed, c->_wbuf, &out_len);
+        enum dnswire_result res     = dnswire_reader_push(&c->reader, (uint8_t*)&c->rbuf[pushed], len - pushed, c->_wbuf, &out_len);
 
-        c->pushed += dnswire_reader_pushed(c->reader);
-        if (c->pushed >= c->read) {
+        pushed += dnswire_reader_pushed(c->reader);
+        if (pushed >= len) {
             done = 1;
         }
-        _dsyslogf(LOG_DEBUG, "DNSTAP: client %zu pushed %zu of %zd", c->id, c->pushed, c->read);
 
         switch (res) {
         case dnswire_have_dnstap:
-            dnstap_handler(dnswire_reader_dnstap(c->reader));
+            dnstap_handler(dnswire_reader_dnstap(c->reader), c);
             done = 0;
             break;
         case dnswire_need_more:
@@ -315,8 +451,7 @@ static int process_rbuf(uv_stream_t* handle, struct client* c)
                 c->finished = 1;
                 _dsyslogf(LOG_DEBUG, "DNSTAP: client %zu finishing %zu", c->id, out_len);
                 uv_read_stop(handle);
-                c->wbuf.len = out_len;
-                uv_write((uv_write_t*)&c->wreq, handle, &c->wbuf, 1, client_write);
+                client_send(handle, c, out_len);
                 return 0;
             }
             uv_close((uv_handle_t*)handle, client_close);
@@ -327,11 +462,7 @@ static int process_rbuf(uv_stream_t* handle, struct client* c)
             return 0;
         }
 
-        if (out_len) {
-            _dsyslogf(LOG_DEBUG, "DNSTAP: client %zu writing %zu", c->id, out_len);
-            uv_read_stop(handle);
-            c->wbuf.len = out_len;
-            uv_write((uv_write_t*)&c->wreq, handle, &c->wbuf, 1, client_write);
+        if (out_len && client_send(handle, c, out_len)) {
             return 0;
         }
     }
@@ -354,40 +485,653 @@ static void client_read(uv_stream_t* handle, ssize_t nread, const uv_buf_t* buf)
     }
     if (nread > 0) {
         _dsyslogf(LOG_DEBUG, "DNSTAP: client %zu read %zd", c->id, nread);
-        c->read   = nread;
-        c->pushed = 0;
-        process_rbuf(handle, c);
+        if (process_rbuf(handle, c, nread) && (size_t)nread == c->rbuf_size && c->rbuf_size < BUF_MAX_SIZE) {
+            // the reader keeps what it needs so the buffer can be replaced
+            char* rbuf = xmalloc(c->rbuf_size * 2);
+            if (rbuf) {
+                xfree(c->rbuf);
+                c->rbuf = rbuf;
+                c->rbuf_size *= 2;
+                _dsyslogf(LOG_DEBUG, "DNSTAP: client %zu read buffer now %zu", c->id, c->rbuf_size);
+            }
+        }
     }
 }
 
-static void client_write(uv_write_t* req, int status)
+static void batch_queue(struct worker* w)
 {
-    struct client* c = req->handle->data;
+    struct batch* b = w->batch;
 
-    if (status) {
-        dsyslogf(LOG_ERR, "DNSTAP: Unable to write to client %zu, closing connection: %s", c->id, uv_strerror(status));
-        uv_close((uv_handle_t*)req->handle, client_close);
+    if (!b)
+        return;
+    w->batch = 0;
+
+    uv_mutex_lock(&batches_lock);
+    // let the connections wait rather than queue without bounds
+    while (w->backlog >= DNSTAP_MAX_BACKLOG && !w->stop)
+        uv_cond_wait(&batches_drained, &batches_lock);
+    w->backlog += b->frames;
+    if (batches_last)
+        batches_last->next = b;
+    else
+        batches = b;
+    batches_last = b;
+    uv_mutex_unlock(&batches_lock);
+
+    uv_async_send(&batches_ready);
+}
+
+static struct batch* batch_new(struct worker* w, size_t need)
+{
+    size_t        size = need > DNSTAP_BATCH_SIZE ? need : DNSTAP_BATCH_SIZE;
+    struct batch* b    = xmalloc(sizeof(struct batch) + size);
+
+    if (b) {
+        b->next   = 0;
+        b->worker = w;
+        b->frames = 0;
+        b->used   = 0;
+        b->size   = size;
+    }
+    return b;
+}
+
+static void batch_put(struct batch* b, const transport_message* tm, const uint8_t* payload, size_t len)
+{
+    struct frame* f = (struct frame*)((uint8_t*)b->data + b->used);
+
+    f->tm  = *tm;
+    f->len = len;
+    memcpy(f + 1, payload, len);
+    b->used += FRAME_SIZE(len);
+    b->frames++;
+}
+
+static void batch_add(struct worker* w, const transport_message* tm, const uint8_t* payload, size_t len)
+{
+    size_t need = FRAME_SIZE(len);
+
+    if (w->batch && w->batch->used + need > w->batch->size)
+        batch_queue(w);
+    if (!w->batch && !(w->batch = batch_new(w, need))) {
+        dsyslogf(LOG_ERR, "DNSTAP: Out of memory in thread %zu, message dropped", w->id);
+        return;
+    }
+    batch_put(w->batch, tm, payload, len);
+}
+
+static void batches_process(uv_async_t* handle)
+{
+    struct batch *b, *next;
+
+    uv_mutex_lock(&batches_lock);
+    b       = batches;
+    batches = batches_last = 0;
+    uv_mutex_unlock(&batches_lock);
+
+    for (; b; b = next) {
+        uint8_t *p = (uint8_t*)b->data, *end = p + b->used;
+
+        next = b->next;
+        while (p < end) {
+            struct frame* f = (struct frame*)p;
+
+            last_ts = f->tm.ts;
+            dns_protocol_handler((const u_char*)(f + 1), f->len, &f->tm);
+            p += FRAME_SIZE(f->len);
+        }
+
+        uv_mutex_lock(&batches_lock);
+        b->worker->backlog -= b->frames;
+        uv_cond_broadcast(&batches_drained);
+        uv_mutex_unlock(&batches_lock);
+        xfree(b);
+    }
+}
+
+static void worker_flush(uv_check_t* handle)
+{
+    batch_queue(handle->data);
+}
+
+static void worker_open(struct worker* w, struct client* c)
+{
+    int r;
+
+    if (c->via == dnstap_via_tcp) {
+        uv_tcp_init(&w->loop, &c->tcp_conn);
+        c->stream = (uv_stream_t*)&c->tcp_conn;
+        r         = uv_tcp_open(&c->tcp_conn, c->fd);
+    } else {
+        uv_pipe_init(&w->loop, &c->unix_conn, 0);
+        c->stream = (uv_stream_t*)&c->unix_conn;
+        r         = uv_pipe_open(&c->unix_conn, c->fd);
+    }
+
+    uv_mutex_lock(&w->lock);
+    c->next    = w->clients;
+    w->clients = c;
+    uv_mutex_unlock(&w->lock);
+
+    if (r) {
+        dsyslogf(LOG_ERR, "DNSTAP: Unable to open client %zu connection in thread %zu: %s", c->id, w->id, uv_strerror(r));
+        close(c->fd);
+        uv_close((uv_handle_t*)c->stream, client_close);
+        return;
+    }
+    uv_read_start(c->stream, client_alloc_buffer, client_read);
+}
+
+static void worker_close_handle(uv_handle_t* handle, void* w)
+{
+    if (!uv_is_closing(handle))
+        uv_close(handle, handle->data == w ? 0 : client_close);
+}
+
+static void worker_wakeup(uv_async_t* handle)
+{
+    struct worker* w = handle->data;
+    struct client *c, *next;
+    int            stop;
+
+    uv_mutex_lock(&w->lock);
+    c           = w->accepted;
+    w->accepted = 0;
+    uv_mutex_unlock(&w->lock);
+
+    for (; c; c = next) {
+        next = c->next;
+        worker_open(w, c);
+    }
+
+    uv_mutex_lock(&batches_lock);
+    stop = w->stop;
+    uv_mutex_unlock(&batches_lock);
+    if (stop)
+        uv_walk(&w->loop, worker_close_handle, w);
+}
+
+static void worker_run(void* arg)
+{
+    struct worker* w = arg;
+
+    uv_run(&w->loop, UV_RUN_DEFAULT);
+    uv_loop_close(&w->loop);
+}
+
+static void workers_start(void)
+{
+    size_t i;
+    int    r;
+
+    if (!(workers = xcalloc(dnstap_threads, sizeof(*workers)))) {
+        dsyslog(LOG_ERR, "DNSTAP: Out of memory starting threads");
+        exit(1);
+    }
+    uv_mutex_init(&batches_lock);
+    uv_cond_init(&batches_drained);
+    uv_async_init(uv_default_loop(), &batches_ready, batches_process);
+
+    for (i = 0; i < dnstap_threads; i++) {
+        struct worker* w = &workers[i];
+
+        w->id = i + 1;
+        uv_mutex_init(&w->lock);
+        uv_loop_init(&w->loop);
+        uv_async_init(&w->loop, &w->wakeup, worker_wakeup);
+        w->wakeup.data = w;
+        uv_check_init(&w->loop, &w->flush);
+        w->flush.data = w;
+        uv_check_start(&w->flush, worker_flush);
+        if ((r = uv_thread_create(&w->thread, worker_run, w))) {
+            dsyslogf(LOG_ERR, "DNSTAP: Unable to start thread: %s", uv_strerror(r));
+            exit(1);
+        }
+    }
+    dsyslogf(LOG_INFO, "DNSTAP: Started %d threads", dnstap_threads);
+}
+
+static void workers_stop(void)
+{
+    struct batch* b;
+    size_t        i;
+
+    uv_mutex_lock(&batches_lock);
+    for (i = 0; i < dnstap_threads; i++)
+        workers[i].stop = 1;
+    uv_cond_broadcast(&batches_drained);
+    uv_mutex_unlock(&batches_lock);
+
+    for (i = 0; i < dnstap_threads; i++) {
+        uv_async_send(&workers[i].wakeup);
+        uv_thread_join(&workers[i].thread);
+        xfree(workers[i].batch);
+    }
+    while ((b = batches)) {
+        batches = b->next;
+        xfree(b);
+    }
+    xfree(workers);
+    workers = 0;
+}
+
+/*
+ * Report frames per second of each connection and the frames waiting for
+ * the main loop, for the seconds since the last report
+ */
+static void workers_report(double seconds)
+{
+    struct client* c;
+    size_t         i, backlog;
+    uint64_t       frames;
+
+    for (i = 0; i < dnstap_threads; i++) {
+        struct worker* w = &workers[i];
+
+        uv_mutex_lock(&batches_lock);
+        backlog = w->backlog;
+        uv_mutex_unlock(&batches_lock);
+
+        uv_mutex_lock(&w->lock);
+        dsyslogf(LOG_INFO, "DNSTAP: Thread %zu has %zu connections, %zu frames backlog", w->id, w->load, backlog);
+        for (c = w->clients; c; c = c->next) {
+            frames = __atomic_load_n(&c->frames, __ATOMIC_RELAXED);
+            dsyslogf(LOG_INFO, "DNSTAP: Client %zu on thread %zu %.0f frames/s", c->id, w->id, seconds > 0 ? (frames - c->reported_frames) / seconds : 0.0);
+            c->reported_frames = frames;
+        }
+        uv_mutex_unlock(&w->lock);
+    }
+}
+
+/*
+ * Least connections first, starting after the last worker picked
+ */
+static struct worker* worker_pick(void)
+{
+    struct worker* best = 0;
+    size_t         i, load, best_load = 0;
+
+    for (i = 0; i < dnstap_threads; i++) {
+        struct worker* w = &workers[(next_worker + i) % dnstap_threads];
+
+        uv_mutex_lock(&w->lock);
+        load = w->load;
+        uv_mutex_unlock(&w->lock);
+        if (!best || load < best_load) {
+            best      = w;
+            best_load = load;
+        }
+    }
+    next_worker = (best - workers + 1) % dnstap_threads;
+    return best;
+}
+
+static void accepted_close(uv_handle_t* handle)
+{
+    xfree(handle);
+}
+
+/*
+ * Accept on the main loop and hand a duplicate of the socket over to a
+ * worker, handles can not move between loops
+ */
+static void worker_accept(uv_stream_t* server, enum dnstap_via via)
+{
+    struct worker* w = worker_pick();
+    struct client* c;
+    uv_stream_t*   conn;
+    uv_os_fd_t     fd;
+
+    if (!(conn = xmalloc(via == dnstap_via_tcp ? sizeof(uv_tcp_t) : sizeof(uv_pipe_t)))) {
+        dsyslog(LOG_ERR, "DNSTAP: Unable to open connection: out of memory");
+        return;
+    }
+    if (via == dnstap_via_tcp)
+        uv_tcp_init(uv_default_loop(), (uv_tcp_t*)conn);
+    else
+        uv_pipe_init(uv_default_loop(), (uv_pipe_t*)conn, 0);
+    if (uv_accept(server, conn) || uv_fileno((uv_handle_t*)conn, &fd)) {
+        uv_close((uv_handle_t*)conn, accepted_close);
+        return;
+    }
+
+    if (!(c = client_new(w))) {
+        dsyslog(LOG_ERR, "DNSTAP: Unable to open connection: out of memory");
+        uv_close((uv_handle_t*)conn, accepted_close);
+        return;
+    }
+    c->via = via;
+    if ((c->fd = dup(fd)) < 0) {
+        dsyslogf(LOG_ERR, "DNSTAP: Unable to hand over connection: %s", strerror(errno));
+        dnswire_reader_destroy(c->reader);
+        xfree(c->rbuf);
+        xfree(c);
+        uv_close((uv_handle_t*)conn, accepted_close);
         return;
     }
+    uv_close((uv_handle_t*)conn, accepted_close);
+
+    dsyslogf(LOG_INFO, "DNSTAP: Connected client %zu over %s on thread %zu", c->id, via == dnstap_via_tcp ? "TCP" : "UNIX socket", w->id);
+
+    uv_mutex_lock(&w->lock);
+    w->load++;
+    c->next     = w->accepted;
+    w->accepted = c;
+    uv_mutex_unlock(&w->lock);
+    uv_async_send(&w->wakeup);
+}
+
+/*
+ * With dnstap_threads a DNSTAP file is mapped and read in chunks, the
+ * frame boundaries of a chunk are found first and then threads decode a
+ * part of the frames each. The DNS messages are counted by the main
+ * thread in the order of the file, so intervals are the same as when the
+ * file is read one frame at a time. The threads are started when the file
+ * is mapped and wait for the next chunk between chunks.
+ */
+#define DNSTAP_FILE_CHUNK (64 * 1024)
+#define FSTRM_CONTROL_STOP 0x03
+
+struct file_part {
+    uv_thread_t   thread;
+    uv_sem_t      go, done;
+    int           started, quit;
+    size_t        first, last; // frames of the chunk
+    struct batch *head, *tail;
+};
+
+static FILE*                 _file = 0;
+static struct dnswire_reader _file_reader;
+
+static const uint8_t*    file_map  = 0;
+static size_t            file_size = 0, file_pos = 0;
+static size_t*           frame_off = 0, *frame_len = 0;
+static struct file_part* file_parts   = 0;
+static size_t            file_part_at = 0; // next part to count
+static struct batch*     file_batch   = 0; // being counted
+static size_t            file_batch_at;
+
+static void file_part_add(struct file_part* p, const transport_message* tm, const uint8_t* payload, size_t len)
+{
+    size_t need = FRAME_SIZE(len);
 
-    if (process_rbuf(req->handle, c)) {
-        if (c->finished) {
-            dsyslogf(LOG_INFO, "DNSTAP: Client %zu is finished, disconnecting", c->id);
-            uv_close((uv_handle_t*)req->handle, client_close);
+    if (!p->tail || p->tail->used + need > p->tail->size) {
+        struct batch* b = batch_new(0, need);
+
+        if (!b) {
+            dsyslog(LOG_ERR, "DNSTAP: Out of memory decoding file, message dropped");
             return;
         }
-        uv_read_start(c->stream, client_alloc_buffer, client_read);
+        if (p->tail)
+            p->tail->next = b;
+        else
+            p->head = b;
+        p->tail = b;
+    }
+    batch_put(p->tail, tm, payload, len);
+}
+
+static void file_part_decode(struct file_part* p)
+{
+    struct client c;
+    size_t        i;
+
+    memset(&c, 0, sizeof(c));
+    c.part = p;
+    for (i = p->first; i < p->last; i++) {
+        struct dnstap d = DNSTAP_INITIALIZER;
+
+        if (dnstap_decode_protobuf(&d, file_map + frame_off[i], frame_len[i]) != dnstap_ok) {
+            dsyslogf(LOG_ERR, "DNSTAP: Unable to decode frame at offset %zu", frame_off[i] - 4);
+            continue;
+        }
+        dnstap_handler(&d, &c);
+        dnstap_cleanup(&d);
+    }
+}
+
+static void file_part_run(void* arg)
+{
+    struct file_part* p = arg;
+
+    for (;;) {
+        uv_sem_wait(&p->go);
+        if (p->quit)
+            break;
+        file_part_decode(p);
+        uv_sem_post(&p->done);
+    }
+}
+
+static void file_parts_start(void)
+{
+    size_t i;
+    int    r;
+
+    for (i = 0; i < dnstap_threads; i++) {
+        struct file_part* p = &file_parts[i];
+
+        if (uv_sem_init(&p->go, 0)) {
+            dsyslog(LOG_ERR, "DNSTAP: Unable to create semaphore, decoding in main thread");
+            continue;
+        }
+        if (uv_sem_init(&p->done, 0)) {
+            dsyslog(LOG_ERR, "DNSTAP: Unable to create semaphore, decoding in main thread");
+            uv_sem_destroy(&p->go);
+            continue;
+        }
+        if ((r = uv_thread_create(&p->thread, file_part_run, p))) {
+            dsyslogf(LOG_ERR, "DNSTAP: Unable to start thread, decoding in main thread: %s", uv_strerror(r));
+            uv_sem_destroy(&p->go);
+            uv_sem_destroy(&p->done);
+            continue;
+        }
+        p->started = 1;
+    }
+}
+
+static void file_parts_stop(void)
+{
+    size_t i;
+
+    for (i = 0; i < dnstap_threads; i++) {
+        struct file_part* p = &file_parts[i];
+
+        if (!p->started)
+            continue;
+        p->quit = 1;
+        uv_sem_post(&p->go);
+        uv_thread_join(&p->thread);
+        uv_sem_destroy(&p->go);
+        uv_sem_destroy(&p->done);
+        p->started = 0;
+    }
+}
+
+static uint32_t file_be32(size_t off)
+{
+    const uint8_t* p = file_map + off;
+
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/*
+ * Find the next chunk of data frames and decode them, returns zero at the
+ * end of the file
+ */
+static int file_decode_chunk(void)
+{
+    size_t n = 0, per, i;
+
+    while (n < DNSTAP_FILE_CHUNK && file_pos + 4 <= file_size) {
+        uint32_t len = file_be32(file_pos);
+
+        if (!len) {
+            // control frame, START is not checked and STOP ends the data
+            if (file_pos + 12 > file_size || file_be32(file_pos + 8) == FSTRM_CONTROL_STOP) {
+                file_pos = file_size;
+                break;
+            }
+            file_pos += 8 + file_be32(file_pos + 4);
+            continue;
+        }
+        if (len > file_size - file_pos - 4) {
+            dsyslogf(LOG_ERR, "DNSTAP: Truncated frame at offset %zu", file_pos);
+            file_pos = file_size;
+            break;
+        }
+        frame_off[n] = file_pos + 4;
+        frame_len[n] = len;
+        n++;
+        file_pos += 4 + len;
+    }
+    if (!n)
+        return 0;
+
+    per = (n + dnstap_threads - 1) / dnstap_threads;
+    for (i = 0; i < dnstap_threads; i++) {
+        struct file_part* p = &file_parts[i];
+
+        p->first = i * per < n ? i * per : n;
+        p->last  = p->first + per < n ? p->first + per : n;
+        p->head = p->tail = 0;
+        if (p->first < p->last) {
+            if (p->started)
+                uv_sem_post(&p->go);
+            else
+                file_part_decode(p);
+        }
+    }
+    for (i = 0; i < dnstap_threads; i++) {
+        if (file_parts[i].started && file_parts[i].first < file_parts[i].last)
+            uv_sem_wait(&file_parts[i].done);
+    }
+    file_part_at = 0;
+    return 1;
+}
+
+static int file_next(struct frame** f)
+{
+    for (;;) {
+        if (file_batch) {
+            if (file_batch_at < file_batch->used) {
+                *f = (struct frame*)((uint8_t*)file_batch->data + file_batch_at);
+                file_batch_at += FRAME_SIZE((*f)->len);
+                return 1;
+            }
+            struct batch* next = file_batch->next;
+            xfree(file_batch);
+            file_batch    = next;
+            file_batch_at = 0;
+            continue;
+        }
+        if (file_parts && file_part_at < dnstap_threads) {
+            file_batch    = file_parts[file_part_at++].head;
+            file_batch_at = 0;
+            continue;
+        }
+        if (!file_decode_chunk())
+            return 0;
     }
 }
 
+static void file_map_open(void)
+{
+#ifdef HAVE_MMAP
+    struct stat st;
+    void*       map;
+
+    if (fstat(fileno(_file), &st) || !st.st_size) {
+        dsyslog(LOG_ERR, "DNSTAP: Unable to map file, reading it in one thread");
+        return;
+    }
+    if ((map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fileno(_file), 0)) == MAP_FAILED) {
+        dsyslogf(LOG_ERR, "DNSTAP: Unable to map file, reading it in one thread: %s", strerror(errno));
+        return;
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+#endif
+    if (!(frame_off = xcalloc(DNSTAP_FILE_CHUNK, sizeof(*frame_off)))
+        || !(frame_len = xcalloc(DNSTAP_FILE_CHUNK, sizeof(*frame_len)))
+        || !(file_parts = xcalloc(dnstap_threads, sizeof(*file_parts)))) {
+        dsyslog(LOG_ERR, "DNSTAP: Out of memory mapping file, reading it in one thread");
+        munmap(map, st.st_size);
+        xfree(frame_off);
+        xfree(frame_len);
+        frame_off = frame_len = 0;
+        return;
+    }
+    file_map      = map;
+    file_size     = st.st_size;
+    file_pos      = 0;
+    file_part_at  = dnstap_threads;
+    file_parts_start();
+    dsyslogf(LOG_INFO, "DNSTAP: Decoding file in %d threads", dnstap_threads);
+#else
+    dsyslog(LOG_ERR, "DNSTAP: No mmap() support, reading file in one thread");
+#endif
+}
+
+static void file_map_close(void)
+{
+    size_t i;
+
+    file_parts_stop();
+    while (file_batch) {
+        struct batch* next = file_batch->next;
+        xfree(file_batch);
+        file_batch = next;
+    }
+    for (i = file_part_at; i < dnstap_threads; i++) {
+        while (file_parts[i].head) {
+            struct batch* next = file_parts[i].head->next;
+            xfree(file_parts[i].head);
+            file_parts[i].head = next;
+        }
+    }
+#ifdef HAVE_MMAP
+    munmap((void*)file_map, file_size);
+#endif
+    xfree(frame_off);
+    xfree(frame_len);
+    xfree(file_parts);
+    file_map   = 0;
+    frame_off  = frame_len = 0;
+    file_parts = 0;
+}
+
+static enum dnswire_result file_read(void)
+{
+    enum dnswire_result res;
+    struct frame*       f;
+
+    if (file_map) {
+        if (!file_next(&f))
+            return dnswire_endofdata;
+        last_ts = f->tm.ts;
+        dns_protocol_handler((const u_char*)(f + 1), f->len, &f->tm);
+        return dnswire_have_dnstap;
+    }
+
+    res = dnswire_reader_fread(&_file_reader, _file);
+    if (res == dnswire_have_dnstap)
+        dnstap_handler(dnswire_reader_dnstap(_file_reader), 0);
+    return res;
+}
+
 static void on_new_unix_connection(uv_stream_t* server, int status)
 {
     if (status < 0) {
         dsyslogf(LOG_ERR, "DNSTAP: Unable to open UNIX socket connection: %s", uv_strerror(status));
         return;
     }
+    if (workers) {
+        worker_accept(server, dnstap_via_unixsock);
+        return;
+    }
 
-    struct client* client = client_new();
+    struct client* client = client_new(0);
     if (!client) {
         dsyslog(LOG_ERR, "DNSTAP: Unable to open UNIX socket connection: out of memory");
         return;
@@ -410,8 +1154,12 @@ static void on_new_tcp_connection(uv_stream_t* server, int status)
         dsyslogf(LOG_ERR, "DNSTAP: Unable to open TCP connection: %s", uv_strerror(status));
         return;
     }
+    if (workers) {
+        worker_accept(server, dnstap_via_tcp);
+        return;
+    }
 
-    struct client* client = client_new();
+    struct client* client = client_new(0);
     if (!client) {
         dsyslog(LOG_ERR, "DNSTAP: Unable to open TCP connection: out of memory");
         return;
@@ -435,7 +1183,7 @@ static void on_new_udp_connection(uv_stream_t* server, int status)
         return;
     }
 
-    struct client* client = client_new();
+    struct client* client = client_new(0);
     if (!client) {
         dsyslog(LOG_ERR, "DNSTAP: Unable to open UDP connection: out of memory");
         return;
@@ -518,7 +1266,41 @@ static int _set_addr(inX_addr* addr, const uint8_t* data, const size_t len)
     return -1;
 }
 
-static int dnstap_handler(const struct dnstap* m)
+/*
+ * Responses often carry the time of the query, pass it on so the response
+ * time can be calculated without matching the query
+ */
+static void _set_query_ts(transport_message* tm, const struct dnstap* m)
+{
+    if (dnstap_message_has_query_time_sec(*m) && dnstap_message_has_query_time_nsec(*m)) {
+        tm->query_ts.tv_sec  = dnstap_message_query_time_sec(*m);
+        tm->query_ts.tv_usec = dnstap_message_query_time_nsec(*m) / 1000;
+    }
+}
+
+/*
+ * Handle the DNS message directly or queue it for the main loop if the
+ * client is on a worker thread
+ */
+static void dnstap_dispatch(struct client* c, transport_message* tm, const uint8_t* payload, size_t len)
+{
+    if (c) {
+        __atomic_fetch_add(&c->frames, 1, __ATOMIC_RELAXED);
+        if (c->worker) {
+            batch_add(c->worker, tm, payload, len);
+            return;
+        }
+        if (c->part) {
+            file_part_add(c->part, tm, payload, len);
+            return;
+        }
+    }
+
+    last_ts = tm->ts;
+    dns_protocol_handler(payload, len, tm);
+}
+
+static int dnstap_handler(const struct dnstap* m, struct client* c)
 {
     transport_message tm = {};
 
@@ -563,8 +1345,7 @@ static int dnstap_handler(const struct dnstap* m)
             tm.dst_port = dnstap_network_port;
         }
 
-        last_ts = tm.ts;
-        dns_protocol_handler(dnstap_message_query_message(*m), dnstap_message_query_message_length(*m), &tm);
+        dnstap_dispatch(c, &tm, dnstap_message_query_message(*m), dnstap_message_query_message_length(*m));
         break;
 
     case DNSTAP_MESSAGE_TYPE_AUTH_RESPONSE:
@@ -605,8 +1386,9 @@ static int dnstap_handler(const struct dnstap* m)
             tm.src_port = dnstap_network_port;
         }
 
-        last_ts = tm.ts;
-        dns_protocol_handler(dnstap_message_response_message(*m), dnstap_message_response_message_length(*m), &tm);
+        _set_query_ts(&tm, m);
+
+        dnstap_dispatch(c, &tm, dnstap_message_response_message(*m), dnstap_message_response_message_length(*m));
         break;
 
     case DNSTAP_MESSAGE_TYPE_RESOLVER_QUERY:
@@ -646,8 +1428,7 @@ static int dnstap_handler(const struct dnstap* m)
             tm.src_port = dnstap_network_port;
         }
 
-        last_ts = tm.ts;
-        dns_protocol_handler(dnstap_message_query_message(*m), dnstap_message_query_message_length(*m), &tm);
+        dnstap_dispatch(c, &tm, dnstap_message_query_message(*m), dnstap_message_query_message_length(*m));
         break;
 
     case DNSTAP_MESSAGE_TYPE_RESOLVER_RESPONSE:
@@ -687,8 +1468,9 @@ static int dnstap_handler(const struct dnstap* m)
             tm.dst_port = dnstap_network_port;
         }
 
-        last_ts = tm.ts;
-        dns_protocol_handler(dnstap_message_response_message(*m), dnstap_message_response_message_length(*m), &tm);
+        _set_query_ts(&tm, m);
+
+        dnstap_dispatch(c, &tm, dnstap_message_response_message(*m), dnstap_message_response_message_length(*m));
         break;
 
     case DNSTAP_MESSAGE_TYPE_CLIENT_QUERY:
@@ -728,8 +1510,7 @@ static int dnstap_handler(const struct dnstap* m)
             tm.dst_port = dnstap_network_port;
         }
 
-        last_ts = tm.ts;
-        dns_protocol_handler(dnstap_message_query_message(*m), dnstap_message_query_message_length(*m), &tm);
+        dnstap_dispatch(c, &tm, dnstap_message_query_message(*m), dnstap_message_query_message_length(*m));
         break;
 
     case DNSTAP_MESSAGE_TYPE_CLIENT_RESPONSE:
@@ -769,8 +1550,9 @@ static int dnstap_handler(const struct dnstap* m)
             tm.src_port = dnstap_network_port;
         }
 
-        last_ts = tm.ts;
-        dns_protocol_handler(dnstap_message_response_message(*m), dnstap_message_response_message_length(*m), &tm);
+        _set_query_ts(&tm, m);
+
+        dnstap_dispatch(c, &tm, dnstap_message_response_message(*m), dnstap_message_response_message_length(*m));
         break;
 
     case DNSTAP_MESSAGE_TYPE_STUB_QUERY:
@@ -812,8 +1594,7 @@ static int dnstap_handler(const struct dnstap* m)
             tm.src_port = dnstap_network_port;
         }
 
-        last_ts = tm.ts;
-        dns_protocol_handler(dnstap_message_query_message(*m), dnstap_message_query_message_length(*m), &tm);
+        dnstap_dispatch(c, &tm, dnstap_message_query_message(*m), dnstap_message_query_message_length(*m));
         break;
 
     case DNSTAP_MESSAGE_TYPE_STUB_RESPONSE:
@@ -855,8 +1636,9 @@ static int dnstap_handler(const struct dnstap* m)
             tm.dst_port = dnstap_network_port;
         }
 
-        last_ts = tm.ts;
-        dns_protocol_handler(dnstap_message_response_message(*m), dnstap_message_response_message_length(*m), &tm);
+        _set_query_ts(&tm, m);
+
+        dnstap_dispatch(c, &tm, dnstap_message_response_message(*m), dnstap_message_response_message_length(*m));
         break;
 
     default:
@@ -872,8 +1654,18 @@ static void stop_uv(uv_timer_t* handle)
     uv_stop(uv_default_loop());
 }
 
-static FILE*                 _file = 0;
-static struct dnswire_reader _file_reader;
+/*
+ * Signals are handled outside of the loop, uv_stop() alone would only be
+ * seen when something else wakes the loop up
+ */
+static uv_async_t stop_async;
+static int        stop_async_ready = 0;
+
+static void stop_async_cb(uv_async_t* handle)
+{
+    uv_stop(uv_default_loop());
+}
+
 static char*                 _sock_file = 0;
 
 #endif // USE_DNSTAP
@@ -1023,10 +1815,11 @@ int dnstap_run(void)
              */
 
             int done = 0;
+            if (dnstap_threads > 0)
+                file_map_open();
             while (!done) {
-                switch (dnswire_reader_fread(&_file_reader, _file)) {
+                switch (file_read()) {
                 case dnswire_have_dnstap:
-                    dnstap_handler(dnswire_reader_dnstap(_file_reader));
                     done = 1;
                     break;
                 case dnswire_again:
@@ -1056,9 +1849,8 @@ int dnstap_run(void)
         }
 
         while (last_ts.tv_sec < finish_ts.tv_sec) {
-            switch (dnswire_reader_fread(&_file_reader, _file)) {
+            switch (file_read()) {
             case dnswire_have_dnstap:
-                dnstap_handler(dnswire_reader_dnstap(_file_reader));
                 break;
             case dnswire_again:
             case dnswire_need_more:
@@ -1084,6 +1876,14 @@ int dnstap_run(void)
             }
         }
     } else {
+        // started here and not at init since daemon mode forks after it
+        if (dnstap_threads > 0 && !workers)
+            workers_start();
+        if (!stop_async_ready) {
+            uv_async_init(uv_default_loop(), &stop_async, stop_async_cb);
+            stop_async_ready = 1;
+        }
+
         gettimeofday(&start_ts, NULL);
         gettimeofday(&last_ts, NULL);
         finish_ts.tv_sec  = ((start_ts.tv_sec / statistics_interval) + 1) * statistics_interval;
@@ -1095,6 +1895,17 @@ int dnstap_run(void)
 
         uv_run(uv_default_loop(), UV_RUN_DEFAULT);
 
+        if (workers) {
+            struct timeval now;
+
+            gettimeofday(&now, NULL);
+            workers_report((now.tv_sec - start_ts.tv_sec) + (now.tv_usec - start_ts.tv_usec) / 1000000.0);
+
+            // count what the threads have read before the last report
+            if (sig_while_processing)
+                batches_process(&batches_ready);
+        }
+
         if (sig_while_processing)
             finish_ts = last_ts;
     }
@@ -1110,6 +1921,8 @@ void dnstap_stop(void)
 #ifdef USE_DNSTAP
     if (!_file) {
         uv_stop(uv_default_loop());
+        if (stop_async_ready)
+            uv_async_send(&stop_async);
     }
 #endif
 }
@@ -1118,10 +1931,14 @@ void dnstap_close(void)
 {
 #ifdef USE_DNSTAP
     if (_file) {
+        if (file_map)
+            file_map_close();
         dnswire_reader_destroy(_file_reader);
         fclose(_file);
         _file = 0;
     } else {
+        if (workers)
+            workers_stop();
         uv_stop(uv_default_loop());
         if (_sock_file) {
             unlink(_sock_file);
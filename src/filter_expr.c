@@ -0,0 +1,683 @@
+/*
+ * Copyright (c) 2008-2023, OARC, Inc.
+ * Copyright (c) 2007-2008, Internet Systems Consortium, Inc.
+ * Copyright (c) 2003-2007, The Measurement Factory, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include "filter_expr.h"
+#include "xmalloc.h"
+#include "syslog_debug.h"
+#include "inX_addr.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <ctype.h>
+#include <sys/socket.h>
+
+/*
+ * Filter expressions are compiled into a small program that works on a
+ * single accumulator, "and" and "or" become conditional jumps so the
+ * evaluation short-circuits like in C.
+ *
+ *   expr    := and { ( "or" | "||" ) and }
+ *   and     := not { ( "and" | "&&" ) not }
+ *   not     := ( "not" | "!" ) not | primary
+ *   primary := "(" expr ")" | FLAG | FIELD OP VALUE | FIELD "in" SET
+ *              | ADDRESS "in" SET | FILTER
+ *   SET     := ELEMENT | "{" ELEMENT { "," ELEMENT } "}"
+ *   ELEMENT := VALUE | VALUE ".." VALUE | PREFIX
+ */
+
+enum filter_op {
+    OP_FLAG,
+    OP_CMP,
+    OP_RANGE,
+    OP_PREFIX,
+    OP_FILTER,
+    OP_NOT,
+    OP_JZ,
+    OP_JNZ
+};
+
+enum filter_cmp {
+    CMP_EQ,
+    CMP_NE,
+    CMP_LT,
+    CMP_LE,
+    CMP_GT,
+    CMP_GE
+};
+
+enum filter_field {
+    F_QR,
+    F_AA,
+    F_TC,
+    F_RD,
+    F_AD,
+    F_DO,
+    F_EDNS,
+    F_MALFORMED,
+    F_QTYPE,
+    F_QCLASS,
+    F_RCODE,
+    F_OPCODE,
+    F_MSGLEN,
+    F_EDNS_VERSION,
+    F_EDNS_BUFSIZ,
+    F_PROTO,
+    F_IP_VERSION,
+    F_SRC_PORT,
+    F_DST_PORT,
+    F_QNAME_LEN,
+    F_LABEL_COUNT,
+    F_CLIENT,
+    F_SERVER
+};
+
+#define FIELD_FLAG 1
+#define FIELD_NUMBER 2
+#define FIELD_ADDRESS 3
+
+typedef struct
+{
+    const char*  name;
+    unsigned int value;
+} filter_value;
+
+static const filter_value qtype_values[] = {
+    { "A", 1 }, { "NS", 2 }, { "CNAME", 5 }, { "SOA", 6 }, { "PTR", 12 },
+    { "MX", 15 }, { "TXT", 16 }, { "AAAA", 28 }, { "SRV", 33 }, { "NAPTR", 35 },
+    { "A6", 38 }, { "DS", 43 }, { "RRSIG", 46 }, { "NSEC", 47 }, { "DNSKEY", 48 },
+    { "NSEC3", 50 }, { "SVCB", 64 }, { "HTTPS", 65 }, { "IXFR", 251 }, { "AXFR", 252 },
+    { "ANY", 255 }, { "CAA", 257 }, { 0 }
+};
+
+static const filter_value qclass_values[] = {
+    { "IN", 1 }, { "CH", 3 }, { "CHAOS", 3 }, { "HS", 4 }, { "NONE", 254 }, { "ANY", 255 }, { 0 }
+};
+
+static const filter_value rcode_values[] = {
+    { "NOERROR", 0 }, { "FORMERR", 1 }, { "SERVFAIL", 2 }, { "NXDOMAIN", 3 },
+    { "NOTIMP", 4 }, { "REFUSED", 5 }, { 0 }
+};
+
+static const filter_value opcode_values[] = {
+    { "QUERY", 0 }, { "IQUERY", 1 }, { "STATUS", 2 }, { "NOTIFY", 4 }, { "UPDATE", 5 }, { 0 }
+};
+
+static const filter_value proto_values[] = {
+    { "TCP", 6 }, { "UDP", 17 }, { 0 }
+};
+
+static const struct
+{
+    const char*         name;
+    enum filter_field   field;
+    int                 type;
+    const filter_value* values;
+} fields[] = {
+    { "qr", F_QR, FIELD_FLAG, 0 },
+    { "aa", F_AA, FIELD_FLAG, 0 },
+    { "tc", F_TC, FIELD_FLAG, 0 },
+    { "rd", F_RD, FIELD_FLAG, 0 },
+    { "ad", F_AD, FIELD_FLAG, 0 },
+    { "do", F_DO, FIELD_FLAG, 0 },
+    { "edns", F_EDNS, FIELD_FLAG, 0 },
+    { "malformed", F_MALFORMED, FIELD_FLAG, 0 },
+    { "qtype", F_QTYPE, FIELD_NUMBER, qtype_values },
+    { "qclass", F_QCLASS, FIELD_NUMBER, qclass_values },
+    { "rcode", F_RCODE, FIELD_NUMBER, rcode_values },
+    { "opcode", F_OPCODE, FIELD_NUMBER, opcode_values },
+    { "msglen", F_MSGLEN, FIELD_NUMBER, 0 },
+    { "edns_version", F_EDNS_VERSION, FIELD_NUMBER, 0 },
+    { "edns_bufsiz", F_EDNS_BUFSIZ, FIELD_NUMBER, 0 },
+    { "proto", F_PROTO, FIELD_NUMBER, proto_values },
+    { "ip_version", F_IP_VERSION, FIELD_NUMBER, 0 },
+    { "src_port", F_SRC_PORT, FIELD_NUMBER, 0 },
+    { "dst_port", F_DST_PORT, FIELD_NUMBER, 0 },
+    { "qname_len", F_QNAME_LEN, FIELD_NUMBER, 0 },
+    { "label_count", F_LABEL_COUNT, FIELD_NUMBER, 0 },
+    { "client", F_CLIENT, FIELD_ADDRESS, 0 },
+    { "server", F_SERVER, FIELD_ADDRESS, 0 },
+    { 0 }
+};
+
+typedef struct
+{
+    inX_addr addr;
+    inX_addr mask;
+} filter_prefix;
+
+typedef struct
+{
+    enum filter_op    op;
+    enum filter_field field;
+    enum filter_cmp   cmp;
+    unsigned int      a, b; // value, range or jump target
+    const void*       ptr; // filter_defn for OP_FILTER, filter_prefix for OP_PREFIX
+} filter_insn;
+
+struct filter_expr {
+    filter_insn* insn;
+    size_t       n;
+};
+
+/*
+ * Compiler
+ */
+
+typedef struct
+{
+    const char*  name;
+    const char*  p;
+    char         tok[256];
+    filter_insn* insn;
+    size_t       n, size;
+    int          bad;
+} filter_compiler;
+
+static void fc_error(filter_compiler* c, const char* msg)
+{
+    if (c->bad)
+        return;
+    if (*c->tok) {
+        dsyslogf(LOG_ERR, "filter %s: %s at '%s'", c->name, msg, c->tok);
+    } else {
+        dsyslogf(LOG_ERR, "filter %s: %s at end of expression", c->name, msg);
+    }
+    c->bad = 1;
+}
+
+/*
+ * Read the next token, words are made of the characters found in names,
+ * numbers and addresses, everything else is one or two characters
+ */
+static void fc_next(filter_compiler* c)
+{
+    size_t n = 0;
+
+    while (isspace((unsigned char)*c->p))
+        c->p++;
+    if (*c->p && (isalnum((unsigned char)*c->p) || strchr("_-.:/", *c->p))) {
+        while (*c->p && (isalnum((unsigned char)*c->p) || strchr("_-.:/", *c->p))) {
+            if (n < sizeof(c->tok) - 1)
+                c->tok[n++] = *c->p;
+            c->p++;
+        }
+    } else if (*c->p) {
+        c->tok[n++] = *c->p++;
+        if ((('=' == c->tok[0] || '!' == c->tok[0] || '<' == c->tok[0] || '>' == c->tok[0]) && '=' == *c->p)
+            || ('&' == c->tok[0] && '&' == *c->p) || ('|' == c->tok[0] && '|' == *c->p))
+            c->tok[n++] = *c->p++;
+    }
+    c->tok[n] = 0;
+}
+
+static int fc_is(filter_compiler* c, const char* tok)
+{
+    return !strcmp(c->tok, tok);
+}
+
+static size_t fc_emit(filter_compiler* c, enum filter_op op)
+{
+    if (c->n == c->size) {
+        size_t       size = c->size ? c->size * 2 : 16;
+        filter_insn* insn = xrealloc(c->insn, size * sizeof(*insn));
+        if (!insn) {
+            fc_error(c, "out of memory");
+            return 0;
+        }
+        c->insn = insn;
+        c->size = size;
+    }
+    memset(&c->insn[c->n], 0, sizeof(*c->insn));
+    c->insn[c->n].op = op;
+    return c->n++;
+}
+
+static void fc_patch(filter_compiler* c, size_t from)
+{
+    // point all jumps from the given instruction onward that are not yet
+    // set to here
+    for (; from < c->n; from++) {
+        if ((OP_JZ == c->insn[from].op || OP_JNZ == c->insn[from].op) && !c->insn[from].a)
+            c->insn[from].a = c->n;
+    }
+}
+
+static int fc_value(filter_compiler* c, const char* s, const filter_value* values, unsigned int* value)
+{
+    char* e;
+
+    if (values) {
+        for (; values->name; values++) {
+            if (!strcasecmp(s, values->name)) {
+                *value = values->value;
+                return 1;
+            }
+        }
+    }
+    if (!isdigit((unsigned char)*s))
+        return 0;
+    *value = strtoul(s, &e, 10);
+    return !*e;
+}
+
+static int fc_prefix(const char* s, filter_prefix* p)
+{
+    char  buf[64];
+    char* slash;
+    int   bits, i, max;
+
+    if (strlen(s) >= sizeof(buf))
+        return 0;
+    strcpy(buf, s);
+    if ((slash = strchr(buf, '/')))
+        *slash = 0;
+    memset(p, 0, sizeof(*p));
+    if (inXaddr_pton(buf, &p->addr) != 1)
+        return 0;
+    max  = AF_INET6 == p->addr.family ? 128 : 32;
+    bits = slash ? atoi(slash + 1) : max;
+    if (bits < 0 || bits > max || (slash && !isdigit((unsigned char)slash[1])))
+        return 0;
+
+    p->mask.family = p->addr.family;
+    for (i = 0; i < bits; i++) {
+        if (AF_INET6 == p->addr.family)
+            p->mask.in6.s6_addr[i / 8] |= 0x80 >> (i % 8);
+        else
+            ((unsigned char*)&p->mask.in4.s_addr)[i / 8] |= 0x80 >> (i % 8);
+    }
+    p->addr = inXaddr_mask(&p->addr, &p->mask);
+    return 1;
+}
+
+static void fc_expr(filter_compiler* c);
+
+/*
+ * One element of a set, the field is tested against a value, a range of
+ * values or an address prefix
+ */
+static void fc_element(filter_compiler* c, int f)
+{
+    size_t i;
+
+    if (FIELD_ADDRESS == fields[f].type) {
+        filter_prefix* p = xcalloc(1, sizeof(*p));
+        if (!p) {
+            fc_error(c, "out of memory");
+            return;
+        }
+        if (!fc_prefix(c->tok, p)) {
+            xfree(p);
+            fc_error(c, "invalid address prefix");
+            return;
+        }
+        i                = fc_emit(c, OP_PREFIX);
+        c->insn[i].field = fields[f].field;
+        c->insn[i].ptr   = p;
+    } else {
+        char* dots = strstr(c->tok, "..");
+        i          = fc_emit(c, dots ? OP_RANGE : OP_CMP);
+        if (c->bad)
+            return;
+        c->insn[i].field = fields[f].field;
+        c->insn[i].cmp   = CMP_EQ;
+        if (dots)
+            *dots = 0;
+        if (!fc_value(c, c->tok, fields[f].values, &c->insn[i].a)
+            || (dots && !fc_value(c, dots + 2, fields[f].values, &c->insn[i].b))) {
+            if (dots)
+                *dots = '.';
+            fc_error(c, "invalid value");
+            return;
+        }
+    }
+    fc_next(c);
+}
+
+static void fc_set(filter_compiler* c, int f)
+{
+    size_t start = c->n;
+
+    if (!fc_is(c, "{")) {
+        fc_element(c, f);
+        return;
+    }
+    fc_next(c);
+    for (;;) {
+        fc_element(c, f);
+        if (c->bad)
+            return;
+        if (fc_is(c, "}"))
+            break;
+        if (!fc_is(c, ",")) {
+            fc_error(c, "expected ',' or '}'");
+            return;
+        }
+        fc_emit(c, OP_JNZ);
+        fc_next(c);
+    }
+    fc_patch(c, start);
+    fc_next(c);
+}
+
+static void fc_primary(filter_compiler* c)
+{
+    enum filter_cmp cmp;
+    size_t          i;
+    int             f;
+
+    if (fc_is(c, "(")) {
+        fc_next(c);
+        fc_expr(c);
+        if (!c->bad && !fc_is(c, ")"))
+            fc_error(c, "expected ')'");
+        fc_next(c);
+        return;
+    }
+    for (f = 0; fields[f].name; f++) {
+        if (!strcmp(c->tok, fields[f].name))
+            break;
+    }
+    if (!fields[f].name) {
+        filter_defn* d;
+        if (!*c->tok || !(d = dns_message_find_filter(c->tok))) {
+            fc_error(c, "unknown field or filter");
+            return;
+        }
+        i              = fc_emit(c, OP_FILTER);
+        c->insn[i].ptr = d;
+        fc_next(c);
+        return;
+    }
+    fc_next(c);
+
+    if (FIELD_FLAG == fields[f].type) {
+        i                = fc_emit(c, OP_FLAG);
+        c->insn[i].field = fields[f].field;
+        return;
+    }
+    if (fc_is(c, "in")) {
+        fc_next(c);
+        fc_set(c, f);
+        return;
+    }
+    if (FIELD_ADDRESS == fields[f].type) {
+        fc_error(c, "expected 'in'");
+        return;
+    }
+
+    if (fc_is(c, "==") || fc_is(c, "="))
+        cmp = CMP_EQ;
+    else if (fc_is(c, "!="))
+        cmp = CMP_NE;
+    else if (fc_is(c, "<"))
+        cmp = CMP_LT;
+    else if (fc_is(c, "<="))
+        cmp = CMP_LE;
+    else if (fc_is(c, ">"))
+        cmp = CMP_GT;
+    else if (fc_is(c, ">="))
+        cmp = CMP_GE;
+    else {
+        fc_error(c, "expected comparison or 'in'");
+        return;
+    }
+    fc_next(c);
+    if (strstr(c->tok, "..")) {
+        fc_error(c, "ranges only work with 'in'");
+        return;
+    }
+    fc_element(c, f);
+    if (!c->bad)
+        c->insn[c->n - 1].cmp = cmp;
+}
+
+static void fc_not(filter_compiler* c)
+{
+    if (fc_is(c, "not") || fc_is(c, "!")) {
+        fc_next(c);
+        fc_not(c);
+        fc_emit(c, OP_NOT);
+        return;
+    }
+    fc_primary(c);
+}
+
+static void fc_and(filter_compiler* c)
+{
+    size_t start = c->n;
+
+    fc_not(c);
+    while (!c->bad && (fc_is(c, "and") || fc_is(c, "&&"))) {
+        fc_emit(c, OP_JZ);
+        fc_next(c);
+        fc_not(c);
+    }
+    fc_patch(c, start);
+}
+
+static void fc_expr(filter_compiler* c)
+{
+    size_t start = c->n;
+
+    fc_and(c);
+    while (!c->bad && (fc_is(c, "or") || fc_is(c, "||"))) {
+        fc_emit(c, OP_JNZ);
+        fc_next(c);
+        fc_and(c);
+    }
+    fc_patch(c, start);
+}
+
+static void filter_expr_free_insn(filter_insn* insn, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        if (OP_PREFIX == insn[i].op)
+            xfree((void*)insn[i].ptr);
+    }
+    xfree(insn);
+}
+
+filter_expr* filter_expr_compile(const char* name, const char* expr)
+{
+    filter_compiler c;
+    filter_expr*    f;
+
+    memset(&c, 0, sizeof(c));
+    c.name = name;
+    c.p    = expr;
+    fc_next(&c);
+    if (!*c.tok)
+        fc_error(&c, "empty expression");
+    else {
+        fc_expr(&c);
+        if (!c.bad && *c.tok)
+            fc_error(&c, "unexpected token");
+    }
+    if (c.bad || !(f = xcalloc(1, sizeof(*f)))) {
+        filter_expr_free_insn(c.insn, c.n);
+        return 0;
+    }
+    f->insn = c.insn;
+    f->n    = c.n;
+    return f;
+}
+
+void filter_expr_free(filter_expr* f)
+{
+    if (!f)
+        return;
+    filter_expr_free_insn(f->insn, f->n);
+    xfree(f);
+}
+
+/*
+ * Evaluation
+ */
+
+static unsigned int filter_field_value(const dns_message* m, enum filter_field field)
+{
+    switch (field) {
+    case F_QR:
+        return m->qr;
+    case F_AA:
+        return m->aa;
+    case F_TC:
+        return m->tc;
+    case F_RD:
+        return m->rd;
+    case F_AD:
+        return m->ad;
+    case F_DO:
+        return m->edns.DO;
+    case F_EDNS:
+        return m->edns.found;
+    case F_MALFORMED:
+        return m->malformed;
+    case F_QTYPE:
+        return m->qtype;
+    case F_QCLASS:
+        return m->qclass;
+    case F_RCODE:
+        return m->rcode;
+    case F_OPCODE:
+        return m->opcode;
+    case F_MSGLEN:
+        return m->msglen;
+    case F_EDNS_VERSION:
+        return m->edns.version;
+    case F_EDNS_BUFSIZ:
+        return m->edns.bufsiz;
+    case F_PROTO:
+        return m->tm->proto;
+    case F_IP_VERSION:
+        return m->tm->ip_version;
+    case F_SRC_PORT:
+        return m->tm->src_port;
+    case F_DST_PORT:
+        return m->tm->dst_port;
+    case F_QNAME_LEN:
+        return m->qname_len;
+    case F_LABEL_COUNT:
+        return m->label_count;
+    default:
+        break;
+    }
+    return 0;
+}
+
+static int filter_prefix_match(const dns_message* m, const filter_insn* insn)
+{
+    const filter_prefix* p = insn->ptr;
+    const inX_addr*      a;
+    inX_addr             masked;
+
+    if (F_CLIENT == insn->field)
+        a = m->qr ? &m->tm->dst_ip_addr : &m->tm->src_ip_addr;
+    else
+        a = m->qr ? &m->tm->src_ip_addr : &m->tm->dst_ip_addr;
+    if (a->family != p->addr.family)
+        return 0;
+    masked = inXaddr_mask(a, &p->mask);
+    return !inXaddr_cmp(&masked, &p->addr);
+}
+
+int filter_expr_eval(const filter_expr* f, const dns_message* m)
+{
+    const filter_insn* insn;
+    unsigned int       v;
+    size_t             pc  = 0;
+    int                acc = 0;
+
+    while (pc < f->n) {
+        insn = &f->insn[pc++];
+        switch (insn->op) {
+        case OP_FLAG:
+            acc = !!filter_field_value(m, insn->field);
+            break;
+        case OP_CMP:
+            v = filter_field_value(m, insn->field);
+            switch (insn->cmp) {
+            case CMP_EQ:
+                acc = v == insn->a;
+                break;
+            case CMP_NE:
+                acc = v != insn->a;
+                break;
+            case CMP_LT:
+                acc = v < insn->a;
+                break;
+            case CMP_LE:
+                acc = v <= insn->a;
+                break;
+            case CMP_GT:
+                acc = v > insn->a;
+                break;
+            case CMP_GE:
+                acc = v >= insn->a;
+                break;
+            }
+            break;
+        case OP_RANGE:
+            v   = filter_field_value(m, insn->field);
+            acc = v >= insn->a && v <= insn->b;
+            break;
+        case OP_PREFIX:
+            acc = filter_prefix_match(m, insn);
+            break;
+        case OP_FILTER:
+            acc = ((const filter_defn*)insn->ptr)->func(m, ((const filter_defn*)insn->ptr)->context);
+            break;
+        case OP_NOT:
+            acc = !acc;
+            break;
+        case OP_JZ:
+            if (!acc)
+                pc = insn->a;
+            break;
+        case OP_JNZ:
+            if (acc)
+                pc = insn->a;
+            break;
+        }
+    }
+    return acc;
+}
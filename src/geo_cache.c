@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2008-2023, OARC, Inc.
+ * Copyright (c) 2007-2008, Internet Systems Consortium, Inc.
+ * Copyright (c) 2003-2007, The Measurement Factory, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include "geo_cache.h"
+#include "lpm.h"
+#include "hashtbl.h"
+#include "xmalloc.h"
+#include "syslog_debug.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+/*
+ * Cache of GeoIP/MaxMind lookup results per network, the result of a
+ * lookup is valid for the whole network the database returned it for so
+ * it is stored as a prefix in a longest prefix match trie with the value
+ * being the index of the result string.
+ *
+ * The cache lives across statistics intervals and is thrown away when the
+ * database is (re)opened, or when it has grown to GEO_CACHE_MAX_PREFIXES
+ * networks.
+ */
+
+#define GEO_CACHE_MAX_PREFIXES (1 << 18)
+#define GEO_CACHE_HASH_SIZE 4096
+
+typedef struct
+{
+    char*        value;
+    unsigned int id;
+} geo_cache_value;
+
+struct geo_cache {
+    const char*       name;
+    lpm*              prefixes;
+    size_t            num_prefixes;
+    hashtbl*          values;
+    geo_cache_value** value; // by id - 1
+    size_t            num_values, size_values;
+    uint64_t          hits, misses;
+};
+
+static unsigned int
+geo_cache_hashfunc(const void* key)
+{
+    return hash_keyed(key, strlen(key));
+}
+
+static int
+geo_cache_cmpfunc(const void* a, const void* b)
+{
+    return strcmp(a, b);
+}
+
+static void geo_cache_value_free(void* p)
+{
+    geo_cache_value* v = p;
+
+    xfree(v->value);
+    xfree(v);
+}
+
+static void geo_cache_clear(geo_cache* c)
+{
+    lpm_free(c->prefixes);
+    c->prefixes     = NULL;
+    c->num_prefixes = 0;
+    if (c->values) {
+        hash_destroy(c->values);
+        c->values = NULL;
+    }
+    xfree(c->value);
+    c->value       = NULL;
+    c->num_values  = 0;
+    c->size_values = 0;
+}
+
+geo_cache* geo_cache_create(const char* name)
+{
+    geo_cache* c = xcalloc(1, sizeof(*c));
+
+    if (c)
+        c->name = name;
+    return c;
+}
+
+void geo_cache_free(geo_cache* c)
+{
+    if (c) {
+        geo_cache_clear(c);
+        xfree(c);
+    }
+}
+
+/*
+ * Returns the cached result for the address or NULL if the database
+ * needs to be asked
+ */
+const char* geo_cache_find(geo_cache* c, const inX_addr* addr)
+{
+    unsigned int id;
+
+    if (c && c->prefixes && (id = lpm_lookup(c->prefixes, addr))) {
+        c->hits++;
+        return c->value[id - 1]->value;
+    }
+    if (c)
+        c->misses++;
+    return NULL;
+}
+
+static unsigned int geo_cache_intern(geo_cache* c, const char* value)
+{
+    geo_cache_value* v;
+
+    if (!c->values) {
+        if (!(c->values = hash_create(GEO_CACHE_HASH_SIZE, geo_cache_hashfunc, geo_cache_cmpfunc, 0, 0, geo_cache_value_free)))
+            return 0;
+    }
+    if ((v = hash_find(value, c->values)))
+        return v->id;
+
+    if (c->num_values == c->size_values) {
+        size_t            size = c->size_values ? c->size_values * 2 : 64;
+        geo_cache_value** value;
+        if (!(value = xrealloc(c->value, size * sizeof(*value))))
+            return 0;
+        c->value       = value;
+        c->size_values = size;
+    }
+    if (!(v = xcalloc(1, sizeof(*v))))
+        return 0;
+    if (!(v->value = xstrdup(value))) {
+        xfree(v);
+        return 0;
+    }
+    v->id = c->num_values + 1;
+    if (hash_add(v->value, v, c->values)) {
+        geo_cache_value_free(v);
+        return 0;
+    }
+    c->value[c->num_values++] = v;
+    return v->id;
+}
+
+/*
+ * Remember the result of a lookup for the network of the given length
+ * that the address is in, failing to do so only means the next lookup
+ * will ask the database again
+ */
+void geo_cache_add(geo_cache* c, const inX_addr* addr, int bits, const char* value)
+{
+    unsigned int id;
+
+    if (!c || !value)
+        return;
+    if (c->num_prefixes >= GEO_CACHE_MAX_PREFIXES) {
+        dfprintf(0, "%s: lookup cache full, flushing", c->name);
+        geo_cache_clear(c);
+    }
+    if (!c->prefixes && !(c->prefixes = lpm_create()))
+        return;
+    if (!(id = geo_cache_intern(c, value)))
+        return;
+    if (lpm_add(c->prefixes, addr, bits, id))
+        c->num_prefixes++;
+}
+
+void geo_cache_report(geo_cache* c)
+{
+    if (!c || !(c->hits + c->misses))
+        return;
+    dfprintf(0, "%s: lookup cache %" PRIu64 " hits, %" PRIu64 " misses, %zu networks",
+        c->name, c->hits, c->misses, c->num_prefixes);
+    c->hits   = 0;
+    c->misses = 0;
+}
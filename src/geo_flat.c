@@ -0,0 +1,612 @@
+/*
+ * Copyright (c) 2008-2023, OARC, Inc.
+ * Copyright (c) 2007-2008, Internet Systems Consortium, Inc.
+ * Copyright (c) 2003-2007, The Measurement Factory, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#if defined(HAVE_LIBMAXMINDDB) && defined(HAVE_MAXMINDDB_H)
+
+#include "geo_flat.h"
+
+#ifdef HAVE_GEO_FLAT
+
+#include "xmalloc.h"
+#include "syslog_debug.h"
+#include "hashtbl.h"
+#include "compat.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#ifdef HAVE_MLOCK
+#include <sys/mman.h>
+#endif
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+/*
+ * A MaxMind database flattened into sorted tables of address ranges, one
+ * for IPv4 and one for IPv6, where each range starts at an address and
+ * ends where the next starts. Adjacent networks with the same value are
+ * merged into one range.
+ *
+ * The value is found with a branch free binary search for the last range
+ * that starts at or before the address, giving the index of the value
+ * string or zero if the database has none for it.
+ *
+ * The tables are built by walking the whole search tree of the database
+ * once when it is opened and again, in a thread, when the file changes.
+ */
+
+struct geo_flat {
+    uint32_t* v4_start;
+    uint32_t* v4_id;
+    size_t    v4_ranges;
+    uint64_t* v6_hi; // first 64 bits of the start address
+    uint64_t* v6_lo; // last 64 bits of the start address
+    uint32_t* v6_id;
+    size_t    v6_ranges;
+    char**    value; // by id - 1
+    size_t    values;
+};
+
+typedef struct
+{
+    MMDB_s             mmdb;
+    geo_flat_value_fn* value_fn;
+    char               buf[256];
+
+    /* id of the value of each data section entry seen */
+    uint32_t* memo_offset; // offset + 1, zero is unused
+    uint32_t* memo_id;
+    size_t    memo_size, memo_used;
+
+    /* interned values, the ids are indexes + 1 in value */
+    uint32_t* intern;
+    size_t    intern_size;
+    char**    value;
+    size_t    values, size_values;
+
+    /* the ranges of the table being built */
+    uint64_t* hi;
+    uint64_t* lo;
+    uint32_t* id;
+    size_t    ranges, size_ranges;
+} geo_flat_builder;
+
+static void geo_flat_builder_free(geo_flat_builder* b)
+{
+    xfree(b->memo_offset);
+    xfree(b->memo_id);
+    xfree(b->intern);
+    xfree(b->hi);
+    xfree(b->lo);
+    xfree(b->id);
+}
+
+static uint32_t geo_flat_intern(geo_flat_builder* b, const char* value)
+{
+    size_t   mask, i, n;
+    uint32_t id;
+
+    if (b->values * 2 >= b->intern_size) {
+        size_t    size = b->intern_size ? b->intern_size * 2 : 1024;
+        uint32_t* intern;
+
+        if (!(intern = xcalloc(size, sizeof(*intern))))
+            return 0;
+        mask = size - 1;
+        for (n = 0; n < b->values; n++) {
+            const char* v = b->value[n];
+            for (i = hash_keyed(v, strlen(v)) & mask; intern[i]; i = (i + 1) & mask)
+                ;
+            intern[i] = n + 1;
+        }
+        xfree(b->intern);
+        b->intern      = intern;
+        b->intern_size = size;
+    }
+
+    mask = b->intern_size - 1;
+    for (i = hash_keyed(value, strlen(value)) & mask; (id = b->intern[i]); i = (i + 1) & mask) {
+        if (!strcmp(b->value[id - 1], value))
+            return id;
+    }
+
+    if (b->values == b->size_values) {
+        size_t size = b->size_values ? b->size_values * 2 : 256;
+        char** v;
+
+        if (!(v = xrealloc(b->value, size * sizeof(*v))))
+            return 0;
+        b->value       = v;
+        b->size_values = size;
+    }
+    if (!(b->value[b->values] = xstrdup(value)))
+        return 0;
+    b->values++;
+    b->intern[i] = b->values;
+    return b->values;
+}
+
+static int geo_flat_value(geo_flat_builder* b, MMDB_entry_s* entry, uint32_t* id)
+{
+    size_t      mask, i;
+    const char* value;
+
+    if (b->memo_used * 2 >= b->memo_size) {
+        size_t    size = b->memo_size ? b->memo_size * 2 : 4096, n;
+        uint32_t *offset, *ids;
+
+        if (!(offset = xcalloc(size, sizeof(*offset))))
+            return 0;
+        if (!(ids = xcalloc(size, sizeof(*ids)))) {
+            xfree(offset);
+            return 0;
+        }
+        mask = size - 1;
+        for (n = 0; n < b->memo_size; n++) {
+            if (!b->memo_offset[n])
+                continue;
+            for (i = (b->memo_offset[n] * 2654435761U) & mask; offset[i]; i = (i + 1) & mask)
+                ;
+            offset[i] = b->memo_offset[n];
+            ids[i]    = b->memo_id[n];
+        }
+        xfree(b->memo_offset);
+        xfree(b->memo_id);
+        b->memo_offset = offset;
+        b->memo_id     = ids;
+        b->memo_size   = size;
+    }
+
+    mask = b->memo_size - 1;
+    for (i = ((entry->offset + 1) * 2654435761U) & mask; b->memo_offset[i]; i = (i + 1) & mask) {
+        if (b->memo_offset[i] == entry->offset + 1) {
+            *id = b->memo_id[i];
+            return 1;
+        }
+    }
+
+    *id = 0;
+    if ((value = b->value_fn(entry, b->buf, sizeof(b->buf))) && !(*id = geo_flat_intern(b, value)))
+        return 0;
+    b->memo_offset[i] = entry->offset + 1;
+    b->memo_id[i]     = *id;
+    b->memo_used++;
+    return 1;
+}
+
+static int geo_flat_emit(geo_flat_builder* b, uint64_t hi, uint64_t lo, uint32_t id)
+{
+    if (b->ranges && b->id[b->ranges - 1] == id)
+        return 1;
+
+    if (b->ranges == b->size_ranges) {
+        size_t    size = b->size_ranges ? b->size_ranges * 2 : 65536;
+        uint64_t* h;
+        uint64_t* l;
+        uint32_t* i;
+
+        if (!(h = xrealloc(b->hi, size * sizeof(*h))))
+            return 0;
+        b->hi = h;
+        if (!(l = xrealloc(b->lo, size * sizeof(*l))))
+            return 0;
+        b->lo = l;
+        if (!(i = xrealloc(b->id, size * sizeof(*i))))
+            return 0;
+        b->id          = i;
+        b->size_ranges = size;
+    }
+    b->hi[b->ranges] = hi;
+    b->lo[b->ranges] = lo;
+    b->id[b->ranges] = id;
+    b->ranges++;
+    return 1;
+}
+
+static int geo_flat_walk(geo_flat_builder* b, uint32_t node, int depth, int width, uint64_t hi, uint64_t lo);
+
+static int geo_flat_record(geo_flat_builder* b, uint64_t record, uint8_t type, MMDB_entry_s* entry, int depth, int width, uint64_t hi, uint64_t lo)
+{
+    uint32_t id;
+
+    switch (type) {
+    case MMDB_RECORD_TYPE_SEARCH_NODE:
+        return geo_flat_walk(b, (uint32_t)record, depth, width, hi, lo);
+    case MMDB_RECORD_TYPE_EMPTY:
+        return geo_flat_emit(b, hi, lo, 0);
+    case MMDB_RECORD_TYPE_DATA:
+        return geo_flat_value(b, entry, &id) && geo_flat_emit(b, hi, lo, id);
+    default:
+        break;
+    }
+    return 0;
+}
+
+/*
+ * Walk the tree below a node at the given depth in address order, the
+ * bits of the address are counted from the top of a width bits number
+ * kept in hi and lo
+ */
+static int geo_flat_walk(geo_flat_builder* b, uint32_t node, int depth, int width, uint64_t hi, uint64_t lo)
+{
+    MMDB_search_node_s n;
+    int                bit = width - 1 - depth;
+
+    if (depth >= width || MMDB_read_node(&b->mmdb, node, &n) != MMDB_SUCCESS)
+        return 0;
+    if (!geo_flat_record(b, n.left_record, n.left_record_type, &n.left_record_entry, depth + 1, width, hi, lo))
+        return 0;
+    if (bit >= 64)
+        hi |= (uint64_t)1 << (bit - 64);
+    else
+        lo |= (uint64_t)1 << bit;
+    return geo_flat_record(b, n.right_record, n.right_record_type, &n.right_record_entry, depth + 1, width, hi, lo);
+}
+
+/*
+ * IPv4 addresses in an IPv6 database are found below ::/96
+ */
+static int geo_flat_walk_v4(geo_flat_builder* b)
+{
+    MMDB_search_node_s n;
+    uint32_t           node = 0;
+    int                depth;
+
+    if (b->mmdb.metadata.ip_version == 4)
+        return geo_flat_walk(b, 0, 0, 32, 0, 0);
+
+    for (depth = 0; depth < 96; depth++) {
+        if (MMDB_read_node(&b->mmdb, node, &n) != MMDB_SUCCESS)
+            return 0;
+        if (n.left_record_type != MMDB_RECORD_TYPE_SEARCH_NODE)
+            return geo_flat_record(b, n.left_record, n.left_record_type, &n.left_record_entry, 0, 32, 0, 0);
+        node = n.left_record;
+    }
+    return geo_flat_walk(b, node, 0, 32, 0, 0);
+}
+
+static void geo_flat_lock(const void* p, size_t len)
+{
+#ifdef HAVE_MLOCK
+    if (p && len && mlock(p, len)) {
+        char errbuf[512];
+        dfprintf(0, "geo_flat: unable to lock %zu bytes in memory: %s", len, dsc_strerror(errno, errbuf, sizeof(errbuf)));
+    }
+#endif
+}
+
+static void geo_flat_unlock(const void* p, size_t len)
+{
+#ifdef HAVE_MLOCK
+    if (p && len)
+        munlock(p, len);
+#endif
+}
+
+void geo_flat_free(geo_flat* f)
+{
+    size_t i;
+
+    if (!f)
+        return;
+    geo_flat_unlock(f->v4_start, f->v4_ranges * sizeof(*f->v4_start));
+    geo_flat_unlock(f->v4_id, f->v4_ranges * sizeof(*f->v4_id));
+    geo_flat_unlock(f->v6_hi, f->v6_ranges * sizeof(*f->v6_hi));
+    geo_flat_unlock(f->v6_lo, f->v6_ranges * sizeof(*f->v6_lo));
+    geo_flat_unlock(f->v6_id, f->v6_ranges * sizeof(*f->v6_id));
+    xfree(f->v4_start);
+    xfree(f->v4_id);
+    xfree(f->v6_hi);
+    xfree(f->v6_lo);
+    xfree(f->v6_id);
+    for (i = 0; i < f->values; i++)
+        xfree(f->value[i]);
+    xfree(f->value);
+    xfree(f);
+}
+
+static int geo_flat_build_tables(geo_flat_builder* b, geo_flat* f)
+{
+    size_t i;
+
+    if (!geo_flat_walk_v4(b))
+        return 0;
+    if (!(f->v4_start = xmalloc(b->ranges * sizeof(*f->v4_start))))
+        return 0;
+    for (i = 0; i < b->ranges; i++)
+        f->v4_start[i] = (uint32_t)b->lo[i];
+    f->v4_id       = b->id;
+    f->v4_ranges   = b->ranges;
+    b->id          = NULL;
+    b->ranges      = 0;
+    b->size_ranges = 0;
+
+    if (b->mmdb.metadata.ip_version == 6) {
+        if (!geo_flat_walk(b, 0, 0, 128, 0, 0))
+            return 0;
+        f->v6_hi     = b->hi;
+        f->v6_lo     = b->lo;
+        f->v6_id     = b->id;
+        f->v6_ranges = b->ranges;
+        b->hi        = NULL;
+        b->lo        = NULL;
+        b->id        = NULL;
+    }
+
+    return 1;
+}
+
+/*
+ * Flatten a MaxMind database, returns NULL with ret set to the MaxMind DB
+ * error code on failure
+ */
+geo_flat* geo_flat_build(const char* file, geo_flat_value_fn* value, int* ret)
+{
+    geo_flat_builder b;
+    geo_flat*        f;
+
+    memset(&b, 0, sizeof(b));
+    b.value_fn = value;
+    if ((*ret = MMDB_open(file, 0, &b.mmdb)) != MMDB_SUCCESS)
+        return NULL;
+
+    if (!(f = xcalloc(1, sizeof(*f)))) {
+        MMDB_close(&b.mmdb);
+        *ret = MMDB_OUT_OF_MEMORY_ERROR;
+        return NULL;
+    }
+    if (!geo_flat_build_tables(&b, f)) {
+        f->value  = b.value;
+        f->values = b.values;
+        geo_flat_free(f);
+        geo_flat_builder_free(&b);
+        MMDB_close(&b.mmdb);
+        *ret = MMDB_INVALID_SEARCH_TREE_ERROR;
+        return NULL;
+    }
+    f->value  = b.value;
+    f->values = b.values;
+    geo_flat_builder_free(&b);
+    MMDB_close(&b.mmdb);
+
+    geo_flat_lock(f->v4_start, f->v4_ranges * sizeof(*f->v4_start));
+    geo_flat_lock(f->v4_id, f->v4_ranges * sizeof(*f->v4_id));
+    geo_flat_lock(f->v6_hi, f->v6_ranges * sizeof(*f->v6_hi));
+    geo_flat_lock(f->v6_lo, f->v6_ranges * sizeof(*f->v6_lo));
+    geo_flat_lock(f->v6_id, f->v6_ranges * sizeof(*f->v6_id));
+
+    dfprintf(0, "geo_flat: %s flattened into %zu IPv4 and %zu IPv6 ranges with %zu values", file, f->v4_ranges, f->v6_ranges, f->values);
+    return f;
+}
+
+/*
+ * Returns the value for the address or NULL if there is none
+ */
+const char* geo_flat_find(const geo_flat* f, const inX_addr* addr)
+{
+    size_t   base = 0, n, half;
+    uint32_t id;
+
+    if (addr->family == AF_INET6) {
+        const uint8_t* a = addr->in6.s6_addr;
+        uint64_t       hi = 0, lo = 0;
+        int            i;
+
+        if (!f->v6_ranges)
+            return NULL;
+        for (i = 0; i < 8; i++) {
+            hi = (hi << 8) | a[i];
+            lo = (lo << 8) | a[i + 8];
+        }
+        for (n = f->v6_ranges; n > 1; n -= half) {
+            half = n / 2;
+            base += half * ((f->v6_hi[base + half] < hi) | ((f->v6_hi[base + half] == hi) & (f->v6_lo[base + half] <= lo)));
+        }
+        id = f->v6_id[base];
+    } else {
+        uint32_t key = ntohl(addr->in4.s_addr);
+
+        if (!f->v4_ranges)
+            return NULL;
+        for (n = f->v4_ranges; n > 1; n -= half) {
+            half = n / 2;
+            base += half * (f->v4_start[base + half] <= key);
+        }
+        id = f->v4_id[base];
+    }
+
+    return id ? f->value[id - 1] : NULL;
+}
+
+/*
+ * A flattened database that is rebuilt when the file changes, the new
+ * tables are built in a thread and replace the old ones when
+ * geo_flat_check() finds the thread done
+ */
+struct geo_flat_db {
+    char*              file;
+    geo_flat_value_fn* value;
+    geo_flat*          flat;
+    struct stat        st;
+#if HAVE_PTHREAD
+    int             building;
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    int             built; // set by the thread when next is done
+    geo_flat*       next;
+    struct stat     next_st;
+#endif
+};
+
+static int geo_flat_changed(const struct stat* a, const struct stat* b)
+{
+    return a->st_ino != b->st_ino || a->st_size != b->st_size || a->st_mtime != b->st_mtime;
+}
+
+geo_flat_db* geo_flat_open(const char* file, geo_flat_value_fn* value, int* ret)
+{
+    geo_flat_db* db;
+
+    if (!(db = xcalloc(1, sizeof(*db))) || !(db->file = xstrdup(file))) {
+        xfree(db);
+        *ret = MMDB_OUT_OF_MEMORY_ERROR;
+        return NULL;
+    }
+    db->value = value;
+    if (stat(file, &db->st) || !(db->flat = geo_flat_build(file, value, ret))) {
+        if (!db->flat && *ret == MMDB_SUCCESS)
+            *ret = MMDB_FILE_OPEN_ERROR;
+        xfree(db->file);
+        xfree(db);
+        return NULL;
+    }
+#if HAVE_PTHREAD
+    pthread_mutex_init(&db->lock, NULL);
+#endif
+    *ret = MMDB_SUCCESS;
+    return db;
+}
+
+void geo_flat_close(geo_flat_db* db)
+{
+#if HAVE_PTHREAD
+    if (db->building) {
+        pthread_join(db->thread, NULL);
+        geo_flat_free(db->next);
+    }
+    pthread_mutex_destroy(&db->lock);
+#endif
+    geo_flat_free(db->flat);
+    xfree(db->file);
+    xfree(db);
+}
+
+const char* geo_flat_lookup(const geo_flat_db* db, const inX_addr* addr)
+{
+    return geo_flat_find(db->flat, addr);
+}
+
+static void geo_flat_replace(geo_flat_db* db, geo_flat* f, const struct stat* st)
+{
+    /* a failed build is not retried until the file changes again */
+    db->st = *st;
+    if (!f) {
+        dsyslogf(LOG_ERR, "geo_flat: Unable to reload %s, keeping the old data", db->file);
+        return;
+    }
+    geo_flat_free(db->flat);
+    db->flat = f;
+    dsyslogf(LOG_INFO, "geo_flat: Reloaded %s", db->file);
+}
+
+#if HAVE_PTHREAD
+static void* geo_flat_rebuild(void* arg)
+{
+    geo_flat_db* db = arg;
+    geo_flat*    f  = NULL;
+    struct stat  st;
+    int          ret;
+
+    memset(&st, 0, sizeof(st));
+    if (!stat(db->file, &st))
+        f = geo_flat_build(db->file, db->value, &ret);
+
+    pthread_mutex_lock(&db->lock);
+    db->next    = f;
+    db->next_st = st;
+    db->built   = 1;
+    pthread_mutex_unlock(&db->lock);
+    return NULL;
+}
+#endif
+
+/*
+ * Start rebuilding the tables if the file has changed and put the new
+ * tables in use once done, called between statistics intervals
+ */
+void geo_flat_check(geo_flat_db* db)
+{
+    struct stat st;
+
+    if (!db)
+        return;
+
+#if HAVE_PTHREAD
+    if (db->building) {
+        int built;
+
+        pthread_mutex_lock(&db->lock);
+        built = db->built;
+        pthread_mutex_unlock(&db->lock);
+        if (built) {
+            pthread_join(db->thread, NULL);
+            db->building = 0;
+            geo_flat_replace(db, db->next, &db->next_st);
+            db->next = NULL;
+        }
+        return;
+    }
+#endif
+
+    if (stat(db->file, &st) || !geo_flat_changed(&st, &db->st))
+        return;
+
+#if HAVE_PTHREAD
+    db->built = 0;
+    if (!pthread_create(&db->thread, NULL, geo_flat_rebuild, db)) {
+        dsyslogf(LOG_INFO, "geo_flat: %s changed, rebuilding", db->file);
+        db->building = 1;
+        return;
+    }
+#endif
+
+    {
+        int ret;
+        geo_flat_replace(db, geo_flat_build(db->file, db->value, &ret), &st);
+    }
+}
+
+#endif
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2008-2023, OARC, Inc.
+ * Copyright (c) 2007-2008, Internet Systems Consortium, Inc.
+ * Copyright (c) 2003-2007, The Measurement Factory, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __dsc_geo_flat_h
+#define __dsc_geo_flat_h
+
+#include "inX_addr.h"
+
+#include <stddef.h>
+#include <maxminddb.h>
+
+/* walking the search tree needs the record types of MMDB_read_node() */
+#ifdef MMDB_RECORD_TYPE_DATA
+#define HAVE_GEO_FLAT 1
+
+/*
+ * Returns the string to index a database entry as, using buf if needed,
+ * or NULL if the entry has no value
+ */
+typedef const char* geo_flat_value_fn(MMDB_entry_s* entry, char* buf, size_t len);
+
+typedef struct geo_flat    geo_flat;
+typedef struct geo_flat_db geo_flat_db;
+
+geo_flat*   geo_flat_build(const char* file, geo_flat_value_fn* value, int* ret);
+void        geo_flat_free(geo_flat* f);
+const char* geo_flat_find(const geo_flat* f, const inX_addr* addr);
+
+geo_flat_db* geo_flat_open(const char* file, geo_flat_value_fn* value, int* ret);
+void         geo_flat_close(geo_flat_db* db);
+const char*  geo_flat_lookup(const geo_flat_db* db, const inX_addr* addr);
+void         geo_flat_check(geo_flat_db* db);
+
+#endif
+
+#endif /* __dsc_geo_flat_h */
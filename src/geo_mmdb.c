@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2008-2023, OARC, Inc.
+ * Copyright (c) 2007-2008, Internet Systems Consortium, Inc.
+ * Copyright (c) 2003-2007, The Measurement Factory, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#if defined(HAVE_LIBMAXMINDDB) && defined(HAVE_MAXMINDDB_H)
+
+#include "geo_mmdb.h"
+#include "xmalloc.h"
+#include "syslog_debug.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+/*
+ * MaxMind databases shared by the indexers, a file configured for more
+ * than one indexer (such as a database with both country and ASN data) is
+ * only opened once and the result of the last lookup is kept so that the
+ * indexers looking up the same address for the same message share one
+ * search of the database.
+ */
+
+typedef struct geo_mmdb_file geo_mmdb_file;
+struct geo_mmdb_file {
+    char*          file;
+    struct stat    st;
+    int            refs;
+    MMDB_s         mmdb;
+    geo_mmdb_file* next;
+};
+
+static geo_mmdb_file* files = NULL;
+
+static const MMDB_s*        last_mmdb = NULL;
+static inX_addr             last_addr;
+static MMDB_lookup_result_s last_result;
+static int                  last_bits;
+
+/*
+ * Returns the opened database or NULL with ret set to the MMDB_open()
+ * error
+ */
+MMDB_s* geo_mmdb_open(const char* file, int* ret)
+{
+    geo_mmdb_file* f;
+    int            err;
+    struct stat    st;
+
+    /* a file replaced since it was opened, such as on a reload, is opened again */
+    memset(&st, 0, sizeof(st));
+    if (!stat(file, &st)) {
+        for (f = files; f; f = f->next) {
+            if (!strcmp(f->file, file) && f->st.st_ino == st.st_ino
+                && f->st.st_size == st.st_size && f->st.st_mtime == st.st_mtime) {
+                dfprintf(0, "geo_mmdb: sharing already opened %s", file);
+                f->refs++;
+                *ret = MMDB_SUCCESS;
+                return &f->mmdb;
+            }
+        }
+    }
+
+    if (!(f = xcalloc(1, sizeof(*f)))) {
+        *ret = MMDB_OUT_OF_MEMORY_ERROR;
+        return NULL;
+    }
+    if (!(f->file = xstrdup(file))) {
+        xfree(f);
+        *ret = MMDB_OUT_OF_MEMORY_ERROR;
+        return NULL;
+    }
+    if ((*ret = MMDB_open(file, 0, &f->mmdb)) != MMDB_SUCCESS) {
+        err = errno;
+        xfree(f->file);
+        xfree(f);
+        errno = err;
+        return NULL;
+    }
+    f->st     = st;
+    f->refs   = 1;
+    f->next   = files;
+    files     = f;
+    last_mmdb = NULL;
+    return &f->mmdb;
+}
+
+/*
+ * Close a database returned by geo_mmdb_open(), the file is closed once
+ * no indexer uses it
+ */
+void geo_mmdb_close(MMDB_s* mmdb)
+{
+    geo_mmdb_file** fp;
+
+    for (fp = &files; *fp; fp = &(*fp)->next) {
+        geo_mmdb_file* f = *fp;
+
+        if (&f->mmdb != mmdb)
+            continue;
+        if (--f->refs)
+            return;
+        *fp = f->next;
+        MMDB_close(&f->mmdb);
+        xfree(f->file);
+        xfree(f);
+        last_mmdb = NULL;
+        return;
+    }
+}
+
+/*
+ * Look up an address, bits is set to the length of the network that the
+ * result is valid for. Returns zero if the lookup failed.
+ */
+int geo_mmdb_lookup(MMDB_s* mmdb, const inX_addr* addr, MMDB_lookup_result_s* r, int* bits)
+{
+    int ret;
+
+    if (mmdb == last_mmdb && addr->family == last_addr.family && !inXaddr_cmp(addr, &last_addr)) {
+        *r    = last_result;
+        *bits = last_bits;
+        return 1;
+    }
+
+    if (addr->family == AF_INET6) {
+        struct sockaddr_in6 s;
+
+        memset(&s, 0, sizeof(s));
+        s.sin6_family = AF_INET6;
+        s.sin6_addr   = addr->in6;
+
+        *r = MMDB_lookup_sockaddr(mmdb, (struct sockaddr*)&s, &ret);
+        if (ret != MMDB_SUCCESS)
+            return 0;
+        *bits = r->netmask;
+    } else {
+        struct sockaddr_in s;
+
+        memset(&s, 0, sizeof(s));
+        s.sin_family = AF_INET;
+        s.sin_addr   = addr->in4;
+
+        *r = MMDB_lookup_sockaddr(mmdb, (struct sockaddr*)&s, &ret);
+        if (ret != MMDB_SUCCESS)
+            return 0;
+        /* IPv4 networks in an IPv6 database are below ::/96 */
+        if (mmdb->metadata.ip_version == 6)
+            *bits = r->netmask > 96 ? r->netmask - 96 : 0;
+        else
+            *bits = r->netmask;
+    }
+
+    last_mmdb   = mmdb;
+    last_addr   = *addr;
+    last_result = *r;
+    last_bits   = *bits;
+    return 1;
+}
+
+#endif
@@ -39,6 +39,101 @@
 #include "hashtbl.h"
 #include "xmalloc.h"
 
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+static uint64_t hash_key[2] = { 0, 0 };
+
+void hash_seed(void)
+{
+    FILE*          fp;
+    struct timeval tv;
+
+    if ((fp = fopen("/dev/urandom", "r"))) {
+        size_t n = fread(hash_key, sizeof(hash_key), 1, fp);
+        fclose(fp);
+        if (n == 1)
+            return;
+    }
+
+    /* not as good but still not known in advance */
+    gettimeofday(&tv, NULL);
+    hash_key[0] = ((uint64_t)tv.tv_sec << 32) ^ (uint64_t)tv.tv_usec ^ ((uint64_t)getpid() << 16);
+    hash_key[1] = (uint64_t)(uintptr_t)&tv ^ ((uint64_t)(uintptr_t)fp << 32) ^ ~hash_key[0];
+}
+
+#define SIP_ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+#define SIP_ROUND(v0, v1, v2, v3) \
+    {                             \
+        v0 += v1;                 \
+        v1 = SIP_ROTL(v1, 13);    \
+        v1 ^= v0;                 \
+        v0 = SIP_ROTL(v0, 32);    \
+        v2 += v3;                 \
+        v3 = SIP_ROTL(v3, 16);    \
+        v3 ^= v2;                 \
+        v0 += v3;                 \
+        v3 = SIP_ROTL(v3, 21);    \
+        v3 ^= v0;                 \
+        v2 += v1;                 \
+        v1 = SIP_ROTL(v1, 17);    \
+        v1 ^= v2;                 \
+        v2 = SIP_ROTL(v2, 32);    \
+    }
+
+/*
+ * SipHash-1-3, words are read in host byte order which does not matter as
+ * the values are never shared
+ */
+uint32_t hash_keyed(const void* key, size_t len)
+{
+    const unsigned char* p   = key;
+    const unsigned char* end = p + (len & ~(size_t)7);
+    uint64_t             v0  = 0x736f6d6570736575ULL ^ hash_key[0];
+    uint64_t             v1  = 0x646f72616e646f6dULL ^ hash_key[1];
+    uint64_t             v2  = 0x6c7967656e657261ULL ^ hash_key[0];
+    uint64_t             v3  = 0x7465646279746573ULL ^ hash_key[1];
+    uint64_t             b   = (uint64_t)len << 56;
+    uint64_t             m;
+
+    for (; p != end; p += 8) {
+        memcpy(&m, p, sizeof(m));
+        v3 ^= m;
+        SIP_ROUND(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+
+    switch (len & 7) {
+    case 7:
+        b |= (uint64_t)p[6] << 48; /* fall through */
+    case 6:
+        b |= (uint64_t)p[5] << 40; /* fall through */
+    case 5:
+        b |= (uint64_t)p[4] << 32; /* fall through */
+    case 4:
+        b |= (uint64_t)p[3] << 24; /* fall through */
+    case 3:
+        b |= (uint64_t)p[2] << 16; /* fall through */
+    case 2:
+        b |= (uint64_t)p[1] << 8; /* fall through */
+    case 1:
+        b |= (uint64_t)p[0];
+    }
+
+    v3 ^= b;
+    SIP_ROUND(v0, v1, v2, v3);
+    v0 ^= b;
+    v2 ^= 0xff;
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+
+    b = v0 ^ v1 ^ v2 ^ v3;
+    return (uint32_t)(b ^ (b >> 32));
+}
+
 hashtbl* hash_create(int N, hashfunc* hasher, hashkeycmp* cmp, int use_arena, hashfree* keyfree, hashfree* datafree)
 {
     hashtbl* new = (*(use_arena ? acalloc : xcalloc))(1, sizeof(*new));
@@ -75,11 +170,18 @@ void hash_destroy(hashtbl* tbl)
             i = next;
         }
     }
-    if (!tbl->use_arena)
+    if (!tbl->use_arena) {
+        xfree(tbl->items);
         xfree(tbl);
+    }
 }
 
 int hash_add(const void* key, void* data, hashtbl* tbl)
+{
+    return hash_add_hashed(key, tbl->hasher(key), data, tbl);
+}
+
+int hash_add_hashed(const void* key, unsigned int hv, void* data, hashtbl* tbl)
 {
     hashitem* new = (*(tbl->use_arena ? acalloc : xcalloc))(1, sizeof(*new));
     hashitem** I;
@@ -88,7 +190,7 @@ int hash_add(const void* key, void* data, hashtbl* tbl)
         return 1;
     new->key  = key;
     new->data = data;
-    slot      = tbl->hasher(key) % tbl->modulus;
+    slot      = hv % tbl->modulus;
     for (I = &tbl->items[slot]; *I; I = &(*I)->next)
         ;
     *I = new;
@@ -115,9 +217,39 @@ void hash_remove(const void* key, hashtbl* tbl)
     }
 }
 
+/*
+ * Remove all items for which match() returns non-zero
+ */
+void hash_remove_matching(hashtbl* tbl, hashmatch* match, void* ctx)
+{
+    hashitem **  I, *i;
+    unsigned int slot;
+    for (slot = 0; slot < tbl->modulus; slot++) {
+        for (I = &tbl->items[slot]; *I;) {
+            if (!match((*I)->data, ctx)) {
+                I = &(*I)->next;
+                continue;
+            }
+            i  = *I;
+            *I = i->next;
+            if (tbl->keyfree)
+                tbl->keyfree((void*)i->key);
+            if (tbl->datafree)
+                tbl->datafree(i->data);
+            if (!tbl->use_arena)
+                xfree(i);
+        }
+    }
+}
+
 void* hash_find(const void* key, hashtbl* tbl)
 {
-    int       slot = tbl->hasher(key) % tbl->modulus;
+    return hash_find_hashed(key, tbl->hasher(key), tbl);
+}
+
+void* hash_find_hashed(const void* key, unsigned int hv, hashtbl* tbl)
+{
+    int       slot = hv % tbl->modulus;
     hashitem* i;
     for (i = tbl->items[slot]; i; i = i->next) {
         if (0 == tbl->keycmp(key, i->key))
@@ -49,6 +49,7 @@ typedef struct _hashitem {
 typedef unsigned int hashfunc(const void* key);
 typedef int          hashkeycmp(const void* a, const void* b);
 typedef void         hashfree(void* p);
+typedef int          hashmatch(void* data, void* ctx);
 
 typedef struct
 {
@@ -70,10 +71,26 @@ hashtbl* hash_create(int N, hashfunc*, hashkeycmp*, int use_arena, hashfree*, ha
 void     hash_destroy(hashtbl*);
 int      hash_add(const void* key, void* data, hashtbl*);
 void     hash_remove(const void* key, hashtbl* tbl);
+void     hash_remove_matching(hashtbl* tbl, hashmatch*, void* ctx);
 void*    hash_find(const void* key, hashtbl*);
 void     hash_iter_init(hashtbl*);
 void*    hash_iterate(hashtbl*);
 
+/*
+ * Same as hash_add()/hash_find() but with the hash value of the key already
+ * computed by the caller, it must be what the table's hasher would return
+ */
+int   hash_add_hashed(const void* key, unsigned int hv, void* data, hashtbl*);
+void* hash_find_hashed(const void* key, unsigned int hv, hashtbl*);
+
+/*
+ * Keyed hash (SipHash-1-3) of len bytes at key, the key is chosen at random
+ * by hash_seed() which must be called before any table is filled. Values
+ * differ between processes and hosts so they must never be stored.
+ */
+void     hash_seed(void);
+uint32_t hash_keyed(const void* key, size_t len);
+
 /*
  * found in lookup3.c
  */
@@ -38,8 +38,6 @@
 
 #include "idn_qname_index.h"
 
-#include <string.h>
-
 #define QNAME_NORMAL 0
 #define QNAME_IDN 1
 
@@ -47,7 +45,7 @@ int idn_qname_indexer(const dns_message* m)
 {
     if (m->malformed)
         return -1;
-    if (0 == strncmp(m->qname, "xn--", 4))
+    if (dns_message_qname_class((dns_message*)m) & QNAME_CLASS_IDN)
         return QNAME_IDN;
     return QNAME_NORMAL;
 }
@@ -70,9 +70,9 @@ unsigned int
 inXaddr_hash(const inX_addr* a)
 {
     if (a->family == AF_INET6) {
-        return hashword(a->in6.s6_addr32, 4, 0);
+        return hash_keyed(&a->in6, sizeof(a->in6));
     }
-    return hashword(&a->in4.s_addr, 1, 0);
+    return hash_keyed(&a->in4, sizeof(a->in4));
 }
 
 int inXaddr_cmp(const inX_addr* a, const inX_addr* b)
@@ -39,10 +39,12 @@
 #include "ip_direction_index.h"
 #include "xmalloc.h"
 #include "inX_addr.h"
+#include "lpm.h"
 #include "syslog_debug.h"
 
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 
 #define LARGEST 2
 
@@ -52,6 +54,11 @@ struct _foo {
     struct _foo* next;
 };
 
+/*
+ * Local addresses with a prefix length mask are looked up in local_lpm,
+ * the few with any other kind of mask are kept in local_addrs
+ */
+static lpm*         local_lpm   = NULL;
 static struct _foo* local_addrs = NULL;
 
 #ifndef DROP_RECV_RESPONSE
@@ -61,8 +68,13 @@ static
     ip_is_local(const inX_addr* a)
 {
     struct _foo* t;
+    if (local_lpm && lpm_lookup(local_lpm, a))
+        return 1;
     for (t = local_addrs; t; t = t->next) {
-        inX_addr m = inXaddr_mask(a, &(t->mask));
+        inX_addr m;
+        if ((a->family == AF_INET6) != (t->addr.family == AF_INET6))
+            continue;
+        m = inXaddr_mask(a, &(t->mask));
         if (!inXaddr_cmp(&(t->addr), &m)) {
             return 1;
         }
@@ -70,6 +82,69 @@ static
     return 0;
 }
 
+/*
+ * Returns the prefix length of the mask or -1 if it is not contiguous
+ */
+static int mask_bits(const unsigned char* mask, int len)
+{
+    int i, bits = 0;
+    for (i = 0; i < len && mask[i] == 0xff; i++)
+        bits += 8;
+    if (i < len) {
+        unsigned char b = mask[i++];
+        while (b & 0x80) {
+            bits++;
+            b <<= 1;
+        }
+        if (b)
+            return -1;
+    }
+    for (; i < len; i++) {
+        if (mask[i])
+            return -1;
+    }
+    return bits;
+}
+
+static int add_local(struct _foo* n)
+{
+    const unsigned char *a, *m;
+    int                  i, len, bits;
+
+    if (n->addr.family == AF_INET6) {
+        a   = n->addr.in6.s6_addr;
+        m   = n->mask.in6.s6_addr;
+        len = 16;
+    } else {
+        a   = (const unsigned char*)&n->addr.in4.s_addr;
+        m   = (const unsigned char*)&n->mask.in4.s_addr;
+        len = 4;
+    }
+    if ((bits = mask_bits(m, len)) < 0) {
+        n->next     = local_addrs;
+        local_addrs = n;
+        return 1;
+    }
+    for (i = 0; i < len; i++) {
+        if (a[i] & ~m[i]) {
+            // address has bits set outside of the mask so it will never
+            // match anything
+            xfree(n);
+            return 1;
+        }
+    }
+    if (!local_lpm && !(local_lpm = lpm_create())) {
+        xfree(n);
+        return 0;
+    }
+    if (!lpm_add(local_lpm, &n->addr, bits, 1)) {
+        xfree(n);
+        return 0;
+    }
+    xfree(n);
+    return 1;
+}
+
 int ip_direction_indexer(const dns_message* m)
 {
     const transport_message* tm = m->tm;
@@ -147,9 +222,7 @@ int ip_local_address(const char* presentation, const char* mask)
             return 0;
         }
     }
-    n->next     = local_addrs;
-    local_addrs = n;
-    return 1;
+    return add_local(n);
 }
 
 int ip_direction_iterator(const char** label)
@@ -169,3 +242,42 @@ int ip_direction_iterator(const char** label)
         return -1;
     return next_iter++;
 }
+
+/*
+ * The local addresses in use are put aside while the configuration is
+ * reloaded, then either the old or the new ones are freed
+ */
+static lpm*         old_local_lpm   = NULL;
+static struct _foo* old_local_addrs = NULL;
+
+static void free_local(lpm* l, struct _foo* t)
+{
+    if (l)
+        lpm_free(l);
+    while (t) {
+        struct _foo* next = t->next;
+        xfree(t);
+        t = next;
+    }
+}
+
+void ip_local_reload_start(void)
+{
+    old_local_lpm   = local_lpm;
+    old_local_addrs = local_addrs;
+    local_lpm       = NULL;
+    local_addrs     = NULL;
+}
+
+void ip_local_reload_finish(int keep)
+{
+    if (keep) {
+        free_local(old_local_lpm, old_local_addrs);
+    } else {
+        free_local(local_lpm, local_addrs);
+        local_lpm   = old_local_lpm;
+        local_addrs = old_local_addrs;
+    }
+    old_local_lpm   = NULL;
+    old_local_addrs = NULL;
+}
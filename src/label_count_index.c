@@ -49,15 +49,7 @@ int label_count_indexer(const dns_message* m)
     if (m->malformed)
         return -1;
 
-    int i, count = 1;
-    int len = strlen(m->qname);
-    if (len == 0 || (len == 1 && m->qname[0] == '.')) {
-        count = 0;
-    } else {
-        for (i = 0; i < len; i++)
-            if (m->qname[i] == '.')
-                count++;
-    }
+    int count = m->label_count;
     if (count >= MAX_LABELS)
         count = MAX_LABELS - 1;
     if (count > largest)
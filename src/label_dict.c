@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2008-2023, OARC, Inc.
+ * Copyright (c) 2007-2008, Internet Systems Consortium, Inc.
+ * Copyright (c) 2003-2007, The Measurement Factory, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include "label_dict.h"
+#include "xmalloc.h"
+
+#define LABEL_DICT_HASH_SZ 65536
+
+extern int persistent_labels;
+
+unsigned int label_dict_interval = 0;
+
+/*
+ * Called once before the arrays are cleared after each interval
+ */
+void label_dict_next_interval(void)
+{
+    label_dict_interval++;
+}
+
+void* label_dict_alloc(label_dict* d, size_t size)
+{
+    return persistent_labels ? xcalloc(1, size) : acalloc(1, size);
+}
+
+char* label_dict_strdup(label_dict* d, const char* s)
+{
+    return persistent_labels ? xstrdup(s) : astrdup(s);
+}
+
+void label_dict_free(label_dict* d, void* p)
+{
+    if (persistent_labels)
+        xfree(p);
+    else
+        afree(p);
+}
+
+label_dict_entry* label_dict_find(label_dict* d, const void* key, unsigned int hv)
+{
+    label_dict_entry* e;
+
+    if (NULL == d->hash)
+        return NULL;
+    if ((e = hash_find_hashed(key, hv, d->hash)))
+        e->seen = label_dict_interval;
+    return e;
+}
+
+int label_dict_add(label_dict* d, const void* key, unsigned int hv, label_dict_entry* e)
+{
+    int reuse = d->free_len > 0;
+
+    if (NULL == d->hash) {
+        d->hash = hash_create(LABEL_DICT_HASH_SZ, d->hasher, d->keycmp, !persistent_labels, NULL, persistent_labels ? d->entryfree : NULL);
+        if (NULL == d->hash)
+            return -1;
+    }
+    e->index = reuse ? d->free_idx[d->free_len - 1] : d->next_idx;
+    e->seen  = label_dict_interval;
+    if (0 != hash_add_hashed(key, hv, e, d->hash))
+        return -1;
+    if (reuse)
+        d->free_len--;
+    else
+        d->next_idx++;
+    return e->index;
+}
+
+int label_dict_iter_init(label_dict* d)
+{
+    hash_iter_init(d->hash);
+    return d->next_idx;
+}
+
+label_dict_entry* label_dict_iterate(label_dict* d)
+{
+    label_dict_entry* e;
+
+    /* labels kept from earlier intervals have no cells in this one */
+    while ((e = hash_iterate(d->hash)) && e->seen != label_dict_interval)
+        ;
+    return e;
+}
+
+static int
+label_dict_stale(void* data, void* ctx)
+{
+    label_dict*       d = ctx;
+    label_dict_entry* e = data;
+
+    if (label_dict_interval - e->seen <= (unsigned int)persistent_labels)
+        return 0;
+    if (d->free_len == d->free_size) {
+        int  size = d->free_size ? d->free_size << 1 : 256;
+        int* idx  = xrealloc(d->free_idx, size * sizeof(*idx));
+        if (NULL == idx)
+            return 0; /* keep it, try again next interval */
+        d->free_idx  = idx;
+        d->free_size = size;
+    }
+    d->free_idx[d->free_len++] = e->index;
+    return 1;
+}
+
+/*
+ * Called for each array using the indexer when the arrays are cleared, the
+ * dictionary is compacted on the first call of the interval
+ */
+void label_dict_reset(label_dict* d)
+{
+    if (!persistent_labels) {
+        /* it was in the arena */
+        d->hash     = NULL;
+        d->next_idx = 0;
+        return;
+    }
+    if (NULL == d->hash || d->compacted == label_dict_interval)
+        return;
+    d->compacted = label_dict_interval;
+    hash_remove_matching(d->hash, label_dict_stale, d);
+}
+
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2008-2023, OARC, Inc.
+ * Copyright (c) 2007-2008, Internet Systems Consortium, Inc.
+ * Copyright (c) 2003-2007, The Measurement Factory, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __dsc_label_dict_h
+#define __dsc_label_dict_h
+
+#include "hashtbl.h"
+
+#include <stddef.h>
+
+/*
+ * Label dictionary of an indexer, maps the key of a label to the index of
+ * its cells in the arrays.
+ *
+ * By default the dictionary lives in the arena and is forgotten when the
+ * arrays are cleared after each interval. With persistent_labels set it is
+ * kept across intervals instead: a label keeps its index for as long as it
+ * is in use, labels not seen for persistent_labels intervals are removed
+ * and their indexes are reused.
+ *
+ * The objects stored must start with a label_dict_entry.
+ */
+
+typedef struct label_dict_entry label_dict_entry;
+struct label_dict_entry {
+    int          index;
+    unsigned int seen; /* interval the label was last indexed in */
+};
+
+typedef struct label_dict label_dict;
+struct label_dict {
+    hashtbl*     hash;
+    hashfunc*    hasher;
+    hashkeycmp*  keycmp;
+    hashfree*    entryfree; /* frees an object when persistent */
+    int          next_idx;
+    int*         free_idx;
+    int          free_len;
+    int          free_size;
+    unsigned int compacted; /* interval it was last compacted in */
+};
+
+#define LABEL_DICT_INIT(hasher, keycmp, entryfree) { NULL, hasher, keycmp, entryfree, 0, NULL, 0, 0, 0 }
+
+extern unsigned int label_dict_interval;
+
+void              label_dict_next_interval(void);
+void*             label_dict_alloc(label_dict* d, size_t size);
+char*             label_dict_strdup(label_dict* d, const char* s);
+void              label_dict_free(label_dict* d, void* p);
+label_dict_entry* label_dict_find(label_dict* d, const void* key, unsigned int hv);
+int               label_dict_add(label_dict* d, const void* key, unsigned int hv, label_dict_entry* e);
+int               label_dict_iter_init(label_dict* d);
+label_dict_entry* label_dict_iterate(label_dict* d);
+void              label_dict_reset(label_dict* d);
+
+#endif /* __dsc_label_dict_h */
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2008-2023, OARC, Inc.
+ * Copyright (c) 2007-2008, Internet Systems Consortium, Inc.
+ * Copyright (c) 2003-2007, The Measurement Factory, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include "lpm.h"
+#include "xmalloc.h"
+
+#include <string.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/*
+ * Longest prefix match of IPv4 and IPv6 addresses using a multibit trie
+ * per family with a first stride of 16 bits and then 8 bits, prefixes are
+ * expanded into the tables so a lookup is one memory access per stride
+ * and stops at the first entry that is not a child table.
+ *
+ * An IPv4 address is found with at most 3 accesses and an IPv6 address
+ * with at most 15, most end in the first table.
+ */
+
+#define LPM_CHILD 0x80000000
+#define LPM_ROOT_SIZE 65536
+#define LPM_NODE_SIZE 256
+
+typedef struct
+{
+    uint32_t* entry; // value, or LPM_CHILD and the offset of a child table
+    uint8_t*  len; // length of the prefix that set the value
+    size_t    size, used;
+} lpm_trie;
+
+struct lpm {
+    lpm_trie v4;
+    lpm_trie v6;
+};
+
+lpm* lpm_create(void)
+{
+    return xcalloc(1, sizeof(lpm));
+}
+
+void lpm_free(lpm* t)
+{
+    if (t) {
+        xfree(t->v4.entry);
+        xfree(t->v4.len);
+        xfree(t->v6.entry);
+        xfree(t->v6.len);
+        xfree(t);
+    }
+}
+
+/*
+ * Allocate a table with all entries set to the given value
+ */
+static int lpm_table(lpm_trie* t, size_t n, uint32_t value, uint8_t len, size_t* off)
+{
+    size_t i;
+
+    if (t->used + n > t->size) {
+        size_t    size = t->size ? t->size * 2 : LPM_ROOT_SIZE + 16 * LPM_NODE_SIZE;
+        uint32_t* entry;
+        uint8_t*  l;
+        while (size < t->used + n)
+            size *= 2;
+        if (!(entry = xrealloc(t->entry, size * sizeof(*entry))))
+            return 0;
+        t->entry = entry;
+        if (!(l = xrealloc(t->len, size * sizeof(*l))))
+            return 0;
+        t->len  = l;
+        t->size = size;
+    }
+    *off = t->used;
+    for (i = 0; i < n; i++) {
+        t->entry[*off + i] = value;
+        t->len[*off + i]   = len;
+    }
+    t->used += n;
+    return 1;
+}
+
+/*
+ * Set the value of an entry unless a longer prefix already did, entries
+ * that point to a child table get the value pushed into the child
+ */
+static void lpm_fill(lpm_trie* t, size_t pos, uint32_t value, uint8_t len)
+{
+    if (t->entry[pos] & LPM_CHILD) {
+        size_t off = t->entry[pos] & ~LPM_CHILD, i;
+        for (i = 0; i < LPM_NODE_SIZE; i++)
+            lpm_fill(t, off + i, value, len);
+        return;
+    }
+    if (t->len[pos] <= len) {
+        t->entry[pos] = value;
+        t->len[pos]   = len;
+    }
+}
+
+static int lpm_insert(lpm_trie* t, const uint8_t* key, int bits, uint32_t value)
+{
+    size_t pos, i, count, off;
+    int    depth = 16, byte = 2;
+
+    // the root table is always at offset 0
+    if (!t->used && !lpm_table(t, LPM_ROOT_SIZE, 0, 0, &off))
+        return 0;
+
+    pos = (key[0] << 8) | key[1];
+    if (bits <= 16) {
+        count = (size_t)1 << (16 - bits);
+        pos &= ~(count - 1);
+        for (i = 0; i < count; i++)
+            lpm_fill(t, pos + i, value, bits);
+        return 1;
+    }
+    for (;;) {
+        if (!(t->entry[pos] & LPM_CHILD)) {
+            if (!lpm_table(t, LPM_NODE_SIZE, t->entry[pos], t->len[pos], &off))
+                return 0;
+            t->entry[pos] = LPM_CHILD | off;
+        }
+        off = t->entry[pos] & ~LPM_CHILD;
+        pos = off + key[byte++];
+        depth += 8;
+        if (bits <= depth) {
+            count = (size_t)1 << (depth - bits);
+            pos &= ~(count - 1);
+            for (i = 0; i < count; i++)
+                lpm_fill(t, pos + i, value, bits);
+            return 1;
+        }
+    }
+}
+
+/*
+ * Add a prefix, the bits of the address after the prefix length are
+ * ignored and value must be non-zero and less than 2^31
+ */
+int lpm_add(lpm* t, const inX_addr* prefix, int bits, unsigned int value)
+{
+    if (!value || (value & LPM_CHILD))
+        return 0;
+    if (prefix->family == AF_INET6) {
+        if (bits < 0 || bits > 128)
+            return 0;
+        return lpm_insert(&t->v6, prefix->in6.s6_addr, bits, value);
+    }
+    if (bits < 0 || bits > 32)
+        return 0;
+    return lpm_insert(&t->v4, (const uint8_t*)&prefix->in4.s_addr, bits, value);
+}
+
+/*
+ * Returns the value of the longest prefix matching the address or 0 if
+ * none do
+ */
+unsigned int lpm_lookup(const lpm* t, const inX_addr* addr)
+{
+    const lpm_trie* trie;
+    const uint8_t*  key;
+    uint32_t        e;
+    int             i, n;
+
+    if (addr->family == AF_INET6) {
+        trie = &t->v6;
+        key  = addr->in6.s6_addr;
+        n    = 16;
+    } else {
+        trie = &t->v4;
+        key  = (const uint8_t*)&addr->in4.s_addr;
+        n    = 4;
+    }
+    if (!trie->used)
+        return 0;
+    e = trie->entry[(key[0] << 8) | key[1]];
+    for (i = 2; (e & LPM_CHILD) && i < n; i++)
+        e = trie->entry[(e & ~LPM_CHILD) + key[i]];
+    return e;
+}
@@ -55,17 +55,21 @@
 struct d2sort {
     char* label;
     int   val;
+    int   idx;
 };
 
 static int d2cmp(const void* a, const void* b)
 {
     /*
-     * descending sort order (larger to smaller)
+     * descending sort order (larger to smaller), equal counts in index
+     * order so the output does not depend on the order of hash tables
      */
-    return ((struct d2sort*)b)->val - ((struct d2sort*)a)->val;
+    if (((struct d2sort*)b)->val != ((struct d2sort*)a)->val)
+        return ((struct d2sort*)b)->val - ((struct d2sort*)a)->val;
+    return ((struct d2sort*)a)->idx - ((struct d2sort*)b)->idx;
 }
 
-static void md_array_free(md_array* a)
+void md_array_free(md_array* a)
 {
     if (a->name)
         xfree((char*)a->name);
@@ -80,75 +84,55 @@ static void md_array_free(md_array* a)
 static void md_array_grow(md_array* a, int i1, int i2)
 {
     int            new_d1_sz, new_d2_sz;
-    md_array_node* d1 = NULL;
-    int*           d2 = NULL;
+    md_array_node* d1;
+    int*           d2;
 
     if (i1 < a->d1.alloc_sz && i2 < a->array[i1].alloc_sz)
         return;
 
     /* dimension 1 */
-    new_d1_sz = a->d1.alloc_sz;
     if (i1 >= a->d1.alloc_sz) {
         /* pick a new size */
+        new_d1_sz = a->d1.alloc_sz;
         if (new_d1_sz == 0)
             new_d1_sz = 2;
         while (i1 >= new_d1_sz)
             new_d1_sz = new_d1_sz << 1;
 
-        /* allocate new array */
-        d1 = acalloc(new_d1_sz, sizeof(*d1));
-        if (NULL == d1) {
-            /* oops, undo! */
+        /* grow the array, in place if it was the last allocation */
+        d1 = arealloc(a->array, a->d1.alloc_sz * sizeof(*d1), new_d1_sz * sizeof(*d1));
+        if (NULL == d1)
             return;
-        }
-
-        /* copy old contents to new array */
-        memcpy(d1, a->array, a->d1.alloc_sz * sizeof(*d1));
+        memset(d1 + a->d1.alloc_sz, 0, (new_d1_sz - a->d1.alloc_sz) * sizeof(*d1));
 
-    } else {
-        d1 = a->array;
+        if (a->array)
+            dfprintf(0, "grew d1 of %s from %d to %d", a->name, a->d1.alloc_sz, new_d1_sz);
+        a->array       = d1;
+        a->d1.alloc_sz = new_d1_sz;
     }
 
     /* dimension 2 */
-    new_d2_sz = d1[i1].alloc_sz;
-    if (i2 >= d1[i1].alloc_sz) {
+    if (i2 >= a->array[i1].alloc_sz) {
         /* pick a new size */
+        new_d2_sz = a->array[i1].alloc_sz;
         if (new_d2_sz == 0)
             new_d2_sz = 2;
         while (i2 >= new_d2_sz)
             new_d2_sz = new_d2_sz << 1;
 
-        /* allocate new array */
-        d2 = acalloc(new_d2_sz, sizeof(*d2));
-        if (NULL == d2) {
-            /* oops, undo! */
-            afree(d1);
+        d2 = arealloc(a->array[i1].array, a->array[i1].alloc_sz * sizeof(*d2), new_d2_sz * sizeof(*d2));
+        if (NULL == d2)
             return;
-        }
-
-        /* copy old contents to new array */
-        memcpy(d2, d1[i1].array, d1[i1].alloc_sz * sizeof(*d2));
-    }
+        memset(d2 + a->array[i1].alloc_sz, 0, (new_d2_sz - a->array[i1].alloc_sz) * sizeof(*d2));
 
-    if (d1 != a->array) {
-        if (a->array) {
-            dfprintf(0, "grew d1 of %s from %d to %d", a->name, a->d1.alloc_sz, new_d1_sz);
-            afree(a->array);
-        }
-        a->array       = d1;
-        a->d1.alloc_sz = new_d1_sz;
-    }
-    if (d2) {
-        if (a->array[i1].array) {
+        if (a->array[i1].array)
             dfprintf(0, "grew d2[%d] of %s from %d to %d", i1, a->name, a->array[i1].alloc_sz, new_d2_sz);
-            afree(a->array[i1].array);
-        }
         a->array[i1].array    = d2;
         a->array[i1].alloc_sz = new_d2_sz;
-    }
 
-    if (new_d2_sz > a->d2.alloc_sz)
-        a->d2.alloc_sz = new_d2_sz;
+        if (new_d2_sz > a->d2.alloc_sz)
+            a->d2.alloc_sz = new_d2_sz;
+    }
 }
 
 /*
@@ -295,6 +279,7 @@ int md_array_print(md_array* a, md_array_printer* pr, FILE* fp)
                 continue;
             }
             sortme[si].val   = val;
+            sortme[si].idx   = i2;
             sortme[si].label = xstrdup(label2);
             if (NULL == sortme[si].label)
                 break;
@@ -320,6 +305,8 @@ int md_array_print(md_array* a, md_array_printer* pr, FILE* fp)
             pr->print_element(fp, "-:SKIPPED:-", skipped);
             pr->print_element(fp, "-:SKIPPED_SUM:-", skipped_sum);
         }
+        if (a->d2.indexer->summary_fn)
+            a->d2.indexer->summary_fn(a->array[i1].array, a->array[i1].alloc_sz, pr, fp);
         pr->d1_end(fp, label1);
     }
     pr->finish_data(fp);
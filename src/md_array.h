@@ -65,6 +65,8 @@ struct indexer {
     int (*iter_fn)(const char**);
     void (*reset_fn)(void);
     const dns_message* (*flush_fn)(enum flush_mode);
+    /* optional, print extra elements for a row of counts indexed by this indexer */
+    void (*summary_fn)(const int* counts, int n, md_array_printer* pr, void* fp);
 };
 
 struct filter_defn {
@@ -125,6 +127,7 @@ struct md_array_list {
 
 md_array*     md_array_create(const char* name, filter_list*, const char*, indexer*, const char*, indexer*);
 void          md_array_clear(md_array*);
+void          md_array_free(md_array*);
 int           md_array_count(md_array*, const void*);
 void          md_array_flush(md_array* a);
 int           md_array_print(md_array* a, md_array_printer* pr, FILE* fp);
@@ -43,6 +43,7 @@
 #include "dns_message.h"
 #include "compat.h"
 #include "client_subnet_index.h"
+#include "syslog_debug.h"
 #if defined(HAVE_LIBGEOIP) && defined(HAVE_GEOIP_H)
 #define HAVE_GEOIP 1
 #include <GeoIP.h>
@@ -410,6 +411,32 @@ int parse_conf_qname_filter(const conf_token_t* tokens)
     return ret == 1 ? 0 : 1;
 }
 
+int parse_conf_filter(const conf_token_t* tokens)
+{
+    char*  name = strndup(tokens[1].token, tokens[1].length);
+    char*  expr;
+    size_t i, len = 1;
+    int    ret;
+
+    for (i = 2; i < PARSE_MAX_ARGS && tokens[i].token; i++)
+        len += tokens[i].length + 1;
+    if (!name || !(expr = calloc(1, len))) {
+        free(name);
+        errno = ENOMEM;
+        return -1;
+    }
+    for (i = 2; i < PARSE_MAX_ARGS && tokens[i].token; i++) {
+        if (i > 2)
+            strcat(expr, " ");
+        strncat(expr, tokens[i].token, tokens[i].length);
+    }
+
+    ret = add_expr_filter(name, expr);
+    free(name);
+    free(expr);
+    return ret == 1 ? 0 : 1;
+}
+
 int parse_conf_dump_reports_on_exit(const conf_token_t* tokens)
 {
     set_dump_reports_on_exit();
@@ -619,6 +646,17 @@ int parse_conf_maxminddb_country(const conf_token_t* tokens)
 #endif
 }
 
+int parse_conf_maxminddb_flatten(const conf_token_t* tokens)
+{
+#if defined(HAVE_MAXMINDDB) && defined(MMDB_RECORD_TYPE_DATA)
+    set_maxminddb_flatten();
+    return 0;
+#else
+    fprintf(stderr, "MaxMind DB flattening support not built in!\n");
+    return 1;
+#endif
+}
+
 int parse_conf_pcap_buffer_size(const conf_token_t* tokens)
 {
     char* pcap_buffer_size = strndup(tokens[1].token, tokens[1].length);
@@ -796,6 +834,27 @@ int parse_conf_response_time_bucket_size(const conf_token_t* tokens)
     return ret == 1 ? 0 : 1;
 }
 
+int parse_conf_response_time_significant_digits(const conf_token_t* tokens)
+{
+    char* s = strndup(tokens[1].token, tokens[1].length);
+    int   ret;
+
+    if (!s) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    ret = set_response_time_significant_digits(s);
+    free(s);
+    return ret == 1 ? 0 : 1;
+}
+
+int parse_conf_response_time_percentiles(const conf_token_t* tokens)
+{
+    set_response_time_percentiles();
+    return 0;
+}
+
 int parse_conf_dnstap_file(const conf_token_t* tokens)
 {
     char* file = strndup(tokens[1].token, tokens[1].length);
@@ -922,33 +981,63 @@ int parse_conf_dnstap_network(const conf_token_t* tokens)
     return dnstap_network_port < 0 ? 1 : 0;
 }
 
+int parse_conf_dnstap_threads(const conf_token_t* tokens)
+{
+    extern int dnstap_threads;
+    char*      threads = strndup(tokens[1].token, tokens[1].length);
+
+    if (!threads) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    dnstap_threads = atoi(threads);
+    free(threads);
+
+    return dnstap_threads < 0 ? 1 : 0;
+}
+
 int parse_conf_knowntlds_file(const conf_token_t* tokens)
 {
-    char* file = strndup(tokens[1].token, tokens[1].length);
+    char* file     = strndup(tokens[1].token, tokens[1].length);
+    char* snapshot = 0;
     int   ret;
 
     if (!file) {
         errno = ENOMEM;
         return -1;
     }
+    if (tokens[2].type != TOKEN_END && !(snapshot = strndup(tokens[2].token, tokens[2].length))) {
+        free(file);
+        errno = ENOMEM;
+        return -1;
+    }
 
-    ret = load_knowntlds(file);
+    ret = load_knowntlds(file, snapshot);
     free(file);
+    free(snapshot);
     return ret == 1 ? 0 : 1;
 }
 
 int parse_conf_tld_list(const conf_token_t* tokens)
 {
-    char* file = strndup(tokens[1].token, tokens[1].length);
+    char* file     = strndup(tokens[1].token, tokens[1].length);
+    char* snapshot = 0;
     int   ret;
 
     if (!file) {
         errno = ENOMEM;
         return -1;
     }
+    if (tokens[2].type != TOKEN_END && !(snapshot = strndup(tokens[2].token, tokens[2].length))) {
+        free(file);
+        errno = ENOMEM;
+        return -1;
+    }
 
-    ret = load_tld_list(file);
+    ret = load_tld_list(file, snapshot);
     free(file);
+    free(snapshot);
     return ret == 1 ? 0 : 1;
 }
 
@@ -997,6 +1086,51 @@ int parse_conf_output_mod(const conf_token_t* tokens)
     return ret == 1 ? 0 : 1;
 }
 
+int parse_conf_checkpoint_file(const conf_token_t* tokens)
+{
+    char* file = strndup(tokens[1].token, tokens[1].length);
+    int   ret;
+
+    if (!file) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    ret = set_checkpoint_file(file);
+    free(file);
+    return ret == 1 ? 0 : 1;
+}
+
+int parse_conf_checkpoint_interval(const conf_token_t* tokens)
+{
+    char* interval = strndup(tokens[1].token, tokens[1].length);
+    int   ret;
+
+    if (!interval) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    ret = set_checkpoint_interval(interval);
+    free(interval);
+    return ret == 1 ? 0 : 1;
+}
+
+int parse_conf_persistent_labels(const conf_token_t* tokens)
+{
+    char* intervals = strndup(tokens[1].token, tokens[1].length);
+    int   ret;
+
+    if (!intervals) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    ret = set_persistent_labels(intervals);
+    free(intervals);
+    return ret == 1 ? 0 : 1;
+}
+
 static conf_token_syntax_t _syntax[] = {
     { "interface",
         parse_conf_interface,
@@ -1034,6 +1168,9 @@ static conf_token_syntax_t _syntax[] = {
     { "qname_filter",
         parse_conf_qname_filter,
         { TOKEN_STRING, TOKEN_STRING, TOKEN_END } },
+    { "filter",
+        parse_conf_filter,
+        { TOKEN_STRING, TOKEN_ANY, TOKEN_END } },
     { "dump_reports_on_exit",
         parse_conf_dump_reports_on_exit,
         { TOKEN_END } },
@@ -1079,6 +1216,9 @@ static conf_token_syntax_t _syntax[] = {
     { "maxminddb_country",
         parse_conf_maxminddb_country,
         { TOKEN_STRING, TOKEN_END } },
+    { "maxminddb_flatten",
+        parse_conf_maxminddb_flatten,
+        { TOKEN_END } },
     { "dns_port",
         parse_conf_dns_port,
         { TOKEN_NUMBER, TOKEN_END } },
@@ -1100,6 +1240,12 @@ static conf_token_syntax_t _syntax[] = {
     { "response_time_bucket_size",
         parse_conf_response_time_bucket_size,
         { TOKEN_NUMBER, TOKEN_END } },
+    { "response_time_significant_digits",
+        parse_conf_response_time_significant_digits,
+        { TOKEN_NUMBER, TOKEN_END } },
+    { "response_time_percentiles",
+        parse_conf_response_time_percentiles,
+        { TOKEN_END } },
     { "dnstap_file",
         parse_conf_dnstap_file,
         { TOKEN_STRING, TOKEN_END } },
@@ -1115,12 +1261,15 @@ static conf_token_syntax_t _syntax[] = {
     { "dnstap_network",
         parse_conf_dnstap_network,
         { TOKEN_STRING, TOKEN_STRING, TOKEN_NUMBER, TOKEN_END } },
+    { "dnstap_threads",
+        parse_conf_dnstap_threads,
+        { TOKEN_NUMBER, TOKEN_END } },
     { "knowntlds_file",
         parse_conf_knowntlds_file,
-        { TOKEN_STRING, TOKEN_END } },
+        { TOKEN_STRING, TOKEN_STRING, TOKEN_END } },
     { "tld_list",
         parse_conf_tld_list,
-        { TOKEN_STRING, TOKEN_END } },
+        { TOKEN_STRING, TOKEN_STRING, TOKEN_END } },
     { "output_user",
         parse_conf_output_user,
         { TOKEN_STRING, TOKEN_END } },
@@ -1130,10 +1279,107 @@ static conf_token_syntax_t _syntax[] = {
     { "output_mod",
         parse_conf_output_mod,
         { TOKEN_NUMBER, TOKEN_END } },
+    { "checkpoint_file",
+        parse_conf_checkpoint_file,
+        { TOKEN_STRING, TOKEN_END } },
+    { "checkpoint_interval",
+        parse_conf_checkpoint_interval,
+        { TOKEN_NUMBER, TOKEN_END } },
+    { "persistent_labels",
+        parse_conf_persistent_labels,
+        { TOKEN_NUMBER, TOKEN_END } },
 
     { 0, 0, { TOKEN_END } }
 };
 
+/*
+ * Options changed when the configuration is reloaded, all others keep
+ * the value they got at start
+ */
+static const char* _reloadable[] = {
+    "dataset",
+    "qname_filter",
+    "filter",
+    "local_address",
+    "geoip_v4_dat",
+    "geoip_v6_dat",
+    "geoip_asn_v4_dat",
+    "geoip_asn_v6_dat",
+    "maxminddb_asn",
+    "maxminddb_country",
+    0
+};
+
+static int _reloading = 0;
+
+static int parse_conf_reloadable(const char* token)
+{
+    const char** r;
+
+    for (r = _reloadable; *r; r++) {
+        if (!strcmp(token, *r))
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * The other options as they were at start, so a reload can tell which of
+ * them changed and say that they are not applied
+ */
+static char** _fixed       = 0;
+static size_t _fixed_count = 0, _fixed_size = 0;
+
+static char* parse_conf_line(const conf_token_t* tokens, size_t token_size)
+{
+    size_t i, len = 0;
+    char * line, *p;
+
+    for (i = 0; i < token_size; i++)
+        len += tokens[i].length + 1;
+    if (!(line = malloc(len)))
+        return 0;
+    for (p = line, i = 0; i < token_size; i++) {
+        memcpy(p, tokens[i].token, tokens[i].length);
+        p += tokens[i].length;
+        *p++ = i + 1 < token_size ? ' ' : 0;
+    }
+    return line;
+}
+
+static void parse_conf_fixed_add(const conf_token_t* tokens, size_t token_size)
+{
+    char* line;
+
+    if (_fixed_count == _fixed_size) {
+        size_t size  = _fixed_size ? _fixed_size * 2 : 32;
+        char** fixed = realloc(_fixed, size * sizeof(*_fixed));
+        if (!fixed)
+            return;
+        _fixed      = fixed;
+        _fixed_size = size;
+    }
+    if ((line = parse_conf_line(tokens, token_size)))
+        _fixed[_fixed_count++] = line;
+}
+
+static int parse_conf_fixed_changed(const conf_token_t* tokens, size_t token_size)
+{
+    char*  line = parse_conf_line(tokens, token_size);
+    size_t i;
+
+    if (!line)
+        return 0;
+    for (i = 0; i < _fixed_count; i++) {
+        if (!strcmp(_fixed[i], line)) {
+            free(line);
+            return 0;
+        }
+    }
+    free(line);
+    return 1;
+}
+
 int parse_conf_tokens(const conf_token_t* tokens, size_t token_size, size_t line)
 {
     const conf_token_syntax_t* syntax;
@@ -1161,6 +1407,16 @@ int parse_conf_tokens(const conf_token_t* tokens, size_t token_size, size_t line
         fprintf(stderr, "\n");
         return 1;
     }
+    if (!parse_conf_reloadable(syntax->token)) {
+        if (!_reloading) {
+            parse_conf_fixed_add(tokens, token_size);
+        } else {
+            if (parse_conf_fixed_changed(tokens, token_size)) {
+                dsyslogf(LOG_WARNING, "CONFIG WARNING [line:%zu]: %s can not be changed by a reload, keeping the current value until a restart", line, syntax->token);
+            }
+            return 0;
+        }
+    }
 
     for (type = syntax->syntax, i = 1; *type != TOKEN_END && i < token_size; i++) {
         if (*type == TOKEN_STRINGS) {
@@ -1318,3 +1574,14 @@ int parse_conf(const char* file)
 
     return 0;
 }
+
+int parse_conf_reload(const char* file)
+{
+    int ret;
+
+    _reloading = 1;
+    ret        = parse_conf(file);
+    _reloading = 0;
+
+    return ret;
+}
@@ -36,5 +36,6 @@
 #define __dsc_parse_conf_h
 
 int parse_conf(const char* file);
+int parse_conf_reload(const char* file);
 
 #endif /* __dsc_parse_conf_h */
@@ -51,6 +51,8 @@
 #include <assert.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <time.h>
 
 #define PCAP_SNAPLEN 65536
 #ifndef ETHER_HDR_LEN
@@ -255,10 +257,7 @@ inline static void tcpkey_set(tcpHashkey_t* key, inX_addr src, uint16_t sport, i
 static unsigned int
 tcp_hashfunc(const void* key)
 {
-    if (!(sizeof(tcpHashkey_t) % 4)) {
-        return hashword(key, sizeof(tcpHashkey_t) / 4, 0);
-    }
-    return hashendian(key, sizeof(tcpHashkey_t), 0);
+    return hash_keyed(key, sizeof(tcpHashkey_t));
 }
 
 static int
@@ -530,7 +529,7 @@ tcpList_remove(tcpstate_t* tcpstate)
     *(tcpstate->newer ? &tcpstate->newer->older : &tcpList.newest) = tcpstate->older;
 }
 
-static void
+static int
 tcpList_remove_older_than(long t)
 {
     int         n = 0;
@@ -542,6 +541,180 @@ tcpList_remove_older_than(long t)
         n++;
     }
     dfprintf(1, "discarded %d old tcpstates", n);
+    return n;
+}
+
+/*
+ * Checkpoint of the TCP reassembly, each tcpstate oldest first followed by
+ * its buffers, each with the slot it was in
+ */
+
+typedef struct
+{
+    tcpHashkey_t key;
+    int64_t      last_use;
+    uint32_t     seq_start;
+    int16_t      msgbufs;
+    u_char       dnslen_buf[2];
+    u_char       dnslen_bytes_seen_mask;
+    int8_t       fin;
+    uint8_t      n_msgbuf, n_segbuf; // buffers that follow
+} tcp_checkpoint_t;
+
+void pcap_checkpoint(checkpoint* c)
+{
+    tcpstate_t*      t;
+    tcp_checkpoint_t r;
+    uint8_t          i;
+
+    for (t = tcpList.oldest; t; t = t->newer) {
+        memset(&r, 0, sizeof(r));
+        r.key                    = t->key;
+        r.last_use               = t->last_use;
+        r.seq_start              = t->seq_start;
+        r.msgbufs                = t->msgbufs;
+        r.dnslen_buf[0]          = t->dnslen_buf[0];
+        r.dnslen_buf[1]          = t->dnslen_buf[1];
+        r.dnslen_bytes_seen_mask = t->dnslen_bytes_seen_mask;
+        r.fin                    = t->fin;
+        for (i = 0; i < MAX_TCP_MSGS; i++)
+            r.n_msgbuf += t->msgbuf[i] != NULL;
+        for (i = 0; i < MAX_TCP_SEGS; i++)
+            r.n_segbuf += t->segbuf[i] != NULL;
+        checkpoint_write(c, &r, sizeof(r));
+
+        for (i = 0; i < MAX_TCP_MSGS; i++) {
+            if (t->msgbuf[i]) {
+                checkpoint_write(c, &i, sizeof(i));
+                checkpoint_write(c, t->msgbuf[i], sizeof(tcp_msgbuf_t) + t->msgbuf[i]->dnslen);
+            }
+        }
+        for (i = 0; i < MAX_TCP_SEGS; i++) {
+            if (t->segbuf[i]) {
+                checkpoint_write(c, &i, sizeof(i));
+                checkpoint_write(c, t->segbuf[i], sizeof(tcp_segbuf_t) + t->segbuf[i]->len);
+            }
+        }
+    }
+}
+
+/*
+ * Walk a checkpoint of TCP reassembly without restoring anything, returns
+ * 1 if every state and buffer in it is complete and in range
+ */
+int pcap_verify(const void* data, size_t size)
+{
+    const u_char*    p   = data;
+    const u_char*    end = p + size;
+    tcp_checkpoint_t r;
+    tcp_msgbuf_t     mb;
+    tcp_segbuf_t     sb;
+    uint8_t          i, slot, msgs, segs;
+
+    while (end - p >= (ptrdiff_t)sizeof(r)) {
+        memcpy(&r, p, sizeof(r));
+        p += sizeof(r);
+        if (r.n_msgbuf > MAX_TCP_MSGS || r.n_segbuf > MAX_TCP_SEGS)
+            return 0;
+        msgs = segs = 0; // slots seen, as bits
+        for (i = 0; i < r.n_msgbuf + r.n_segbuf; i++) {
+            const int msg  = i < r.n_msgbuf;
+            size_t    hlen = msg ? sizeof(mb) : sizeof(sb), len;
+
+            if (end - p < (ptrdiff_t)(1 + hlen))
+                return 0;
+            slot = *p++;
+            memcpy(msg ? (void*)&mb : (void*)&sb, p, hlen);
+            len = hlen + (msg ? mb.dnslen : sb.len);
+            if (slot >= (msg ? MAX_TCP_MSGS : MAX_TCP_SEGS) || end - p < (ptrdiff_t)len
+                || ((msg ? msgs : segs) & (1 << slot)))
+                return 0;
+            if (msg)
+                msgs |= 1 << slot;
+            else
+                segs |= 1 << slot;
+            p += len;
+        }
+    }
+    return p == end;
+}
+
+void pcap_restore(const void* data, size_t size)
+{
+    const u_char*    p   = data;
+    const u_char*    end = p + size;
+    tcp_checkpoint_t r;
+    tcpstate_t*      t;
+    tcp_msgbuf_t     mb;
+    tcp_segbuf_t     sb;
+    uint8_t          i, slot;
+    size_t           restored = 0;
+
+    if (!size)
+        return;
+    if (NULL == tcpHash && NULL == (tcpHash = hash_create(MAX_TCP_STATE, tcp_hashfunc, tcp_cmpfunc, 0, NULL, tcpstate_free)))
+        return;
+
+    while (end - p >= (ptrdiff_t)sizeof(r)) {
+        memcpy(&r, p, sizeof(r));
+        p += sizeof(r);
+        if (!(t = xcalloc(1, sizeof(*t))))
+            break;
+        t->key                    = r.key;
+        t->last_use               = r.last_use;
+        t->seq_start              = r.seq_start;
+        t->msgbufs                = r.msgbufs;
+        t->dnslen_buf[0]          = r.dnslen_buf[0];
+        t->dnslen_buf[1]          = r.dnslen_buf[1];
+        t->dnslen_bytes_seen_mask = r.dnslen_bytes_seen_mask;
+        t->fin                    = r.fin;
+
+        for (i = 0; i < r.n_msgbuf + r.n_segbuf; i++) {
+            const int msg = i < r.n_msgbuf;
+            size_t    hlen = msg ? sizeof(mb) : sizeof(sb), len;
+            void*     buf;
+
+            if (end - p < (ptrdiff_t)(1 + hlen))
+                goto invalid;
+            slot = *p++;
+            memcpy(msg ? (void*)&mb : (void*)&sb, p, hlen);
+            len = hlen + (msg ? mb.dnslen : sb.len);
+            if (slot >= (msg ? MAX_TCP_MSGS : MAX_TCP_SEGS) || end - p < (ptrdiff_t)len
+                || (msg ? (void*)t->msgbuf[slot] : (void*)t->segbuf[slot]))
+                goto invalid;
+            if (!(buf = xmalloc(len)))
+                goto invalid;
+            memcpy(buf, p, len);
+            p += len;
+            if (msg)
+                t->msgbuf[slot] = buf;
+            else
+                t->segbuf[slot] = buf;
+        }
+
+        if (hash_find(&t->key, tcpHash) || hash_add(&t->key, t, tcpHash)) {
+            tcpstate_free(t);
+            continue;
+        }
+        tcpList_add_newest(t);
+        restored++;
+    }
+    if (p != end) {
+        dsyslog(LOG_ERR, "pcap: checkpoint of TCP reassembly is truncated");
+    }
+    /*
+     * last_use is the time of the packets, which for a pcap file is not the
+     * current time, so states are only dropped if idle for long before the
+     * newest one saved, the others when idle by the time of the next packets
+     */
+    if (tcpList.newest)
+        restored -= tcpList_remove_older_than(tcpList.newest->last_use - MAX_TCP_IDLE);
+    dsyslogf(LOG_INFO, "pcap: restored %zu TCP reassembly states", restored);
+    return;
+
+invalid:
+    tcpstate_free(t);
+    dsyslogf(LOG_ERR, "pcap: checkpoint of TCP reassembly is invalid, restored %zu states", restored);
 }
 
 /*
@@ -38,6 +38,7 @@
 #define __dsc_pcap_h
 
 #include "md_array.h"
+#include "checkpoint.h"
 
 #include <stdio.h>
 
@@ -51,5 +52,8 @@ void Pcap_close(void);
 int  Pcap_start_time(void);
 int  Pcap_finish_time(void);
 void pcap_report(FILE*, md_array_printer*);
+void pcap_checkpoint(checkpoint* c);
+int  pcap_verify(const void* data, size_t size);
+void pcap_restore(const void* data, size_t size);
 
 #endif /* __dsc_pcap_h */
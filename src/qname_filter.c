@@ -0,0 +1,698 @@
+/*
+ * Copyright (c) 2008-2023, OARC, Inc.
+ * Copyright (c) 2007-2008, Internet Systems Consortium, Inc.
+ * Copyright (c) 2003-2007, The Measurement Factory, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include "qname_filter.h"
+#include "xmalloc.h"
+#include "syslog_debug.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+/*
+ * All qname filters are compiled into one NFA and matched together with a
+ * lazily built DFA, so one pass over the qname gives the result of every
+ * filter as a bitmask.
+ *
+ * Only a subset of POSIX extended regular expressions is supported:
+ * literals, escaped punctuation, ".", bracket expressions with ranges,
+ * "^", "$", grouping, alternation and the "*", "+", "?" and "{m,n}"
+ * repetitions. qname_filter_add() returns -1 for anything else so that the
+ * caller can fall back to regexec().
+ *
+ * Matching is case insensitive, same as REG_ICASE, and the DSC does not
+ * set a locale so everything is bytes.
+ */
+
+#define MAX_REPEAT 32
+#define MAX_DFA_STATES 1024
+#define DFA_HASH_SIZE 2048
+
+#define cls_set(c, b) ((c)[(unsigned char)(b) >> 3] |= 1 << ((unsigned char)(b)&7))
+#define cls_isset(c, b) ((c)[(unsigned char)(b) >> 3] & (1 << ((unsigned char)(b)&7)))
+
+enum re_type {
+    RE_CHAR,
+    RE_CAT,
+    RE_ALT,
+    RE_STAR,
+    RE_PLUS,
+    RE_QUEST,
+    RE_REPEAT,
+    RE_BOL,
+    RE_EOL,
+    RE_EMPTY
+};
+
+typedef struct re_node re_node;
+struct re_node {
+    enum re_type  type;
+    re_node*      left;
+    re_node*      right;
+    int           min, max; // for RE_REPEAT, max is -1 for no upper bound
+    unsigned char cls[32]; // for RE_CHAR
+};
+
+typedef struct
+{
+    const char* p;
+    int         bad;
+} re_parser;
+
+enum nfa_type {
+    NFA_CHAR,
+    NFA_SPLIT,
+    NFA_BOL,
+    NFA_EOL,
+    NFA_MATCH
+};
+
+typedef struct
+{
+    enum nfa_type type;
+    int           out, out1;
+    unsigned int  match; // filter bit for NFA_MATCH
+    unsigned char cls[32]; // for NFA_CHAR
+} nfa_node;
+
+typedef struct
+{
+    int*         set; // NFA nodes, sorted
+    int          n;
+    unsigned int hv;
+    int          hnext; // next state in the same hash bucket
+    unsigned int accept; // filters matched when in this state
+    unsigned int accept_eol; // filters matched if the qname ends here
+    int          next[256];
+} dfa_state;
+
+static nfa_node*    nfa       = 0;
+static int          nfa_size  = 0;
+static int          nfa_nodes = 0;
+static int          starts[QNAME_FILTER_MAX];
+static int          filters = 0;
+static unsigned int mark_gen = 0;
+static unsigned int* mark    = 0;
+static int*         work     = 0;
+static int          work_n   = 0;
+
+static dfa_state* dfa[MAX_DFA_STATES];
+static int        dfa_states = 0;
+static int        dfa_hash[DFA_HASH_SIZE];
+
+/*
+ * Parser, builds the parse tree of one pattern
+ */
+
+static re_node* re_new(re_parser* p, enum re_type type, re_node* left, re_node* right)
+{
+    re_node* r = xcalloc(1, sizeof(*r));
+    if (!r) {
+        p->bad = 1;
+        return 0;
+    }
+    r->type  = type;
+    r->left  = left;
+    r->right = right;
+    return r;
+}
+
+static void re_free(re_node* r)
+{
+    if (r) {
+        re_free(r->left);
+        re_free(r->right);
+        xfree(r);
+    }
+}
+
+static void re_fold(unsigned char* cls)
+{
+    int c;
+    for (c = 'a'; c <= 'z'; c++) {
+        if (cls_isset(cls, c) || cls_isset(cls, toupper(c))) {
+            cls_set(cls, c);
+            cls_set(cls, toupper(c));
+        }
+    }
+}
+
+static re_node* re_bracket(re_parser* p)
+{
+    re_node* r;
+    int      neg = 0, first = 1, i;
+
+    if (!(r = re_new(p, RE_CHAR, 0, 0)))
+        return 0;
+    if ('^' == *p->p) {
+        neg = 1;
+        p->p++;
+    }
+    while (*p->p && (first || ']' != *p->p)) {
+        unsigned char c = *p->p;
+        first           = 0;
+        if ('[' == c && (':' == p->p[1] || '.' == p->p[1] || '=' == p->p[1])) {
+            // character classes, collating symbols and equivalence classes
+            p->bad = 1;
+            return r;
+        }
+        if ('-' == p->p[1] && p->p[2] && ']' != p->p[2]) {
+            unsigned char e = p->p[2];
+            if (c > e) {
+                p->bad = 1;
+                return r;
+            }
+            if (!(islower(c) && islower(e)) && !(isupper(c) && isupper(e))
+                && ((c <= 'Z' && e >= 'A') || (c <= 'z' && e >= 'a'))) {
+                // ranges with letters only when in the same case
+                p->bad = 1;
+                return r;
+            }
+            for (i = c; i <= e; i++)
+                cls_set(r->cls, i);
+            p->p += 3;
+        } else {
+            cls_set(r->cls, c);
+            p->p++;
+        }
+    }
+    if (']' != *p->p) {
+        p->bad = 1;
+        return r;
+    }
+    p->p++;
+    re_fold(r->cls);
+    if (neg) {
+        for (i = 0; i < 32; i++)
+            r->cls[i] = ~r->cls[i];
+    }
+    r->cls[0] &= ~1;
+    return r;
+}
+
+static re_node* re_alt(re_parser* p);
+
+static re_node* re_atom(re_parser* p)
+{
+    re_node* r;
+    int      i;
+
+    switch (*p->p) {
+    case '(':
+        p->p++;
+        r = re_alt(p);
+        if (')' != *p->p) {
+            p->bad = 1;
+            return r;
+        }
+        p->p++;
+        return r;
+    case '^':
+        p->p++;
+        return re_new(p, RE_BOL, 0, 0);
+    case '$':
+        p->p++;
+        return re_new(p, RE_EOL, 0, 0);
+    case '.':
+        p->p++;
+        if ((r = re_new(p, RE_CHAR, 0, 0))) {
+            for (i = 1; i < 256; i++)
+                cls_set(r->cls, i);
+        }
+        return r;
+    case '[':
+        p->p++;
+        return re_bracket(p);
+    case '*':
+    case '+':
+    case '?':
+    case '{':
+        p->bad = 1;
+        return 0;
+    case '\\':
+        p->p++;
+        if (!*p->p || isalnum((unsigned char)*p->p)) {
+            // back-references and GNU extensions
+            p->bad = 1;
+            return 0;
+        }
+        break;
+    default:
+        break;
+    }
+    if ((r = re_new(p, RE_CHAR, 0, 0))) {
+        cls_set(r->cls, *p->p);
+        re_fold(r->cls);
+    }
+    p->p++;
+    return r;
+}
+
+static int re_number(re_parser* p)
+{
+    int n = 0;
+    if (!isdigit((unsigned char)*p->p))
+        return -1;
+    while (isdigit((unsigned char)*p->p) && n <= MAX_REPEAT)
+        n = n * 10 + (*p->p++ - '0');
+    return n;
+}
+
+static re_node* re_repeat(re_parser* p)
+{
+    re_node* r = re_atom(p);
+
+    while (!p->bad) {
+        if ('*' == *p->p)
+            r = re_new(p, RE_STAR, r, 0);
+        else if ('+' == *p->p)
+            r = re_new(p, RE_PLUS, r, 0);
+        else if ('?' == *p->p)
+            r = re_new(p, RE_QUEST, r, 0);
+        else if ('{' == *p->p) {
+            int min, max;
+            p->p++;
+            min = re_number(p);
+            max = min;
+            if (',' == *p->p) {
+                p->p++;
+                max = re_number(p);
+            }
+            if (min < 0) {
+                if (max < 0) {
+                    p->bad = 1;
+                    break;
+                }
+                min = 0;
+            }
+            if ('}' != *p->p || min > MAX_REPEAT || max > MAX_REPEAT || (max >= 0 && min > max)) {
+                p->bad = 1;
+                break;
+            }
+            if ((r = re_new(p, RE_REPEAT, r, 0))) {
+                r->min = min;
+                r->max = max;
+            }
+        } else
+            break;
+        p->p++;
+    }
+    return r;
+}
+
+static re_node* re_cat(re_parser* p)
+{
+    re_node* r = 0;
+
+    while (!p->bad && *p->p && '|' != *p->p && ')' != *p->p) {
+        re_node* a = re_repeat(p);
+        r          = r ? re_new(p, RE_CAT, r, a) : a;
+    }
+    return r ? r : re_new(p, RE_EMPTY, 0, 0);
+}
+
+static re_node* re_alt(re_parser* p)
+{
+    re_node* r = re_cat(p);
+
+    while (!p->bad && '|' == *p->p) {
+        p->p++;
+        r = re_new(p, RE_ALT, r, re_cat(p));
+    }
+    return r;
+}
+
+/*
+ * NFA, each piece of the parse tree is compiled with the node that follows
+ * it already known so there is nothing to patch up afterwards
+ */
+
+static int nfa_new(enum nfa_type type, int out, int out1)
+{
+    if (nfa_nodes == nfa_size) {
+        int       size = nfa_size ? nfa_size * 2 : 256;
+        nfa_node* n    = xrealloc(nfa, size * sizeof(*nfa));
+        if (!n)
+            return -1;
+        nfa      = n;
+        nfa_size = size;
+    }
+    memset(&nfa[nfa_nodes], 0, sizeof(*nfa));
+    nfa[nfa_nodes].type = type;
+    nfa[nfa_nodes].out  = out;
+    nfa[nfa_nodes].out1 = out1;
+    return nfa_nodes++;
+}
+
+static int nfa_compile(const re_node* r, int next)
+{
+    int s, e, i;
+
+    if (next < 0)
+        return -1;
+    switch (r->type) {
+    case RE_CHAR:
+        if ((s = nfa_new(NFA_CHAR, next, -1)) >= 0)
+            memcpy(nfa[s].cls, r->cls, sizeof(r->cls));
+        return s;
+    case RE_CAT:
+        return nfa_compile(r->left, nfa_compile(r->right, next));
+    case RE_ALT:
+        s = nfa_compile(r->left, next);
+        e = nfa_compile(r->right, next);
+        if (s < 0 || e < 0)
+            return -1;
+        return nfa_new(NFA_SPLIT, s, e);
+    case RE_QUEST:
+        if ((s = nfa_compile(r->left, next)) < 0)
+            return -1;
+        return nfa_new(NFA_SPLIT, s, next);
+    case RE_STAR:
+        if ((s = nfa_new(NFA_SPLIT, -1, next)) < 0)
+            return -1;
+        if ((e = nfa_compile(r->left, s)) < 0)
+            return -1;
+        nfa[s].out = e;
+        return s;
+    case RE_PLUS:
+        if ((s = nfa_new(NFA_SPLIT, -1, next)) < 0)
+            return -1;
+        if ((e = nfa_compile(r->left, s)) < 0)
+            return -1;
+        nfa[s].out = e;
+        return e;
+    case RE_REPEAT:
+        if (r->max < 0) {
+            if ((s = nfa_new(NFA_SPLIT, -1, next)) < 0)
+                return -1;
+            if ((e = nfa_compile(r->left, s)) < 0)
+                return -1;
+            nfa[s].out = e;
+        } else {
+            // x{0,n} is (x(x(...)?)?)?
+            s = next;
+            for (i = r->min; i < r->max; i++) {
+                if ((e = nfa_compile(r->left, s)) < 0)
+                    return -1;
+                if ((s = nfa_new(NFA_SPLIT, e, next)) < 0)
+                    return -1;
+            }
+        }
+        for (i = 0; i < r->min; i++)
+            s = nfa_compile(r->left, s);
+        return s;
+    case RE_BOL:
+        return nfa_new(NFA_BOL, next, -1);
+    case RE_EOL:
+        return nfa_new(NFA_EOL, next, -1);
+    case RE_EMPTY:
+        return next;
+    }
+    return -1;
+}
+
+/*
+ * Add a node and everything reachable from it without consuming input to
+ * the work list, assertions that can not be passed are kept in the list
+ */
+static void nfa_add(int n, int bol, int eol)
+{
+    if (mark[n] == mark_gen)
+        return;
+    mark[n] = mark_gen;
+    switch (nfa[n].type) {
+    case NFA_SPLIT:
+        nfa_add(nfa[n].out, bol, eol);
+        nfa_add(nfa[n].out1, bol, eol);
+        return;
+    case NFA_BOL:
+        if (bol) {
+            nfa_add(nfa[n].out, bol, eol);
+            return;
+        }
+        break;
+    case NFA_EOL:
+        if (eol) {
+            nfa_add(nfa[n].out, bol, eol);
+            return;
+        }
+        break;
+    default:
+        break;
+    }
+    work[work_n++] = n;
+}
+
+static void nfa_work_start(void)
+{
+    if (!++mark_gen) {
+        memset(mark, 0, nfa_nodes * sizeof(*mark));
+        mark_gen = 1;
+    }
+    work_n = 0;
+}
+
+static int int_cmp(const void* a, const void* b)
+{
+    return *(const int*)a - *(const int*)b;
+}
+
+/*
+ * DFA, states are sets of NFA nodes created when first needed
+ */
+
+static void dfa_flush(void)
+{
+    int i;
+    for (i = 0; i < dfa_states; i++) {
+        xfree(dfa[i]->set);
+        xfree(dfa[i]);
+    }
+    dfa_states = 0;
+    for (i = 0; i < DFA_HASH_SIZE; i++)
+        dfa_hash[i] = -1;
+}
+
+static unsigned int dfa_accept(const int* set, int n)
+{
+    unsigned int accept = 0;
+    int          i;
+    for (i = 0; i < n; i++) {
+        if (NFA_MATCH == nfa[set[i]].type)
+            accept |= nfa[set[i]].match;
+    }
+    return accept;
+}
+
+/*
+ * Find or create the state for the nodes in the work list, returns -1 if
+ * the state cache is full
+ */
+static int dfa_state_get(int bol)
+{
+    unsigned int hv = 2166136261U;
+    dfa_state*   d;
+    int          i, s;
+
+    qsort(work, work_n, sizeof(*work), int_cmp);
+    for (i = 0; i < work_n; i++)
+        hv = (hv ^ work[i]) * 16777619U;
+    for (s = dfa_hash[hv % DFA_HASH_SIZE]; s >= 0; s = dfa[s]->hnext) {
+        if (dfa[s]->hv == hv && dfa[s]->n == work_n && !memcmp(dfa[s]->set, work, work_n * sizeof(*work)))
+            return s;
+    }
+    if (dfa_states == MAX_DFA_STATES)
+        return -1;
+    if (!(d = xcalloc(1, sizeof(*d))) || !(d->set = xmalloc((work_n ? work_n : 1) * sizeof(*work)))) {
+        xfree(d);
+        return -1;
+    }
+    memcpy(d->set, work, work_n * sizeof(*work));
+    d->n      = work_n;
+    d->hv     = hv;
+    d->accept = dfa_accept(d->set, d->n);
+    for (i = 0; i < 256; i++)
+        d->next[i] = -1;
+
+    // what would match if the qname ends here
+    nfa_work_start();
+    for (i = 0; i < d->n; i++)
+        nfa_add(d->set[i], bol, 1);
+    d->accept_eol = dfa_accept(work, work_n);
+
+    d->hnext                    = dfa_hash[hv % DFA_HASH_SIZE];
+    dfa_hash[hv % DFA_HASH_SIZE] = dfa_states;
+    dfa[dfa_states]             = d;
+    return dfa_states++;
+}
+
+static int dfa_start(void)
+{
+    int i;
+    nfa_work_start();
+    for (i = 0; i < filters; i++)
+        nfa_add(starts[i], 1, 0);
+    return dfa_state_get(1);
+}
+
+static int dfa_step(int s, unsigned char c)
+{
+    const dfa_state* d = dfa[s];
+    int              i, n;
+
+    nfa_work_start();
+    for (i = 0; i < d->n; i++) {
+        const nfa_node* e = &nfa[d->set[i]];
+        if (NFA_CHAR == e->type && cls_isset(e->cls, c))
+            nfa_add(e->out, 0, 0);
+    }
+    // filters match anywhere in the qname so they can start at any point
+    for (i = 0; i < filters; i++)
+        nfa_add(starts[i], 0, 0);
+    if ((n = dfa_state_get(0)) >= 0)
+        dfa[s]->next[c] = n;
+    return n;
+}
+
+/*
+ * Run the DFA over the qname, returns -1 if the state cache filled up
+ */
+static int dfa_run(const unsigned char* q, size_t len, unsigned int* match)
+{
+    unsigned int all = filters < 32 ? (1U << filters) - 1 : ~0U;
+    unsigned int m;
+    int          s;
+    size_t       i;
+
+    if (!dfa_states) {
+        if (dfa_start())
+            return -1;
+    }
+    s = 0;
+    m = dfa[s]->accept;
+    for (i = 0; i < len && m != all; i++) {
+        int n = dfa[s]->next[q[i]];
+        if (n < 0 && (n = dfa_step(s, q[i])) < 0)
+            return -1;
+        s = n;
+        m |= dfa[s]->accept;
+    }
+    *match = m | dfa[s]->accept_eol;
+    return 0;
+}
+
+/*
+ * Add a pattern to the set of qname filters, returns the filter bit in the
+ * mask returned by qname_filter_match() or -1 if the pattern can not be
+ * handled here
+ */
+int qname_filter_add(const char* pattern)
+{
+    re_parser p = { pattern, 0 };
+    re_node*  r;
+    int       m, s;
+
+    if (filters == QNAME_FILTER_MAX)
+        return -1;
+    r = re_alt(&p);
+    if (p.bad || *p.p) {
+        re_free(r);
+        return -1;
+    }
+    if ((m = nfa_new(NFA_MATCH, -1, -1)) < 0 || (s = nfa_compile(r, m)) < 0) {
+        re_free(r);
+        dsyslogf(LOG_ERR, "qname_filter: unable to compile '%s', out of memory?", pattern);
+        return -1;
+    }
+    re_free(r);
+    nfa[m].match     = 1U << filters;
+    starts[filters] = s;
+
+    xfree(mark);
+    xfree(work);
+    mark     = xcalloc(nfa_nodes, sizeof(*mark));
+    work     = xmalloc(nfa_nodes * sizeof(*work));
+    mark_gen = 0;
+    if (!mark || !work) {
+        dsyslogf(LOG_ERR, "qname_filter: unable to compile '%s', out of memory?", pattern);
+        return -1;
+    }
+
+    // existing states do not know about the new filter
+    dfa_flush();
+    return filters++;
+}
+
+/*
+ * Match the qname against all filters, returns a bitmask of the filters
+ * that matched
+ */
+unsigned int qname_filter_match(const char* qname, size_t len)
+{
+    unsigned int match = 0;
+
+    if (!filters)
+        return 0;
+    if (dfa_run((const unsigned char*)qname, len, &match)) {
+        // start over with an empty cache, one qname fits in it
+        dfa_flush();
+        if (dfa_run((const unsigned char*)qname, len, &match))
+            dsyslog(LOG_ERR, "qname_filter: unable to create DFA state, out of memory?");
+    }
+    return match;
+}
+
+/*
+ * Remove all filters, used when the configuration is reloaded
+ */
+void qname_filter_reset(void)
+{
+    dfa_flush();
+    xfree(nfa);
+    xfree(mark);
+    xfree(work);
+    nfa       = 0;
+    nfa_size  = 0;
+    nfa_nodes = 0;
+    mark      = 0;
+    mark_gen  = 0;
+    work      = 0;
+    work_n    = 0;
+    filters   = 0;
+}
@@ -37,156 +37,410 @@
 #include "config.h"
 
 #include "qname_index.h"
-#include "hashtbl.h"
+#include "label_dict.h"
 #include "xmalloc.h"
 
 #include <string.h>
 
-typedef struct
-{
-    int      next_idx;
-    hashtbl* hash;
-} levelobj;
+/*
+ * The qname, second_ld and third_ld dictionaries share one reverse trie
+ * of the names' labels. Each label is interned once and each name is the
+ * path to its node, so the second and third level domains of a qname are
+ * ancestors of its node and one walk finds all three. Every level has its
+ * own indexes which follow the label_dict semantics of persistent_labels.
+ */
 
-static hashfunc   name_hashfunc;
-static hashkeycmp name_cmpfunc;
-static int        name_indexer(const char*, levelobj*);
-static int        name_iterator(const char**, levelobj*);
-static void       name_reset(levelobj*);
+#define NAME_HASH_SZ 131072
+#define LABEL_HASH_SZ 65536
+
+enum {
+    LEVEL_FULL,
+    LEVEL_SECOND,
+    LEVEL_THIRD,
+    LEVELS
+};
 
-#define MAX_ARRAY_SZ 65536
+typedef struct labelobj labelobj;
+struct labelobj {
+    const char*    name; /* not 0-terminated */
+    unsigned short len;
+    unsigned int   refs; /* nodes using it */
+};
 
-static levelobj Full   = { 0, NULL };
-static levelobj Second = { 0, NULL };
-static levelobj Third  = { 0, NULL };
+typedef struct nameobj nameobj;
+struct nameobj {
+    nameobj*        parent; /* NULL for the rightmost label */
+    const labelobj* label;
+    unsigned int    hv; /* of label and parent's hv */
+    unsigned short  len; /* of the whole name */
+    unsigned int    walked; /* interval it was last walked in */
+    int             idx[LEVELS]; /* -1 if no index on that level */
+    unsigned int    seen[LEVELS];
+};
 
 typedef struct
 {
-    char* name;
-    int   index;
-} nameobj;
+    nameobj**    node; /* by index */
+    int          size;
+    int          next_idx;
+    int*         free_idx;
+    int          free_len;
+    int          free_size;
+    int          iter_idx;
+} levelobj;
+
+extern int persistent_labels;
+
+static hashtbl*     Names     = NULL;
+static hashtbl*     Labels    = NULL;
+static unsigned int names_gen = 1; /* changes whenever nodes are freed */
+static unsigned int compacted = 0;
+static levelobj     Levels[LEVELS];
+
+static hashfunc   name_hashfunc;
+static hashkeycmp name_cmpfunc;
+static hashfree   name_free;
+static hashfunc   label_hashfunc;
+static hashkeycmp label_cmpfunc;
+static int        name_indexer(const dns_message*, int);
+static int        name_iterator(const char**, int);
+static void       name_reset(void);
 
 /* ==== QNAME ============================================================= */
 
 int qname_indexer(const dns_message* m)
 {
-    if (m->malformed)
-        return -1;
-    return name_indexer(m->qname, &Full);
+    return name_indexer(m, LEVEL_FULL);
 }
 
 int qname_iterator(const char** label)
 {
-    return name_iterator(label, &Full);
+    return name_iterator(label, LEVEL_FULL);
 }
 
 void qname_reset()
 {
-    name_reset(&Full);
+    name_reset();
 }
 
 /* ==== SECOND LEVEL DOMAIN =============================================== */
 
 int second_ld_indexer(const dns_message* m)
 {
-    if (m->malformed)
-        return -1;
-    return name_indexer(dns_message_QnameToNld(m->qname, 2), &Second);
+    return name_indexer(m, LEVEL_SECOND);
 }
 
 int second_ld_iterator(const char** label)
 {
-    return name_iterator(label, &Second);
+    return name_iterator(label, LEVEL_SECOND);
 }
 
 void second_ld_reset()
 {
-    name_reset(&Second);
+    name_reset();
 }
 
-/* ==== QNAME ============================================================= */
+/* ==== THIRD LEVEL DOMAIN ================================================ */
 
 int third_ld_indexer(const dns_message* m)
 {
-    if (m->malformed)
-        return -1;
-    return name_indexer(dns_message_QnameToNld(m->qname, 3), &Third);
+    return name_indexer(m, LEVEL_THIRD);
 }
 
 int third_ld_iterator(const char** label)
 {
-    return name_iterator(label, &Third);
+    return name_iterator(label, LEVEL_THIRD);
 }
 
 void third_ld_reset()
 {
-    name_reset(&Third);
+    name_reset();
 }
 
 /* ======================================================================== */
 
+static void*
+name_alloc(size_t size)
+{
+    return persistent_labels ? xcalloc(1, size) : acalloc(1, size);
+}
+
+static const labelobj*
+label_intern(const char* name, unsigned short len, unsigned int hv)
+{
+    labelobj  key = { name, len, 0 };
+    labelobj* obj;
+    char*     s;
+
+    if ((obj = hash_find_hashed(&key, hv, Labels)))
+        return obj;
+    if (NULL == (obj = name_alloc(sizeof(*obj) + len + 1)))
+        return NULL;
+    s = (char*)(obj + 1);
+    memcpy(s, name, len);
+    obj->name = s;
+    obj->len  = len;
+    if (0 != hash_add_hashed(obj, hv, obj, Labels)) {
+        if (persistent_labels)
+            xfree(obj);
+        return NULL;
+    }
+    return obj;
+}
+
+static nameobj*
+name_child(nameobj* parent, const char* name, unsigned short len)
+{
+    labelobj      label = { name, len, 0 };
+    nameobj       key   = { parent, &label };
+    nameobj*      obj;
+    unsigned char buf[sizeof(unsigned int) + MAX_QNAME_SZ];
+    unsigned int  phv = parent ? parent->hv : 0, hv;
+    int           level;
+
+    memcpy(buf, &phv, sizeof(phv));
+    memcpy(buf + sizeof(phv), name, len);
+    hv = hash_keyed(buf, sizeof(phv) + len);
+    if ((obj = hash_find_hashed(&key, hv, Names))) {
+        obj->walked = label_dict_interval;
+        return obj;
+    }
+    if (NULL == (obj = name_alloc(sizeof(*obj))))
+        return NULL;
+    if (NULL == (obj->label = label_intern(name, len, hash_keyed(name, len)))) {
+        if (persistent_labels)
+            xfree(obj);
+        return NULL;
+    }
+    obj->parent = parent;
+    obj->hv     = hv;
+    obj->len    = (parent ? parent->len + 1 : 0) + len;
+    obj->walked = label_dict_interval;
+    for (level = 0; level < LEVELS; level++)
+        obj->idx[level] = -1;
+    if (0 != hash_add_hashed(obj, hv, obj, Names)) {
+        if (persistent_labels)
+            xfree(obj);
+        return NULL;
+    }
+    ((labelobj*)obj->label)->refs++;
+    return obj;
+}
+
+/*
+ * Walk the qname from its rightmost label and cache the nodes of all levels
+ * in the message, the second and third level domains always start at a label
+ */
 static int
-name_indexer(const char* theName, levelobj* theLevel)
+name_walk(dns_message* m)
 {
-    nameobj* obj;
-    if (NULL == theLevel->hash) {
-        theLevel->hash = hash_create(MAX_ARRAY_SZ, name_hashfunc, name_cmpfunc, 1, afree, afree);
-        if (NULL == theLevel->hash)
+    const char* second = dns_message_nld(m, 2);
+    const char* third  = dns_message_nld(m, 3);
+    const char *s, *e = m->qname + m->qname_len;
+    nameobj*    n = NULL;
+
+    if (NULL == Names) {
+        Names  = hash_create(NAME_HASH_SZ, name_hashfunc, name_cmpfunc, !persistent_labels, NULL, persistent_labels ? name_free : NULL);
+        Labels = hash_create(LABEL_HASH_SZ, label_hashfunc, label_cmpfunc, !persistent_labels, NULL, persistent_labels ? xfree : NULL);
+        if (NULL == Names || NULL == Labels) {
+            Names = Labels = NULL;
+            return -1;
+        }
+    }
+    memset(m->qname_node, 0, sizeof(m->qname_node));
+    for (;;) {
+        for (s = e; s > m->qname && '.' != s[-1]; s--)
+            ;
+        if (NULL == (n = name_child(n, s, e - s)))
             return -1;
+        if (s == second)
+            m->qname_node[LEVEL_SECOND] = n;
+        if (s == third)
+            m->qname_node[LEVEL_THIRD] = n;
+        if (s == m->qname)
+            break;
+        e = s - 1;
     }
-    if ((obj = hash_find(theName, theLevel->hash)))
-        return obj->index;
-    obj = acalloc(1, sizeof(*obj));
-    if (NULL == obj)
+    m->qname_node[LEVEL_FULL] = n;
+    m->qname_node_gen         = names_gen;
+    return 0;
+}
+
+static int
+name_indexer(const dns_message* m, int level)
+{
+    levelobj* l = &Levels[level];
+    nameobj*  n;
+
+    if (m->malformed)
         return -1;
-    obj->name = astrdup(theName);
-    if (NULL == obj->name) {
-        afree(obj);
+    if (m->qname_node_gen != names_gen && name_walk((dns_message*)m) < 0)
         return -1;
-    }
-    obj->index = theLevel->next_idx;
-    if (0 != hash_add(obj->name, obj, theLevel->hash)) {
-        afree(obj->name);
-        afree(obj);
+    if (NULL == (n = (nameobj*)m->qname_node[level]))
         return -1;
+    if (n->idx[level] < 0) {
+        int idx = l->free_len ? l->free_idx[l->free_len - 1] : l->next_idx;
+        if (idx >= l->size) {
+            int       size = l->size ? l->size << 1 : 1024;
+            nameobj** node = xrealloc(l->node, size * sizeof(*node));
+            if (NULL == node)
+                return -1;
+            l->node = node;
+            l->size = size;
+        }
+        l->node[idx] = n;
+        n->idx[level] = idx;
+        if (l->free_len)
+            l->free_len--;
+        else
+            l->next_idx++;
     }
-    theLevel->next_idx++;
-    return obj->index;
+    n->seen[level] = label_dict_interval;
+    return n->idx[level];
 }
 
 static int
-name_iterator(const char** label, levelobj* theLevel)
+name_iterator(const char** label, int level)
 {
-    nameobj*    obj;
+    levelobj*   l = &Levels[level];
+    nameobj *   n, *p;
     static char label_buf[MAX_QNAME_SZ];
-    if (0 == theLevel->next_idx)
+    int         pos;
+
+    if (0 == l->next_idx)
         return -1;
     if (NULL == label) {
-        hash_iter_init(theLevel->hash);
-        return theLevel->next_idx;
+        l->iter_idx = 0;
+        return l->next_idx;
     }
-    if ((obj = hash_iterate(theLevel->hash)) == NULL)
-        return -1;
-    snprintf(label_buf, sizeof(label_buf), "%s", obj->name);
+    /* names kept from earlier intervals have no cells in this one */
+    do {
+        if (l->iter_idx >= l->next_idx)
+            return -1;
+        n = l->node[l->iter_idx++];
+    } while (NULL == n || n->seen[level] != label_dict_interval);
+    for (pos = 0, p = n; p; p = p->parent) {
+        memcpy(label_buf + pos, p->label->name, p->label->len);
+        pos += p->label->len;
+        if (p->parent)
+            label_buf[pos++] = '.';
+    }
+    label_buf[pos] = 0;
     *label = label_buf;
-    return obj->index;
+    return n->idx[level];
+}
+
+static int
+name_stale(void* data, void* ctx)
+{
+    nameobj* n = data;
+    int      level, stale;
+
+    /*
+     * A node is walked whenever any of its descendants is, so a stale node
+     * is always removed together with its whole subtree
+     */
+    stale = label_dict_interval - n->walked > (unsigned int)persistent_labels;
+    for (level = 0; level < LEVELS; level++) {
+        levelobj* l = &Levels[level];
+        if (n->idx[level] < 0)
+            continue;
+        if (!stale && label_dict_interval - n->seen[level] <= (unsigned int)persistent_labels)
+            continue;
+        if (l->free_len == l->free_size) {
+            int  size = l->free_size ? l->free_size << 1 : 256;
+            int* idx  = xrealloc(l->free_idx, size * sizeof(*idx));
+            if (idx) {
+                l->free_idx  = idx;
+                l->free_size = size;
+            }
+        }
+        /* the index is lost if it can not be put on the free list */
+        if (l->free_len < l->free_size)
+            l->free_idx[l->free_len++] = n->idx[level];
+        l->node[n->idx[level]] = NULL;
+        n->idx[level]          = -1;
+    }
+    return stale;
+}
+
+static int
+label_unused(void* data, void* ctx)
+{
+    return 0 == ((labelobj*)data)->refs;
 }
 
+/*
+ * Called for each array using any of the levels when the arrays are
+ * cleared, the trie is forgotten or compacted on the first call of the
+ * interval
+ */
 static void
-name_reset(levelobj* theLevel)
+name_reset(void)
 {
-    theLevel->hash     = NULL;
-    theLevel->next_idx = 0;
+    int level;
+
+    if (NULL == Names)
+        return;
+    if (!persistent_labels) {
+        /* it was in the arena */
+        Names = Labels = NULL;
+        for (level = 0; level < LEVELS; level++) {
+            Levels[level].next_idx = 0;
+            Levels[level].free_len = 0;
+        }
+        names_gen++;
+        return;
+    }
+    if (compacted == label_dict_interval)
+        return;
+    compacted = label_dict_interval;
+    hash_remove_matching(Names, name_stale, NULL);
+    hash_remove_matching(Labels, label_unused, NULL);
+    names_gen++;
 }
 
 static unsigned int
 name_hashfunc(const void* key)
 {
-    return hashendian(key, strlen(key), 0);
+    return ((const nameobj*)key)->hv;
 }
 
 static int
 name_cmpfunc(const void* a, const void* b)
 {
-    return strcasecmp(a, b);
+    const nameobj* x = a;
+    const nameobj* y = b;
+
+    if (x->parent != y->parent || x->label->len != y->label->len)
+        return 1;
+    return memcmp(x->label->name, y->label->name, x->label->len);
+}
+
+static void
+name_free(void* p)
+{
+    nameobj* n = p;
+
+    ((labelobj*)n->label)->refs--;
+    xfree(n);
+}
+
+static unsigned int
+label_hashfunc(const void* key)
+{
+    const labelobj* l = key;
+
+    return hash_keyed(l->name, l->len);
+}
+
+static int
+label_cmpfunc(const void* a, const void* b)
+{
+    const labelobj* x = a;
+    const labelobj* y = b;
+
+    if (x->len != y->len)
+        return 1;
+    return memcmp(x->name, y->name, x->len);
 }
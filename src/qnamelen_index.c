@@ -44,7 +44,7 @@ static int largest = 0;
 
 int qnamelen_indexer(const dns_message* m)
 {
-    int i = strlen(m->qname);
+    int i = m->qname_len;
     if (m->malformed)
         return -1;
     if (i >= MAX_QNAME_SZ)
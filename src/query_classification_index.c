@@ -62,18 +62,16 @@ enum {
 static int
 nonauth_tld(const dns_message* m)
 {
-    unsigned int i;
-    const char*  tld = dns_message_tld((dns_message*)m);
-    for (i = 0; KnownTLDS[i]; i++)
-        if (0 == strcmp(KnownTLDS[i], tld))
-            return 0;
+    const char* tld = dns_message_tld((dns_message*)m);
+    if (is_known_tld(tld, dns_message_nld_hash((dns_message*)m, 1)))
+        return 0;
     return CLASS_NONAUTH_TLD;
 }
 
 static int
 root_servers_net(const dns_message* m)
 {
-    if (0 == strcmp(m->qname + strlen(m->qname) - 16, "root-servers.net"))
+    if (dns_message_qname_class((dns_message*)m) & QNAME_CLASS_RSN_SUFFIX)
         return CLASS_ROOT_SERVERS_NET;
     return 0;
 }
@@ -81,7 +79,7 @@ root_servers_net(const dns_message* m)
 static int
 localhost(const dns_message* m)
 {
-    if (0 == strcmp(m->qname + strlen(m->qname) - 9, "localhost"))
+    if (dns_message_qname_class((dns_message*)m) & QNAME_CLASS_LOCALHOST_SUFFIX)
         return CLASS_LOCALHOST;
     return 0;
 }
@@ -102,7 +100,7 @@ a_for_root(const dns_message* m)
 {
     if (m->qtype != T_A)
         return 0;
-    if (0 == strcmp(m->qname, "."))
+    if (dns_message_qname_class((dns_message*)m) & QNAME_CLASS_ROOT)
         return CLASS_A_FOR_ROOT;
     return 0;
 }
@@ -110,30 +108,9 @@ a_for_root(const dns_message* m)
 static int
 rfc1918_ptr(const dns_message* m)
 {
-    char*        tok = 0;
-    char*        t;
-    char         q[1024];
-    unsigned int i = 0;
     if (m->qtype != T_PTR)
         return 0;
-    q[sizeof(q) - 1] = 0;
-    strncpy(q, m->qname, sizeof(q));
-    if (q[sizeof(q) - 1] != 0) {
-        // String was truncated
-        return 0;
-    }
-    if (NULL == (t = strstr(q, ".in-addr.arpa")))
-        return 0;
-    *t = '\0';
-    for (t = strtok_r(q, ".", &tok); t; t = strtok_r(NULL, ".", &tok)) {
-        i >>= 8;
-        i |= ((atoi(t) & 0xff) << 24);
-    }
-    if ((i & 0xff000000) == 0x0a000000) /* 10.0.0.0/8 */
-        return CLASS_RFC1918_PTR;
-    if ((i & 0xfff00000) == 0xac100000) /* 172.16.0.0/12 */
-        return CLASS_RFC1918_PTR;
-    if ((i & 0xffff0000) == 0xc0a80000) /* 192.168.0.0/16 */
+    if (dns_message_qname_class((dns_message*)m) & QNAME_CLASS_RFC1918_PTR)
         return CLASS_RFC1918_PTR;
     return 0;
 }
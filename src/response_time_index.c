@@ -43,9 +43,13 @@
 #include "syslog_debug.h"
 #include "pcap.h"
 #include "compat.h"
+#include "checkpoint.h"
 
 #include <math.h>
 #include <assert.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
 
 #define TIMED_OUT 0
 #define MISSING_QUERY 1
@@ -53,23 +57,59 @@
 #define INTERNAL_ERROR 3
 #define FIRST_BUCKET 4
 
-struct query;
-struct query {
-    struct query *    prev, *next;
-    transport_message tm;
-    dns_message       m;
-};
+/*
+ * Pending queries are kept as fixed size records in a pool allocated on
+ * first use, found by an open addressing table of pool slots and linked
+ * in a FIFO by age for timing them out. A record only holds what is
+ * needed to match the response and to count the query if it times out,
+ * the QNAME is not kept but a hash of it is used to verify the response.
+ */
+
+#define RT_KEY_WORDS 10
+
+#define RT_RD 0x01
+#define RT_AA 0x02
+#define RT_TC 0x04
+#define RT_AD 0x08
+#define RT_EDNS 0x10
+#define RT_DO 0x20
+
+typedef struct
+{
+    uint32_t key[RT_KEY_WORDS]; // client and server address, ports, id, IP version and protocol
+    uint32_t hash; // of the key
+    uint32_t prev, next; // FIFO by age as slot + 1 or 0 for none, next also links free slots
+    uint32_t ts_sec, ts_usec;
+    uint32_t qname_hash; // zero if the query had no QNAME
+    uint16_t qtype, qclass, msglen, edns_bufsiz;
+    uint8_t  opcode, rcode, flags, edns_version, encryption;
+} rt_query;
 
-#define MAX_ARRAY_SZ 65536
-static hashtbl*                        theHash      = 0;
 static enum response_time_mode         mode         = response_time_log10;
 static time_t                          max_sec      = 5;
 static enum response_time_max_sec_mode max_sec_mode = response_time_ceil;
 static unsigned int                    bucket_size  = 100;
 static size_t                          max_queries = 1000000, num_queries = 0;
-static struct query *                  qfirst = 0, *qlast = 0;
 static int                             max_iter = INTERNAL_ERROR, next_iter, flushing = 0;
 static enum response_time_full_mode    full_mode = response_time_drop_query;
+static int                             percentiles = 0;
+
+/*
+ * HDR mode buckets, the first sub_count microseconds are exact and after
+ * that each doubling of the range has sub_half buckets, giving a relative
+ * error below 10^-significant_digits
+ */
+static unsigned int sub_half_mag = 7, sub_half = 128, sub_mask = 255;
+
+static rt_query* pool      = 0;
+static size_t    pool_used = 0;
+static uint32_t  pool_free = 0; // first free slot + 1
+static uint32_t* table     = 0; // slot + 1 or 0 for empty
+static size_t    table_mask;
+static uint32_t  qfirst = 0, qlast = 0;
+
+static transport_message flushed_tm;
+static dns_message       flushed_m;
 
 void response_time_set_mode(enum response_time_mode m)
 {
@@ -101,77 +141,349 @@ void response_time_set_full_mode(enum response_time_full_mode m)
     full_mode = m;
 }
 
-static unsigned int _hash(const struct query* q)
+void response_time_set_significant_digits(unsigned int d)
 {
-    if (q->m.qr)
-        return inXaddr_hash(&q->tm.dst_ip_addr) ^ ((q->tm.dst_port & 0xffff) | (q->m.id << 16));
-    return inXaddr_hash(&q->tm.src_ip_addr) ^ ((q->tm.src_port & 0xffff) | (q->m.id << 16));
+    unsigned int largest = 2, mag = 0;
+
+    while (d--)
+        largest *= 10;
+    while ((1U << mag) < largest)
+        mag++;
+    sub_half_mag = mag - 1;
+    sub_half     = 1U << sub_half_mag;
+    sub_mask     = (1U << mag) - 1;
 }
 
-static int _cmp(const struct query* a, const struct query* b)
-{
-    int cmp;
-
-    // compare DNS ID
-    if (a->m.id != b->m.id)
-        return a->m.id < b->m.id ? -1 : 1;
-
-    // compare IP version, since inXaddr_cmp() does not, and protocol
-    if (a->tm.ip_version != b->tm.ip_version)
-        return a->tm.ip_version < b->tm.ip_version ? -1 : 1;
-    if (a->tm.proto != b->tm.proto)
-        return a->tm.proto < b->tm.proto ? -1 : 1;
-
-    // compare client IP&port first since other should be server and more static data
-    if (!a->m.qr && !b->m.qr) {
-        // both are queries, compare source address first as that is the client
-        if ((cmp = inXaddr_cmp(&a->tm.src_ip_addr, &b->tm.src_ip_addr)))
-            return cmp;
-        if (a->tm.src_port != b->tm.src_port)
-            return a->tm.src_port < b->tm.src_port ? -1 : 1;
-        if ((cmp = inXaddr_cmp(&a->tm.dst_ip_addr, &b->tm.dst_ip_addr)))
-            return cmp;
-        if (a->tm.dst_port != b->tm.dst_port)
-            return a->tm.dst_port < b->tm.dst_port ? -1 : 1;
-    } else if (a->m.qr && b->m.qr) {
-        // both are responses, compare destination address first as that is the client
-        if ((cmp = inXaddr_cmp(&a->tm.dst_ip_addr, &b->tm.dst_ip_addr)))
-            return cmp;
-        if (a->tm.dst_port != b->tm.dst_port)
-            return a->tm.dst_port < b->tm.dst_port ? -1 : 1;
-        if ((cmp = inXaddr_cmp(&a->tm.src_ip_addr, &b->tm.src_ip_addr)))
-            return cmp;
-        if (a->tm.src_port != b->tm.src_port)
-            return a->tm.src_port < b->tm.src_port ? -1 : 1;
-    } else if (a->m.qr && !b->m.qr) {
-        // a is a response and b is a query, compare a's destination with b's source first
-        if ((cmp = inXaddr_cmp(&a->tm.dst_ip_addr, &b->tm.src_ip_addr)))
-            return cmp;
-        if (a->tm.dst_port != b->tm.src_port)
-            return a->tm.dst_port < b->tm.src_port ? -1 : 1;
-        if ((cmp = inXaddr_cmp(&a->tm.src_ip_addr, &b->tm.dst_ip_addr)))
-            return cmp;
-        if (a->tm.src_port != b->tm.dst_port)
-            return a->tm.src_port < b->tm.dst_port ? -1 : 1;
+void response_time_set_percentiles(int p)
+{
+    percentiles = p;
+}
+
+static int rt_log2(unsigned long us)
+{
+    return (int)(sizeof(us) * 8) - 1 - __builtin_clzl(us);
+}
+
+static int rt_hdr_index(unsigned long us)
+{
+    int bucket = rt_log2(us | sub_mask) - sub_half_mag;
+
+    return ((bucket + 1) << sub_half_mag) + (int)(us >> bucket) - sub_half;
+}
+
+/*
+ * Range of microseconds, end exclusive, counted by a response time index
+ */
+static void rt_range(int iter, unsigned long* lo, unsigned long* hi)
+{
+    int           i = iter - FIRST_BUCKET, bucket;
+    unsigned long sub;
+
+    switch (mode) {
+    case response_time_bucket:
+        *lo = (unsigned long)i * bucket_size;
+        *hi = *lo + bucket_size;
+        return;
+    case response_time_log10:
+        for (*lo = 1; i--; *lo *= 10)
+            ;
+        *hi = *lo * 10;
+        return;
+    case response_time_log2:
+        *lo = 1UL << i;
+        *hi = *lo << 1;
+        return;
+    case response_time_hdr:
+        bucket = (i >> sub_half_mag) - 1;
+        sub    = (i & (sub_half - 1)) + sub_half;
+        if (bucket < 0) {
+            bucket = 0;
+            sub -= sub_half;
+        }
+        *lo = sub << bucket;
+        *hi = *lo + (1UL << bucket);
+        return;
+    }
+    *lo = *hi = 0;
+}
+
+static int rt_init(void)
+{
+    size_t size = 16;
+
+    if (max_queries > UINT32_MAX - 1)
+        max_queries = UINT32_MAX - 1;
+    while (size < max_queries * 2)
+        size *= 2;
+
+    if (!(pool = xcalloc(max_queries, sizeof(*pool))))
+        return 0;
+    if (!(table = xcalloc(size, sizeof(*table)))) {
+        xfree(pool);
+        pool = 0;
+        return 0;
+    }
+    table_mask = size - 1;
+    return 1;
+}
+
+static void rt_key(const dns_message* m, uint32_t* key)
+{
+    const transport_message* tm     = m->tm;
+    const inX_addr*          client = m->qr ? &tm->dst_ip_addr : &tm->src_ip_addr;
+    const inX_addr*          server = m->qr ? &tm->src_ip_addr : &tm->dst_ip_addr;
+
+    memset(key, 0, RT_KEY_WORDS * sizeof(*key));
+    if (tm->ip_version == 6) {
+        memcpy(key, client->in6.s6_addr, 16);
+        memcpy(key + 4, server->in6.s6_addr, 16);
     } else {
-        // a is a query and b is a response, compare a's source with b's destination first
-        if ((cmp = inXaddr_cmp(&a->tm.src_ip_addr, &b->tm.dst_ip_addr)))
-            return cmp;
-        if (a->tm.src_port != b->tm.dst_port)
-            return a->tm.src_port < b->tm.dst_port ? -1 : 1;
-        if ((cmp = inXaddr_cmp(&a->tm.dst_ip_addr, &b->tm.src_ip_addr)))
-            return cmp;
-        if (a->tm.dst_port != b->tm.src_port)
-            return a->tm.dst_port < b->tm.src_port ? -1 : 1;
+        key[0] = client->in4.s_addr;
+        key[4] = server->in4.s_addr;
     }
+    if (m->qr)
+        key[8] = ((uint32_t)tm->dst_port << 16) | tm->src_port;
+    else
+        key[8] = ((uint32_t)tm->src_port << 16) | tm->dst_port;
+    key[9] = ((uint32_t)m->id << 16) | (tm->ip_version << 8) | tm->proto;
+}
+
+static uint32_t rt_qname_hash(const dns_message* m)
+{
+    uint32_t    h = 2166136261U;
+    const char* p;
+
+    if (!m->qname_len)
+        return 0;
+    for (p = m->qname; *p; p++)
+        h = (h ^ (unsigned char)tolower((unsigned char)*p)) * 16777619U;
+    return h | 1;
+}
+
+static void rt_fill(rt_query* q, const dns_message* m)
+{
+    q->ts_sec       = m->tm->ts.tv_sec;
+    q->ts_usec      = m->tm->ts.tv_usec;
+    q->qname_hash   = rt_qname_hash(m);
+    q->qtype        = m->qtype;
+    q->qclass       = m->qclass;
+    q->msglen       = m->msglen;
+    q->edns_bufsiz  = m->edns.bufsiz;
+    q->opcode       = m->opcode;
+    q->rcode        = m->rcode;
+    q->edns_version = m->edns.version;
+    q->encryption   = m->tm->encryption;
+    q->flags        = (m->rd ? RT_RD : 0) | (m->aa ? RT_AA : 0) | (m->tc ? RT_TC : 0) | (m->ad ? RT_AD : 0)
+               | (m->edns.found ? RT_EDNS : 0) | (m->edns.DO ? RT_DO : 0);
+}
 
+/*
+ * Rebuild the query, without QNAME, to count it when it has timed out
+ */
+static void rt_message(const rt_query* q, dns_message* m, transport_message* tm)
+{
+    memset(tm, 0, sizeof(*tm));
+    tm->ts.tv_sec  = q->ts_sec;
+    tm->ts.tv_usec = q->ts_usec;
+    tm->ip_version = (q->key[9] >> 8) & 0xff;
+    tm->proto      = q->key[9] & 0xff;
+    tm->src_port   = q->key[8] >> 16;
+    tm->dst_port   = q->key[8] & 0xffff;
+    tm->encryption = q->encryption;
+    if (tm->ip_version == 6) {
+        inXaddr_assign_v6(&tm->src_ip_addr, (const struct in6_addr*)&q->key[0]);
+        inXaddr_assign_v6(&tm->dst_ip_addr, (const struct in6_addr*)&q->key[4]);
+    } else {
+        struct in_addr a;
+        a.s_addr = q->key[0];
+        inXaddr_assign_v4(&tm->src_ip_addr, &a);
+        a.s_addr = q->key[4];
+        inXaddr_assign_v4(&tm->dst_ip_addr, &a);
+    }
+
+    memset(m, 0, sizeof(*m));
+    m->tm           = tm;
+    m->id           = q->key[9] >> 16;
+    m->qtype        = q->qtype;
+    m->qclass       = q->qclass;
+    m->msglen       = q->msglen;
+    m->opcode       = q->opcode;
+    m->rcode        = q->rcode;
+    m->rd           = !!(q->flags & RT_RD);
+    m->aa           = !!(q->flags & RT_AA);
+    m->tc           = !!(q->flags & RT_TC);
+    m->ad           = !!(q->flags & RT_AD);
+    m->edns.found   = !!(q->flags & RT_EDNS);
+    m->edns.DO      = !!(q->flags & RT_DO);
+    m->edns.version = q->edns_version;
+    m->edns.bufsiz  = q->edns_bufsiz;
+}
+
+/*
+ * Returns the table entry of the query with the key, or the empty entry
+ * where it would be added if it is not pending
+ */
+static uint32_t* rt_find(const uint32_t* key, uint32_t hash)
+{
+    size_t   i;
+    uint32_t slot;
+
+    for (i = hash & table_mask; (slot = table[i]); i = (i + 1) & table_mask) {
+        if (pool[slot - 1].hash == hash && !memcmp(pool[slot - 1].key, key, sizeof(pool[slot - 1].key)))
+            break;
+    }
+    return &table[i];
+}
+
+static void rt_fifo_append(uint32_t slot)
+{
+    pool[slot - 1].prev = qlast;
+    pool[slot - 1].next = 0;
+    if (qlast)
+        pool[qlast - 1].next = slot;
+    else
+        qfirst = slot;
+    qlast = slot;
+}
+
+static void rt_fifo_unlink(uint32_t slot)
+{
+    rt_query* q = &pool[slot - 1];
+
+    if (q->prev)
+        pool[q->prev - 1].next = q->next;
+    else
+        qfirst = q->next;
+    if (q->next)
+        pool[q->next - 1].prev = q->prev;
+    else
+        qlast = q->prev;
+}
+
+/*
+ * Remove a pending query, entries after it in the table are moved back
+ * so lookups never need to skip removed entries
+ */
+static void rt_remove(uint32_t slot)
+{
+    size_t i, j, home;
+
+    for (i = pool[slot - 1].hash & table_mask; table[i] != slot; i = (i + 1) & table_mask)
+        ;
+    for (j = (i + 1) & table_mask; table[j]; j = (j + 1) & table_mask) {
+        home = pool[table[j] - 1].hash & table_mask;
+        // entries with their home between the hole and themselves stay
+        if (i < j ? (i < home && home <= j) : (i < home || home <= j))
+            continue;
+        table[i] = table[j];
+        i        = j;
+    }
+    table[i] = 0;
+
+    rt_fifo_unlink(slot);
+    pool[slot - 1].next = pool_free;
+    pool_free           = slot;
+    num_queries--;
+}
+
+static uint32_t rt_alloc(void)
+{
+    uint32_t slot;
+
+    if (pool_free) {
+        slot      = pool_free;
+        pool_free = pool[slot - 1].next;
+        return slot;
+    }
+    if (pool_used < max_queries)
+        return ++pool_used;
     return 0;
 }
 
+/*
+ * Index of the response time bucket for a query and response time
+ */
+static int rt_response_index(const struct timeval* qts, const struct timeval* rts)
+{
+    struct timeval diff;
+    unsigned long  us;
+    int            iter;
+
+    diff.tv_sec  = rts->tv_sec - qts->tv_sec;
+    diff.tv_usec = rts->tv_usec - qts->tv_usec;
+    if (diff.tv_usec >= 1000000) {
+        diff.tv_sec += 1;
+        diff.tv_usec -= 1000000;
+    } else if (diff.tv_usec < 0) {
+        diff.tv_sec -= 1;
+        diff.tv_usec += 1000000;
+    }
+
+    if (diff.tv_sec < 0 || diff.tv_usec < 0) {
+        dfprintf(1, "response_time: bad diff " PRItime ", " PRItime " - " PRItime, diff.tv_sec, diff.tv_usec, qts->tv_sec, qts->tv_usec, rts->tv_sec, rts->tv_usec);
+        return INTERNAL_ERROR;
+    }
+    if (diff.tv_sec >= max_sec) {
+        switch (max_sec_mode) {
+        case response_time_ceil:
+            dfprintf(2, "response_time: diff " PRItime " ceiled to " PRItime, diff.tv_sec, diff.tv_usec, max_sec, 0L);
+            diff.tv_sec  = max_sec;
+            diff.tv_usec = 0;
+            break;
+        case response_time_timed_out:
+            dfprintf(1, "response_time: diff " PRItime " too old, timed out", diff.tv_sec, diff.tv_usec);
+            return TIMED_OUT;
+        default:
+            dfprint(1, "response_time: bad max_sec_mode");
+            return INTERNAL_ERROR;
+        }
+    }
+
+    us = (diff.tv_sec * 1000000) + diff.tv_usec;
+    switch (mode) {
+    case response_time_bucket:
+        iter = FIRST_BUCKET + (us / bucket_size);
+        dfprintf(2, "response_time: found q/r us:%lu, put in bucket %d (%lu-%lu usec)", us, iter, (us / bucket_size) * bucket_size, ((us / bucket_size) + 1) * bucket_size);
+        break;
+    case response_time_log10: {
+        double d = log10((double)us);
+        if (d < 0) {
+            dfprintf(1, "response_time: bad log10(%lu) ret %f", us, d);
+            return INTERNAL_ERROR;
+        }
+        iter = FIRST_BUCKET + (int)d;
+        dfprintf(2, "response_time: found q/r us:%lu, log10 %d (%.0f-%.0f usec)", us, iter, pow(10, (int)d), pow(10, (int)d + 1));
+        break;
+    }
+    case response_time_log2: {
+        double d = log2((double)us);
+        if (d < 0) {
+            dfprintf(1, "response_time: bad log2(%lu) ret %f", us, d);
+            return INTERNAL_ERROR;
+        }
+        iter = FIRST_BUCKET + (int)d;
+        dfprintf(2, "response_time: found q/r us:%lu, log2 %d (%.0f-%.0f usec)", us, iter, pow(2, (int)d), pow(2, (int)d + 1));
+        break;
+    }
+    case response_time_hdr:
+        iter = FIRST_BUCKET + rt_hdr_index(us);
+        dfprintf(2, "response_time: found q/r us:%lu, hdr %d", us, iter);
+        break;
+    default:
+        dfprint(1, "response_time: bad mode");
+        return INTERNAL_ERROR;
+    }
+
+    if (iter > max_iter)
+        max_iter = iter;
+    return iter;
+}
+
 int response_time_indexer(const dns_message* m)
 {
-    struct query       q, *obj;
-    transport_message* tm  = m->tm;
+    transport_message* tm = m->tm;
+    uint32_t           key[RT_KEY_WORDS], hash, slot, *pos;
+    rt_query*          q;
     int                ret = -1;
 
     if (flushing) {
@@ -185,134 +497,62 @@ int response_time_indexer(const dns_message* m)
 
     dfprintf(1, "response_time: %s %u %s", m->qr ? "response" : "query", m->id, m->qname);
 
-    if (!theHash) {
-        theHash = hash_create(MAX_ARRAY_SZ, (hashfunc*)_hash, (hashkeycmp*)_cmp, 0, 0, 0);
-        if (!theHash)
-            return INTERNAL_ERROR;
+    if (m->qr && (tm->query_ts.tv_sec || tm->query_ts.tv_usec)) {
+        // the query time came with the response, e.g. from dnstap, so any
+        // pending query is only looked up to drop it
+        if (num_queries) {
+            rt_key(m, key);
+            if ((slot = *rt_find(key, hash_keyed(key, sizeof(key)))))
+                rt_remove(slot);
+        }
+        return rt_response_index(&tm->query_ts, &tm->ts);
     }
 
-    q.m     = *m;
-    q.tm    = *tm;
-    q.m.tm  = &q.tm;
-    q.m.tld = 0;
+    if (!table && !rt_init()) {
+        dfprint(1, "response_time: failed to alloc pending queries");
+        return INTERNAL_ERROR;
+    }
 
-    obj = hash_find(&q, theHash);
+    rt_key(m, key);
+    hash = hash_keyed(key, sizeof(key));
+    pos  = rt_find(key, hash);
+    slot = *pos;
 
     if (m->qr) {
-        struct timeval diff;
-        unsigned long  us;
-        int            iter;
+        struct timeval qts;
+        uint32_t       qname_hash;
 
-        if (!obj) {
+        if (!slot) {
             // got a response without a query,
             dfprint(1, "response_time: missing query for response");
             return MISSING_QUERY;
         }
 
-        // TODO: compare more?
-        // - qclass/qtype, qname
-
-        // found query, remove and calculate index
-        if (obj->prev)
-            obj->prev->next = obj->next;
-        if (obj->next)
-            obj->next->prev = obj->prev;
-        if (obj == qfirst)
-            qfirst = obj->next;
-        if (obj == qlast)
-            qlast = obj->prev;
-        hash_remove(obj, theHash);
-        num_queries--;
-
-        q      = *obj;
-        q.m.tm = &q.tm;
-        xfree(obj);
-
-        diff.tv_sec  = tm->ts.tv_sec - q.tm.ts.tv_sec;
-        diff.tv_usec = tm->ts.tv_usec - q.tm.ts.tv_usec;
-        if (diff.tv_usec >= 1000000) {
-            diff.tv_sec += 1;
-            diff.tv_usec -= 1000000;
-        } else if (diff.tv_usec < 0) {
-            diff.tv_sec -= 1;
-            diff.tv_usec += 1000000;
-        }
-
-        if (diff.tv_sec < 0 || diff.tv_usec < 0) {
-            dfprintf(1, "response_time: bad diff " PRItime ", " PRItime " - " PRItime, diff.tv_sec, diff.tv_usec, q.tm.ts.tv_sec, q.tm.ts.tv_usec, tm->ts.tv_sec, tm->ts.tv_usec);
-            return INTERNAL_ERROR;
-        }
-        if (diff.tv_sec >= max_sec) {
-            switch (max_sec_mode) {
-            case response_time_ceil:
-                dfprintf(2, "response_time: diff " PRItime " ceiled to " PRItime, diff.tv_sec, diff.tv_usec, max_sec, 0L);
-                diff.tv_sec  = max_sec;
-                diff.tv_usec = 0;
-                break;
-            case response_time_timed_out:
-                dfprintf(1, "response_time: diff " PRItime " too old, timed out", diff.tv_sec, diff.tv_usec);
-                return TIMED_OUT;
-            default:
-                dfprint(1, "response_time: bad max_sec_mode");
-                return INTERNAL_ERROR;
-            }
+        q          = &pool[slot - 1];
+        qname_hash = rt_qname_hash(m);
+        if (q->qname_hash && qname_hash && q->qname_hash != qname_hash) {
+            // same id but not the same question, leave the query pending
+            dfprint(1, "response_time: qname of response does not match query");
+            return MISSING_QUERY;
         }
 
-        us = (diff.tv_sec * 1000000) + diff.tv_usec;
-        switch (mode) {
-        case response_time_bucket:
-            iter = FIRST_BUCKET + (us / bucket_size);
-            dfprintf(2, "response_time: found q/r us:%lu, put in bucket %d (%lu-%lu usec)", us, iter, (us / bucket_size) * bucket_size, ((us / bucket_size) + 1) * bucket_size);
-            break;
-        case response_time_log10: {
-            double d = log10((double)us);
-            if (d < 0) {
-                dfprintf(1, "response_time: bad log10(%lu) ret %f", us, d);
-                return INTERNAL_ERROR;
-            }
-            iter = FIRST_BUCKET + (int)d;
-            dfprintf(2, "response_time: found q/r us:%lu, log10 %d (%.0f-%.0f usec)", us, iter, pow(10, (int)d), pow(10, (int)d + 1));
-            break;
-        }
-        case response_time_log2: {
-            double d = log2((double)us);
-            if (d < 0) {
-                dfprintf(1, "response_time: bad log2(%lu) ret %f", us, d);
-                return INTERNAL_ERROR;
-            }
-            iter = FIRST_BUCKET + (int)d;
-            dfprintf(2, "response_time: found q/r us:%lu, log2 %d (%.0f-%.0f usec)", us, iter, pow(2, (int)d), pow(2, (int)d + 1));
-            break;
-        }
-        default:
-            dfprint(1, "response_time: bad mode");
-            return INTERNAL_ERROR;
-        }
+        // found query, remove and calculate index
+        qts.tv_sec  = q->ts_sec;
+        qts.tv_usec = q->ts_usec;
+        rt_remove(slot);
 
-        if (iter > max_iter)
-            max_iter = iter;
-        return iter;
+        return rt_response_index(&qts, &tm->ts);
     }
 
-    if (obj) {
-        // Found another query in the hash so the old one have timed out,
-        // reuse the obj for the new query
-        obj->tm.ts = tm->ts;
-        if (obj != qlast) {
-            if (obj->prev)
-                obj->prev->next = obj->next;
-            if (obj->next) {
-                if (obj == qfirst)
-                    qfirst = obj->next;
-                obj->next->prev = obj->prev;
-            }
-            obj->prev = qlast;
-            obj->next = 0;
-            assert(qlast);
-            qlast->next = obj;
-            qlast       = obj;
+    if (slot) {
+        // Found another query pending so the old one have timed out,
+        // reuse the slot for the new query
+        rt_fill(&pool[slot - 1], m);
+        if (slot != qlast) {
+            rt_fifo_unlink(slot);
+            rt_fifo_append(slot);
         }
-        dfprintf(1, "response_time: reuse %p, timed out", obj);
+        dfprintf(1, "response_time: reuse %u, timed out", slot);
         return TIMED_OUT;
     }
 
@@ -320,7 +560,7 @@ int response_time_indexer(const dns_message* m)
         // We're at max, see if we can time out the oldest query
         ret = TIMED_OUT;
         assert(qfirst);
-        if (tm->ts.tv_sec - qfirst->tm.ts.tv_sec < max_sec) {
+        if (tm->ts.tv_sec - (time_t)pool[qfirst - 1].ts_sec < max_sec) {
             // no, so what to do?
             switch (full_mode) {
             case response_time_drop_query:
@@ -336,46 +576,31 @@ int response_time_indexer(const dns_message* m)
             }
         }
 
-        // remove oldest obj from hash and reuse it
-        obj    = qfirst;
-        qfirst = obj->next;
-        if (qfirst)
-            qfirst->prev = 0;
-        hash_remove(obj, theHash);
-        num_queries--;
-        dfprintf(1, "response_time: reuse %p, too old", obj);
-    } else {
-        obj = xcalloc(1, sizeof(*obj));
-        if (!obj) {
-            dfprint(1, "response_time: failed to alloc obj");
-            return INTERNAL_ERROR;
-        }
+        // remove oldest query and reuse its slot, entries may have moved
+        dfprintf(1, "response_time: reuse %u, too old", qfirst);
+        rt_remove(qfirst);
+        pos = rt_find(key, hash);
     }
 
-    *obj      = q;
-    obj->m.tm = &obj->tm;
-    if (hash_add(obj, obj, theHash)) {
-        xfree(obj);
-        dfprint(1, "response_time: failed to add to hash");
+    if (!(slot = rt_alloc())) {
+        dfprint(1, "response_time: no free slot");
         return INTERNAL_ERROR;
     }
-
-    obj->prev = qlast;
-    obj->next = 0;
-    if (qlast)
-        qlast->next = obj;
-    qlast = obj;
-    if (!qfirst)
-        qfirst = obj;
+    q = &pool[slot - 1];
+    memcpy(q->key, key, sizeof(q->key));
+    q->hash = hash;
+    rt_fill(q, m);
+    *pos = slot;
+    rt_fifo_append(slot);
     num_queries++;
-    dfprintf(2, "response_time: add %p, %zu/%zu queries", obj, num_queries, max_queries);
+    dfprintf(2, "response_time: add %u, %zu/%zu queries", slot, num_queries, max_queries);
 
     return ret;
 }
 
 int response_time_iterator(const char** label)
 {
-    char label_buf[128];
+    static char label_buf[128];
 
     if (!label) {
         next_iter = 0;
@@ -403,19 +628,10 @@ int response_time_iterator(const char** label)
             return -1;
         }
     } else {
-        switch (mode) {
-        case response_time_bucket:
-            snprintf(label_buf, 128, "%d-%d", (next_iter - FIRST_BUCKET) * bucket_size, (next_iter - FIRST_BUCKET + 1) * bucket_size);
-            break;
-        case response_time_log10:
-            snprintf(label_buf, 128, "%.0f-%.0f", pow(10, next_iter - FIRST_BUCKET), pow(10, next_iter - FIRST_BUCKET + 1));
-            break;
-        case response_time_log2:
-            snprintf(label_buf, 128, "%.0f-%.0f", pow(2, next_iter - FIRST_BUCKET), pow(2, next_iter - FIRST_BUCKET + 1));
-            break;
-        default:
-            return -1;
-        }
+        unsigned long lo, hi;
+
+        rt_range(next_iter, &lo, &hi);
+        snprintf(label_buf, 128, "%lu-%lu", lo, hi);
         *label = label_buf;
     }
 
@@ -427,39 +643,58 @@ void response_time_reset()
     max_iter = INTERNAL_ERROR;
 }
 
-static struct query* flushed_obj = 0;
+void response_time_summary(const int* counts, int n, md_array_printer* pr, void* fp)
+{
+    static const struct {
+        const char*   label;
+        unsigned long ppm; // parts per million
+    } pct[] = {
+        { "p50", 500000 },
+        { "p90", 900000 },
+        { "p99", 990000 },
+        { "p999", 999000 },
+    };
+    unsigned long total = 0, seen = 0, lo, hi;
+    size_t        p     = 0;
+    int           i;
+
+    if (!percentiles)
+        return;
+
+    for (i = FIRST_BUCKET; i < n; i++)
+        total += counts[i];
+    if (!total)
+        return;
+
+    for (i = FIRST_BUCKET; i < n && p < sizeof(pct) / sizeof(pct[0]); i++) {
+        seen += counts[i];
+        // highest value of the bucket holding the percentile
+        while (p < sizeof(pct) / sizeof(pct[0]) && seen * 1000000 >= total * pct[p].ppm) {
+            rt_range(i, &lo, &hi);
+            pr->print_element(fp, pct[p].label, (int)(hi - 1));
+            p++;
+        }
+    }
+}
 
 const dns_message* response_time_flush(enum flush_mode fm)
 {
     switch (fm) {
     case flush_get:
-        if (qfirst && last_ts.tv_sec - qfirst->tm.ts.tv_sec >= max_sec) {
-            dfprintf(2, "response_time: flush_get old %p, new %p", flushed_obj, qfirst);
-
-            if (flushed_obj)
-                xfree(flushed_obj);
-
-            flushed_obj = qfirst;
-            qfirst      = flushed_obj->next;
-            if (qfirst)
-                qfirst->prev = 0;
-            if (flushed_obj == qlast)
-                qlast = 0;
-            hash_remove(flushed_obj, theHash);
-            num_queries--;
-            return &flushed_obj->m;
+        if (qfirst && last_ts.tv_sec - (time_t)pool[qfirst - 1].ts_sec >= max_sec) {
+            dfprintf(2, "response_time: flush_get %u", qfirst);
+
+            rt_message(&pool[qfirst - 1], &flushed_m, &flushed_tm);
+            rt_remove(qfirst);
+            return &flushed_m;
         }
         break;
     case flush_on:
-        dfprintf(2, "response_time: flush_on %p", flushed_obj);
+        dfprint(2, "response_time: flush_on");
         flushing = 1;
         break;
     case flush_off:
-        dfprintf(2, "response_time: flush_off %p", flushed_obj);
-        if (flushed_obj) {
-            xfree(flushed_obj);
-            flushed_obj = 0;
-        }
+        dfprint(2, "response_time: flush_off");
         flushing = 0;
         break;
     default:
@@ -468,3 +703,79 @@ const dns_message* response_time_flush(enum flush_mode fm)
 
     return 0;
 }
+
+/*
+ * Checkpoint of the pending queries, oldest first
+ */
+
+typedef struct
+{
+    uint32_t record_size;
+    uint32_t count;
+} rt_checkpoint;
+
+void response_time_checkpoint(checkpoint* c)
+{
+    rt_checkpoint h;
+    uint32_t      slot;
+
+    h.record_size = sizeof(rt_query);
+    h.count       = num_queries;
+    checkpoint_write(c, &h, sizeof(h));
+    for (slot = qfirst; slot; slot = pool[slot - 1].next)
+        checkpoint_write(c, &pool[slot - 1], sizeof(rt_query));
+}
+
+/*
+ * Check that a checkpoint of pending queries can be restored, returns 1
+ * if it can
+ */
+int response_time_verify(const void* data, size_t size)
+{
+    rt_checkpoint h;
+
+    if (size < sizeof(h))
+        return 0;
+    memcpy(&h, data, sizeof(h));
+    return h.record_size == sizeof(rt_query) && (size - sizeof(h)) / sizeof(rt_query) == h.count && !((size - sizeof(h)) % sizeof(rt_query));
+}
+
+void response_time_restore(const void* data, size_t size)
+{
+    const unsigned char* p = data;
+    rt_checkpoint        h;
+    rt_query             q;
+    uint32_t             i, slot, *pos;
+    time_t               now      = time(NULL);
+    size_t               restored = 0;
+
+    if (size < sizeof(h))
+        return;
+    memcpy(&h, p, sizeof(h));
+    p += sizeof(h);
+    if (h.record_size != sizeof(rt_query) || (size - sizeof(h)) / sizeof(rt_query) < h.count) {
+        dsyslog(LOG_ERR, "response_time: checkpoint of pending queries does not match, not restored");
+        return;
+    }
+    if (!table && !rt_init()) {
+        dsyslog(LOG_ERR, "response_time: failed to alloc pending queries, not restored");
+        return;
+    }
+
+    // the newest are kept if there is no room for all
+    for (i = h.count > max_queries ? h.count - max_queries : 0; i < h.count; i++) {
+        memcpy(&q, p + (size_t)i * sizeof(q), sizeof(q));
+        if (now - (time_t)q.ts_sec >= max_sec)
+            continue;
+        q.hash = hash_keyed(q.key, sizeof(q.key));
+        pos    = rt_find(q.key, q.hash);
+        if (*pos || num_queries >= max_queries || !(slot = rt_alloc()))
+            continue;
+        pool[slot - 1] = q;
+        *pos           = slot;
+        rt_fifo_append(slot);
+        num_queries++;
+        restored++;
+    }
+    dsyslogf(LOG_INFO, "response_time: restored %zu of %u pending queries", restored, h.count);
+}
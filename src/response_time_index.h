@@ -38,11 +38,13 @@
 #define __dsc_response_time_index_h
 
 #include "dns_message.h"
+#include "checkpoint.h"
 
 enum response_time_mode {
     response_time_bucket,
     response_time_log10,
-    response_time_log2
+    response_time_log2,
+    response_time_hdr
 };
 
 enum response_time_max_sec_mode {
@@ -61,10 +63,16 @@ void response_time_set_max_sec_mode(enum response_time_max_sec_mode m);
 void response_time_set_bucket_size(unsigned int s);
 void response_time_set_max_queries(size_t q);
 void response_time_set_full_mode(enum response_time_full_mode m);
+void response_time_set_significant_digits(unsigned int d);
+void response_time_set_percentiles(int p);
 
 int                response_time_indexer(const dns_message*);
 int                response_time_iterator(const char** label);
 void               response_time_reset(void);
 const dns_message* response_time_flush(enum flush_mode mode);
+void               response_time_summary(const int* counts, int n, md_array_printer* pr, void* fp);
+void               response_time_checkpoint(checkpoint* c);
+int                response_time_verify(const void* data, size_t size);
+void               response_time_restore(const void* data, size_t size);
 
 #endif /* __dsc_response_time_index_h */
@@ -40,10 +40,12 @@
 #include "xmalloc.h"
 #include "hashtbl.h"
 #include "inX_addr.h"
+#include "v4_table.h"
 
 #define MAX_ARRAY_SZ 65536
 static hashtbl* theHash  = NULL;
 static int      next_idx = 0;
+static v4_table v4       = V4_TABLE_INIT;
 
 typedef struct
 {
@@ -55,16 +57,22 @@ int sip_indexer(const dns_message* m)
 {
     ipaddrobj* obj;
     inX_addr*  server_ip_addr = m->qr ? &m->tm->src_ip_addr : &m->tm->dst_ip_addr;
+    void**     slot;
 
     if (m->malformed)
         return -1;
+    if ((slot = v4_table_slot(&v4, server_ip_addr)) && *slot)
+        return ((ipaddrobj*)*slot)->index;
     if (NULL == theHash) {
         theHash = hash_create(MAX_ARRAY_SZ, (hashfunc*)inXaddr_hash, (hashkeycmp*)inXaddr_cmp, 1, NULL, afree);
         if (NULL == theHash)
             return -1;
     }
-    if ((obj = hash_find(server_ip_addr, theHash)))
+    if ((obj = hash_find(server_ip_addr, theHash))) {
+        if (slot)
+            *slot = obj;
         return obj->index;
+    }
     obj = acalloc(1, sizeof(*obj));
     if (NULL == obj)
         return -1;
@@ -75,6 +83,8 @@ int sip_indexer(const dns_message* m)
         return -1;
     }
     next_idx++;
+    if (slot)
+        *slot = obj;
     return obj->index;
 }
 
@@ -99,4 +109,5 @@ void sip_reset()
 {
     theHash  = NULL;
     next_idx = 0;
+    v4_table_reset(&v4);
 }
@@ -0,0 +1,280 @@
+/*
+ * Copyright (c) 2008-2023, OARC, Inc.
+ * Copyright (c) 2007-2008, Internet Systems Consortium, Inc.
+ * Copyright (c) 2003-2007, The Measurement Factory, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Generate DNSTAP over a UNIX socket to benchmark reading it, the frames
+ * of a DNSTAP file are sent over and over as a bidirectional Frame Streams
+ * connection
+ *
+ *   make bench_dnstap
+ *   dsc -f CONF    (with dnstap_unixsock SOCKET and optionally dnstap_threads)
+ *   ./bench_dnstap FILE.dnstap SOCKET [ FRAMES [ CONNECTIONS ] ]
+ *
+ * A connection ends when dsc answers STOP with FINISH, so the frames/s
+ * is how fast dsc read them. CONF needs no_wait_interval, otherwise dsc
+ * sleeps until the next interval starts and that is what gets measured.
+ * With dnstap_threads the last frames may still be queued for the main
+ * loop at FINISH, use dump_reports_on_exit and check the counts.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+
+#define FSTRM_CONTROL_ACCEPT 0x01
+#define FSTRM_CONTROL_START 0x02
+#define FSTRM_CONTROL_STOP 0x03
+#define FSTRM_CONTROL_READY 0x04
+#define FSTRM_CONTROL_FINISH 0x05
+#define FSTRM_CONTROL_FIELD_CONTENT_TYPE 0x01
+
+#define CONTENT_TYPE "protobuf:dnstap.Dnstap"
+#define WBUF_SIZE (64 * 1024)
+
+struct frame {
+    uint32_t len;
+    uint8_t* data;
+};
+
+static struct frame* frames  = 0;
+static size_t        nframes = 0;
+
+static int read_be32(FILE* fp, uint32_t* v)
+{
+    if (fread(v, 4, 1, fp) != 1)
+        return -1;
+    *v = ntohl(*v);
+    return 0;
+}
+
+static int load_file(const char* file)
+{
+    FILE*    fp = fopen(file, "r");
+    uint32_t len;
+    size_t   alloc = 0;
+
+    if (!fp) {
+        fprintf(stderr, "%s: %s\n", file, strerror(errno));
+        return -1;
+    }
+    // data frames until the STOP control frame, START is skipped
+    while (!read_be32(fp, &len)) {
+        if (!len) {
+            if (read_be32(fp, &len) || fseek(fp, len, SEEK_CUR))
+                break;
+            continue;
+        }
+        if (nframes == alloc) {
+            alloc  = alloc ? alloc * 2 : 1024;
+            frames = realloc(frames, alloc * sizeof(*frames));
+        }
+        if (!frames || !(frames[nframes].data = malloc(len)) || fread(frames[nframes].data, len, 1, fp) != 1) {
+            fprintf(stderr, "%s: unable to read frame\n", file);
+            fclose(fp);
+            return -1;
+        }
+        frames[nframes++].len = len;
+    }
+    fclose(fp);
+    return nframes ? 0 : -1;
+}
+
+static int write_all(int fd, const void* buf, size_t len)
+{
+    const uint8_t* p = buf;
+    ssize_t        n;
+
+    while (len) {
+        if ((n = write(fd, p, len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int send_control(int fd, uint32_t type, int content_type)
+{
+    uint32_t buf[5];
+    size_t   n = 0, clen = sizeof(CONTENT_TYPE) - 1;
+
+    buf[n++] = 0;
+    buf[n++] = htonl(4 + (content_type ? 8 + clen : 0));
+    buf[n++] = htonl(type);
+    if (content_type) {
+        buf[n++] = htonl(FSTRM_CONTROL_FIELD_CONTENT_TYPE);
+        buf[n++] = htonl(clen);
+    }
+    if (write_all(fd, buf, n * 4))
+        return -1;
+    return content_type ? write_all(fd, CONTENT_TYPE, clen) : 0;
+}
+
+static int wait_control(int fd, uint32_t type)
+{
+    uint32_t hdr[3];
+    char     skip[256];
+    size_t   r = 0;
+    ssize_t  n;
+
+    while (r < sizeof(hdr)) {
+        if ((n = read(fd, (char*)hdr + r, sizeof(hdr) - r)) <= 0)
+            return -1;
+        r += n;
+    }
+    if (hdr[0] || ntohl(hdr[1]) < 4 || ntohl(hdr[1]) - 4 > sizeof(skip) || ntohl(hdr[2]) != type)
+        return -1;
+    for (r = ntohl(hdr[1]) - 4; r; r -= n) {
+        if ((n = read(fd, skip, r)) <= 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int run(const char* sock, size_t count)
+{
+    struct sockaddr_un addr;
+    static uint8_t     wbuf[WBUF_SIZE];
+    size_t             used = 0, i;
+    int                fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, sock, sizeof(addr.sun_path) - 1);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+        fprintf(stderr, "%s: %s\n", sock, strerror(errno));
+        return -1;
+    }
+
+    if (send_control(fd, FSTRM_CONTROL_READY, 1) || wait_control(fd, FSTRM_CONTROL_ACCEPT)
+        || send_control(fd, FSTRM_CONTROL_START, 1)) {
+        fprintf(stderr, "%s: handshake failed\n", sock);
+        close(fd);
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        const struct frame* f = &frames[i % nframes];
+        uint32_t            len;
+
+        if (used + 4 + f->len > sizeof(wbuf)) {
+            if (write_all(fd, wbuf, used))
+                break;
+            used = 0;
+        }
+        if (4 + f->len > sizeof(wbuf)) {
+            len = htonl(f->len);
+            if (write_all(fd, &len, 4) || write_all(fd, f->data, f->len))
+                break;
+            continue;
+        }
+        len = htonl(f->len);
+        memcpy(wbuf + used, &len, 4);
+        memcpy(wbuf + used + 4, f->data, f->len);
+        used += 4 + f->len;
+    }
+    if (i < count || (used && write_all(fd, wbuf, used))) {
+        fprintf(stderr, "%s: write failed: %s\n", sock, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    if (send_control(fd, FSTRM_CONTROL_STOP, 0) || wait_control(fd, FSTRM_CONTROL_FINISH)) {
+        fprintf(stderr, "%s: no FINISH after STOP\n", sock);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+int main(int argc, const char* argv[])
+{
+    struct timeval start, end;
+    size_t         count = 1000000, conns = 1, i;
+    double         secs, bytes = 0;
+    int            failed = 0, status;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s FILE.dnstap SOCKET [ FRAMES [ CONNECTIONS ] ]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 3)
+        count = strtoul(argv[3], 0, 10);
+    if (argc > 4)
+        conns = strtoul(argv[4], 0, 10);
+    if (load_file(argv[1]) || !count || !conns)
+        return 1;
+    for (i = 0; i < count; i++)
+        bytes += 4 + frames[i % nframes].len;
+
+    gettimeofday(&start, 0);
+    for (i = 0; i < conns; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (!pid)
+            _exit(run(argv[2], count) ? 1 : 0);
+    }
+    while (wait(&status) > 0) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status))
+            failed++;
+    }
+    gettimeofday(&end, 0);
+
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+    printf("%zu connections, %zu frames each (%zu from file), %.3f seconds\n", conns, count, nframes, secs);
+    printf("%.0f frames/s, %.1f MB/s\n", conns * count / secs, conns * bytes / secs / 1000000);
+    if (failed)
+        printf("%d connections failed\n", failed);
+    return failed ? 1 : 0;
+}
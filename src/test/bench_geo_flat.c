@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2008-2023, OARC, Inc.
+ * Copyright (c) 2007-2008, Internet Systems Consortium, Inc.
+ * Copyright (c) 2003-2007, The Measurement Factory, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Benchmark lookups in a flattened MaxMind database against libmaxminddb
+ *
+ *   make bench_geo_flat
+ *   ./bench_geo_flat FILE.mmdb [ country | asn ] [ LOOKUPS ]
+ */
+
+#include "config.h"
+
+#if defined(HAVE_LIBMAXMINDDB) && defined(HAVE_MAXMINDDB_H)
+#include "geo_flat.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+
+int debug_flag = 0;
+
+#ifdef HAVE_GEO_FLAT
+
+static const char* country_value(MMDB_entry_s* entry, char* buf, size_t len)
+{
+    MMDB_entry_data_s d;
+    size_t            n;
+
+    if (MMDB_get_value(entry, &d, "country", "iso_code", 0) != MMDB_SUCCESS || d.type != MMDB_DATA_TYPE_UTF8_STRING)
+        return NULL;
+    n = d.data_size > len - 1 ? len - 1 : d.data_size;
+    memcpy(buf, d.utf8_string, n);
+    buf[n] = 0;
+    return buf;
+}
+
+static const char* asn_value(MMDB_entry_s* entry, char* buf, size_t len)
+{
+    MMDB_entry_data_s d;
+
+    if (MMDB_get_value(entry, &d, "autonomous_system_number", 0) != MMDB_SUCCESS)
+        return NULL;
+    switch (d.type) {
+    case MMDB_DATA_TYPE_UINT16:
+        snprintf(buf, len, "%" PRIu16, d.uint16);
+        return buf;
+    case MMDB_DATA_TYPE_UINT32:
+        snprintf(buf, len, "%" PRIu32, d.uint32);
+        return buf;
+    default:
+        break;
+    }
+    return NULL;
+}
+
+static const char* mmdb_find(MMDB_s* mmdb, geo_flat_value_fn* value, const inX_addr* addr, char* buf, size_t len)
+{
+    struct sockaddr_in   s4;
+    struct sockaddr_in6  s6;
+    struct sockaddr*     s;
+    MMDB_lookup_result_s r;
+    int                  ret;
+
+    if (addr->family == AF_INET6) {
+        memset(&s6, 0, sizeof(s6));
+        s6.sin6_family = AF_INET6;
+        s6.sin6_addr   = addr->in6;
+        s              = (struct sockaddr*)&s6;
+    } else {
+        memset(&s4, 0, sizeof(s4));
+        s4.sin_family = AF_INET;
+        s4.sin_addr   = addr->in4;
+        s             = (struct sockaddr*)&s4;
+    }
+    r = MMDB_lookup_sockaddr(mmdb, s, &ret);
+    if (ret != MMDB_SUCCESS || !r.found_entry)
+        return NULL;
+    return value(&r.entry, buf, len);
+}
+
+static double elapsed(const struct timeval* start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+int main(int argc, char* argv[])
+{
+    geo_flat_value_fn* value = country_value;
+    geo_flat*          flat;
+    MMDB_s             mmdb;
+    inX_addr*          addrs;
+    size_t             lookups = 1000000, i, found = 0, differ = 0;
+    struct timeval     start;
+    double             t_mmdb, t_flat;
+    char               buf[64];
+    int                ret, v6;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s FILE.mmdb [ country | asn ] [ LOOKUPS ]\n", argv[0]);
+        return 2;
+    }
+    if (argc > 2 && !strcmp(argv[2], "asn"))
+        value = asn_value;
+    if (argc > 3)
+        lookups = strtoul(argv[3], NULL, 10);
+
+    if ((ret = MMDB_open(argv[1], 0, &mmdb)) != MMDB_SUCCESS) {
+        fprintf(stderr, "%s: %s\n", argv[1], MMDB_strerror(ret));
+        return 1;
+    }
+    v6 = mmdb.metadata.ip_version == 6;
+
+    gettimeofday(&start, NULL);
+    if (!(flat = geo_flat_build(argv[1], value, &ret))) {
+        fprintf(stderr, "%s: unable to flatten: %s\n", argv[1], MMDB_strerror(ret));
+        return 1;
+    }
+    printf("flattened in %.2f s\n", elapsed(&start));
+
+    /* half IPv4 and half IPv6 within 2000::/3 if the database has it */
+    if (!(addrs = calloc(lookups, sizeof(*addrs))))
+        return 1;
+    srandom(time(NULL));
+    for (i = 0; i < lookups; i++) {
+        if (v6 && (i & 1)) {
+            size_t j;
+            addrs[i].family = AF_INET6;
+            for (j = 0; j < 16; j++)
+                addrs[i].in6.s6_addr[j] = random();
+            addrs[i].in6.s6_addr[0] = 0x20 | (addrs[i].in6.s6_addr[0] & 0x1f);
+        } else {
+            addrs[i].family     = AF_INET;
+            addrs[i].in4.s_addr = random();
+        }
+    }
+
+    for (i = 0; i < lookups; i++) {
+        const char* a = mmdb_find(&mmdb, value, &addrs[i], buf, sizeof(buf));
+        const char* b = geo_flat_find(flat, &addrs[i]);
+        if (a)
+            found++;
+        if ((a == NULL) != (b == NULL) || (a && strcmp(a, b)))
+            differ++;
+    }
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < lookups; i++)
+        mmdb_find(&mmdb, value, &addrs[i], buf, sizeof(buf));
+    t_mmdb = elapsed(&start);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < lookups; i++)
+        geo_flat_find(flat, &addrs[i]);
+    t_flat = elapsed(&start);
+
+    printf("%zu lookups, %zu found, %zu differ\n", lookups, found, differ);
+    printf("libmaxminddb %.1f ns/lookup\n", t_mmdb * 1000000000.0 / lookups);
+    printf("flattened    %.1f ns/lookup\n", t_flat * 1000000000.0 / lookups);
+
+    geo_flat_free(flat);
+    MMDB_close(&mmdb);
+    free(addrs);
+    return differ ? 1 : 0;
+}
+
+#else
+
+int main(int argc, char* argv[])
+{
+    fprintf(stderr, "MaxMind DB flattening support not built in!\n");
+    return 2;
+}
+
+#endif
@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2008-2023, OARC, Inc.
+ * Copyright (c) 2007-2008, Internet Systems Consortium, Inc.
+ * Copyright (c) 2003-2007, The Measurement Factory, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Benchmark the hash tables with QNAMEs crafted to collide under the
+ * unkeyed lookup3 hash with a zero seed, as used before hash_keyed(),
+ * against the same number of random QNAMEs
+ *
+ *   make bench_hash
+ *   ./bench_hash [ NAMES [ ROUNDS ] ]
+ */
+
+#include "config.h"
+
+#include "hashtbl.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/time.h>
+
+#define MODULUS 65536
+
+int debug_flag = 0;
+
+static unsigned int unkeyed_hash(const void* key)
+{
+    return hashendian(key, strlen(key), 0);
+}
+
+static unsigned int keyed_hash(const void* key)
+{
+    return hash_keyed(key, strlen(key));
+}
+
+static int name_cmp(const void* a, const void* b)
+{
+    return strcasecmp(a, b);
+}
+
+static double elapsed(const struct timeval* start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+
+static void random_name(char* name)
+{
+    int i;
+
+    for (i = 0; i < 12; i++)
+        name[i] = chars[random() % (sizeof(chars) - 1)];
+    strcpy(name + 12, ".example.com");
+}
+
+/* next name in order, much faster than a random one when searching */
+static void next_name(char* name)
+{
+    int i;
+
+    for (i = 11; i >= 0; i--) {
+        const char* c = strchr(chars, name[i]);
+        if (c[1]) {
+            name[i] = c[1];
+            return;
+        }
+        name[i] = chars[0];
+    }
+}
+
+/*
+ * Insert all names and look each of them up rounds times, returns the
+ * nanoseconds per lookup
+ */
+static double run(hashfunc* hasher, char** names, size_t n, size_t rounds)
+{
+    hashtbl*       tbl;
+    struct timeval start;
+    size_t         i, r, found = 0;
+    double         t;
+
+    if (!(tbl = hash_create(MODULUS, hasher, name_cmp, 0, NULL, NULL)))
+        exit(1);
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++)
+        hash_add(names[i], names[i], tbl);
+    for (r = 0; r < rounds; r++)
+        for (i = 0; i < n; i++)
+            if (hash_find(names[i], tbl))
+                found++;
+    t = elapsed(&start);
+    hash_destroy(tbl);
+    if (found != n * rounds) {
+        fprintf(stderr, "only %zu of %zu found\n", found, n * rounds);
+        exit(1);
+    }
+    return t * 1000000000.0 / (n * rounds);
+}
+
+int main(int argc, char* argv[])
+{
+    size_t         n = 1000, rounds = 10, i;
+    char **        crafted, **plain;
+    char           name[32];
+    struct timeval start;
+
+    if (argc > 1)
+        n = strtoul(argv[1], NULL, 10);
+    if (argc > 2)
+        rounds = strtoul(argv[2], NULL, 10);
+    if (!n || !rounds) {
+        fprintf(stderr, "usage: %s [ NAMES [ ROUNDS ] ]\n", argv[0]);
+        return 2;
+    }
+
+    hash_seed();
+    srandom(time(NULL));
+    crafted = calloc(n, sizeof(*crafted));
+    plain   = calloc(n, sizeof(*plain));
+    if (!crafted || !plain)
+        return 1;
+
+    /* all in the same bucket of the unkeyed hash, like an attacker would */
+    gettimeofday(&start, NULL);
+    random_name(name);
+    for (i = 0; i < n; i++) {
+        if (!(crafted[i] = malloc(32)) || !(plain[i] = malloc(32)))
+            return 1;
+        do
+            next_name(name);
+        while (unkeyed_hash(name) % MODULUS);
+        strcpy(crafted[i], name);
+        random_name(plain[i]);
+    }
+    printf("crafted %zu colliding names in %.2f s\n", n, elapsed(&start));
+
+    printf("random names,  unkeyed %8.1f ns/lookup\n", run(unkeyed_hash, plain, n, rounds));
+    printf("random names,  keyed   %8.1f ns/lookup\n", run(keyed_hash, plain, n, rounds));
+    printf("crafted names, unkeyed %8.1f ns/lookup\n", run(unkeyed_hash, crafted, n, rounds));
+    printf("crafted names, keyed   %8.1f ns/lookup\n", run(keyed_hash, crafted, n, rounds));
+
+    for (i = 0; i < n; i++) {
+        free(crafted[i]);
+        free(plain[i]);
+    }
+    free(crafted);
+    free(plain);
+    return 0;
+}
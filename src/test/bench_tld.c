@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2008-2023, OARC, Inc.
+ * Copyright (c) 2007-2008, Internet Systems Consortium, Inc.
+ * Copyright (c) 2003-2007, The Measurement Factory, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Benchmark the TLD list trie against a hash of the TLD list entries, as
+ * the list was kept before it was compiled into the trie
+ *
+ *   make bench_tld
+ *   ./bench_tld [ public_suffix_list.dat [ LOOKUPS ] ]
+ *
+ * The ASCII rules of the Public Suffix List are loaded like dsc-psl-convert
+ * --all would convert them. Two things are measured:
+ * - finding entries of the list and entries with an extra label in front
+ *   of them, with one lookup in the hash and with tld_list_find()
+ * - finding the registered suffix of names "www.host.<entry>" like
+ *   dns_message_QnameToNld() does, with one hash lookup per suffix as
+ *   before the trie and with one tld_list_walk() per label
+ */
+
+#include "config.h"
+
+#include "tld_list.h"
+#include "hashtbl.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/time.h>
+
+#define MAX_ENTRIES 65536
+#define MAX_NAME_SZ 256
+
+int debug_flag = 0;
+
+typedef struct
+{
+    char* name;
+    int   flags;
+} hashed_entry;
+
+static hashtbl* hashed_entries = NULL;
+
+static unsigned int hashed_hashfunc(const void* key)
+{
+    return hash_keyed(key, strlen(key));
+}
+
+static int hashed_cmpfunc(const void* a, const void* b)
+{
+    return strcasecmp(a, b);
+}
+
+static int hashed_add_one(const char* name, int flags)
+{
+    hashed_entry* e;
+
+    if ((e = hash_find(name, hashed_entries))) {
+        e->flags |= flags;
+        return 0;
+    }
+    if (!(e = malloc(sizeof(*e))) || !(e->name = strdup(name)))
+        return -1;
+    e->flags = flags;
+    return hash_add(e->name, e, hashed_entries);
+}
+
+/* add the entry and its suffixes the same way tld_list_add() does */
+static int hashed_add(const char* tld)
+{
+    const char* e     = tld + strlen(tld) - 1;
+    const char* t;
+    int         state = 0;
+
+    if (!hashed_entries && !(hashed_entries = hash_create(MAX_ENTRIES, hashed_hashfunc, hashed_cmpfunc, 0, NULL, NULL)))
+        return -1;
+    while (*e == '.' && e > tld)
+        e--;
+    for (t = e; t > tld;) {
+        t--;
+        if ('.' == *t) {
+            if (0 == state && hashed_add_one(t + 1, TLD_LIST_HAS_CHILDREN))
+                return -1;
+            state = 1;
+        } else {
+            state = 0;
+        }
+    }
+    while (*t == '.' && t < e)
+        t++;
+    return hashed_add_one(t, TLD_LIST_IS_TLD);
+}
+
+static int hashed_find(const char* name)
+{
+    hashed_entry* e = hash_find(name, hashed_entries);
+
+    return e ? e->flags : 0;
+}
+
+static double elapsed(const struct timeval* start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+/*
+ * Offset of the registered suffix in name, or -1, using one lookup of each
+ * suffix of the name in the hash
+ */
+static int hashed_suffix(const char* name)
+{
+    const char* t  = name + strlen(name);
+    const char* lt = NULL;
+    int         r;
+
+    while (--t > name) {
+        if ('.' != *t)
+            continue;
+        r = hashed_find(t + 1);
+        if (r & TLD_LIST_IS_TLD)
+            lt = t + 1;
+        if (!(r & TLD_LIST_HAS_CHILDREN))
+            break;
+    }
+    return lt ? lt - name : -1;
+}
+
+/* same as hashed_suffix() using one walk of each label in the trie */
+static int trie_suffix(const char* name)
+{
+    const char*  e  = name + strlen(name);
+    const char*  t  = e;
+    const char*  lt = NULL;
+    unsigned int node = TLD_LIST_ROOT;
+    int          r;
+
+    while (--t > name) {
+        if ('.' != *t)
+            continue;
+        r = tld_list_walk(&node, t + 1, e - (t + 1));
+        e = t;
+        if (r & TLD_LIST_IS_TLD)
+            lt = t + 1;
+        if (!(r & TLD_LIST_HAS_CHILDREN))
+            break;
+    }
+    return lt ? lt - name : -1;
+}
+
+/*
+ * Look up all names, returns the nanoseconds per lookup and the sum of the
+ * results in sum
+ */
+static double run(int (*lookup)(const char*), char** names, size_t lookups, const size_t* order, unsigned long* sum)
+{
+    struct timeval start;
+    size_t         i;
+
+    *sum = 0;
+    gettimeofday(&start, NULL);
+    for (i = 0; i < lookups; i++)
+        *sum += lookup(names[order[i]]);
+    return elapsed(&start) * 1000000000.0 / lookups;
+}
+
+int main(int argc, char* argv[])
+{
+    const char*   file    = "test/public_suffix_list.dat";
+    size_t        lookups = 5000000, n = 0, i;
+    char          line[MAX_NAME_SZ];
+    char**        names;
+    size_t *      order, *sfx_order;
+    FILE*         fp;
+    unsigned long hashed_sum, trie_sum, hashed_suffix_sum, trie_suffix_sum;
+    double        hashed, trie, hashed_sfx, trie_sfx;
+
+    if (argc > 1)
+        file = argv[1];
+    if (argc > 2)
+        lookups = strtoul(argv[2], NULL, 10);
+    if (!lookups) {
+        fprintf(stderr, "usage: %s [ public_suffix_list.dat [ LOOKUPS ] ]\n", argv[0]);
+        return 2;
+    }
+    if (!(fp = fopen(file, "r"))) {
+        perror(file);
+        return 1;
+    }
+    if (!(names = calloc(MAX_ENTRIES * 3, sizeof(*names))) || !(order = calloc(lookups, sizeof(*order)))
+        || !(sfx_order = calloc(lookups, sizeof(*sfx_order))))
+        return 1;
+
+    while (n < MAX_ENTRIES && fgets(line, sizeof(line), fp)) {
+        char *p = line, *e;
+        for (e = p; *e && *e != '\n' && *e != ' ' && *e != '\t' && *e != '\r'; e++) {
+            if (*e & 0x80)
+                break;
+        }
+        if (*e & 0x80 || e == p || !strncmp(p, "//", 2))
+            continue;
+        *e = 0;
+        if (*p == '!')
+            p++;
+        else if (!strncmp(p, "*.", 2))
+            p += 2;
+        tld_list_add(p);
+        if (hashed_add(p))
+            return 1;
+        if (!(names[n * 3] = strdup(p)) || !(names[n * 3 + 1] = malloc(strlen(p) + 6)) || !(names[n * 3 + 2] = malloc(strlen(p) + 10)))
+            return 1;
+        sprintf(names[n * 3 + 1], "host.%s", p);
+        sprintf(names[n * 3 + 2], "www.host.%s", p);
+        n++;
+    }
+    fclose(fp);
+    if (!n) {
+        fprintf(stderr, "no entries in %s\n", file);
+        return 1;
+    }
+
+    srandom(time(NULL));
+    for (i = 0; i < lookups; i++) {
+        size_t entry = random() % n;
+        order[i]     = entry * 3 + random() % 2;
+        sfx_order[i] = entry * 3 + 2;
+    }
+
+    if (!tld_list_compile()) {
+        fprintf(stderr, "unable to compile the TLD list\n");
+        return 1;
+    }
+    hashed     = run(hashed_find, names, lookups, order, &hashed_sum);
+    hashed_sfx = run(hashed_suffix, names, lookups, sfx_order, &hashed_suffix_sum);
+    trie_sfx   = run(trie_suffix, names, lookups, sfx_order, &trie_suffix_sum);
+    trie       = run(tld_list_find, names, lookups, order, &trie_sum);
+    if (hashed_sum != trie_sum || hashed_suffix_sum != trie_suffix_sum) {
+        fprintf(stderr, "results differ\n");
+        return 1;
+    }
+    printf("%zu entries, %zu lookups\n", n, lookups);
+    printf("find,   hashed %8.1f ns/lookup\n", hashed);
+    printf("find,   trie   %8.1f ns/lookup\n", trie);
+    printf("suffix, hashed %8.1f ns/lookup\n", hashed_sfx);
+    printf("suffix, trie   %8.1f ns/lookup\n", trie_sfx);
+
+    for (i = 0; i < n * 3; i++)
+        free(names[i]);
+    free(names);
+    free(order);
+    free(sfx_order);
+    return 0;
+}
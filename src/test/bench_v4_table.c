@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2008-2023, OARC, Inc.
+ * Copyright (c) 2007-2008, Internet Systems Consortium, Inc.
+ * Copyright (c) 2003-2007, The Measurement Factory, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Benchmark finding IPv4 clients in the direct indexed v4_table against
+ * the hash table the client and server address indexers use
+ *
+ *   make bench_v4_table
+ *   ./bench_v4_table [ ADDRESSES [ PREFIXES [ LOOKUPS ] ] ]
+ *
+ * ADDRESSES random addresses spread over PREFIXES random /16s are looked up
+ * LOOKUPS times in random order.
+ */
+
+#include "config.h"
+
+#include "v4_table.h"
+#include "hashtbl.h"
+#include "xmalloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#define MAX_ARRAY_SZ 65536
+
+int debug_flag = 0;
+
+typedef struct
+{
+    inX_addr addr;
+    int      index;
+} ipaddrobj;
+
+static double elapsed(const struct timeval* start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+/* same as the indexers, returns the index or -1 */
+static int hashed_index(hashtbl* tbl, const inX_addr* a, int* next_idx)
+{
+    ipaddrobj* obj;
+
+    if ((obj = hash_find(a, tbl)))
+        return obj->index;
+    if (NULL == (obj = acalloc(1, sizeof(*obj))))
+        return -1;
+    obj->addr  = *a;
+    obj->index = *next_idx;
+    if (0 != hash_add(&obj->addr, obj, tbl))
+        return -1;
+    return (*next_idx)++;
+}
+
+static int table_index(v4_table* t, hashtbl* tbl, const inX_addr* a, int* next_idx)
+{
+    void** slot;
+    int    idx;
+
+    if ((slot = v4_table_slot(t, a)) && *slot)
+        return ((ipaddrobj*)*slot)->index;
+    if ((idx = hashed_index(tbl, a, next_idx)) >= 0 && slot)
+        *slot = hash_find(a, tbl);
+    return idx;
+}
+
+/*
+ * Index all lookups, returns the nanoseconds per lookup and the sum of the
+ * indexes in sum
+ */
+static double run(inX_addr* addrs, const size_t* order, size_t lookups, int direct, unsigned long* sum)
+{
+    hashtbl*       tbl;
+    v4_table       t        = V4_TABLE_INIT;
+    int            next_idx = 0, idx;
+    struct timeval start;
+    size_t         i;
+    double         ns;
+
+    if (!(tbl = hash_create(MAX_ARRAY_SZ, (hashfunc*)inXaddr_hash, (hashkeycmp*)inXaddr_cmp, 1, NULL, NULL)))
+        exit(1);
+    *sum = 0;
+    gettimeofday(&start, NULL);
+    for (i = 0; i < lookups; i++) {
+        if (direct)
+            idx = table_index(&t, tbl, &addrs[order[i]], &next_idx);
+        else
+            idx = hashed_index(tbl, &addrs[order[i]], &next_idx);
+        if (idx < 0)
+            exit(1);
+        *sum += idx;
+    }
+    ns = elapsed(&start) * 1000000000.0 / lookups;
+    if (direct)
+        printf("%d leaves, %zu KB of table\n", t.leaves, (t.leaves + 1) * (size_t)65536 * sizeof(void*) / 1024);
+    freeArena();
+    return ns;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t         n = 100000, prefixes = 64, lookups = 10000000, i;
+    uint32_t*      prefix;
+    inX_addr*      addrs;
+    size_t*        order;
+    unsigned long  hashed_sum, direct_sum;
+    double         hashed, direct;
+
+    if (argc > 1)
+        n = strtoul(argv[1], NULL, 10);
+    if (argc > 2)
+        prefixes = strtoul(argv[2], NULL, 10);
+    if (argc > 3)
+        lookups = strtoul(argv[3], NULL, 10);
+    if (!n || !prefixes || !lookups || prefixes > 65536) {
+        fprintf(stderr, "usage: %s [ ADDRESSES [ PREFIXES [ LOOKUPS ] ] ]\n", argv[0]);
+        return 2;
+    }
+
+    hash_seed();
+    srandom(time(NULL));
+    prefix = calloc(prefixes, sizeof(*prefix));
+    addrs  = calloc(n, sizeof(*addrs));
+    order  = calloc(lookups, sizeof(*order));
+    if (!prefix || !addrs || !order)
+        return 1;
+    for (i = 0; i < prefixes; i++)
+        prefix[i] = random() & 0xffff;
+    for (i = 0; i < n; i++) {
+        struct in_addr a;
+        a.s_addr = htonl(prefix[random() % prefixes] << 16 | (random() & 0xffff));
+        inXaddr_assign_v4(&addrs[i], &a);
+    }
+    for (i = 0; i < lookups; i++)
+        order[i] = random() % n;
+
+    hashed = run(addrs, order, lookups, 0, &hashed_sum);
+    direct = run(addrs, order, lookups, 1, &direct_sum);
+    if (hashed_sum != direct_sum) {
+        fprintf(stderr, "indexes differ\n");
+        return 1;
+    }
+    printf("%zu addresses in %zu /16s, %zu lookups\n", n, prefixes, lookups);
+    printf("hashed %8.1f ns/lookup\n", hashed);
+    printf("direct %8.1f ns/lookup\n", direct);
+
+    free(prefix);
+    free(addrs);
+    free(order);
+    return 0;
+}
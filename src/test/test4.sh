@@ -29,3 +29,13 @@ test -f 1458044657.dscdata.xml || sleep 2
 test -f 1458044657.dscdata.xml || sleep 3
 test -f 1458044657.dscdata.xml
 diff 1458044657.dscdata.xml "$srcdir/response_time3.gold"
+
+rm -f 1458044657.dscdata.xml
+
+../dsc "$srcdir/response_time4.conf"
+
+test -f 1458044657.dscdata.xml || sleep 1
+test -f 1458044657.dscdata.xml || sleep 2
+test -f 1458044657.dscdata.xml || sleep 3
+test -f 1458044657.dscdata.xml
+diff 1458044657.dscdata.xml "$srcdir/response_time4.gold"
@@ -0,0 +1,18 @@
+#!/bin/sh -xe
+
+# Decode the DNSTAP file in threads and compare with the same gold as
+# when it is read one frame at a time
+
+mkdir -p test5_threads
+rm -f test5_threads/1573730567.dscdata.xml
+sed -e 's%^run_dir .*%run_dir "./test5_threads";%' \
+    -e 's%^dnstap_file .*%dnstap_file ../test.dnstap.dist;\
+dnstap_threads 2;%' \
+    "$srcdir/1573730567.conf" > test5_threads.conf
+../dsc test5_threads.conf
+
+test -f test5_threads/1573730567.dscdata.xml || sleep 1
+test -f test5_threads/1573730567.dscdata.xml || sleep 2
+test -f test5_threads/1573730567.dscdata.xml || sleep 3
+test -f test5_threads/1573730567.dscdata.xml
+diff test5_threads/1573730567.dscdata.xml "$srcdir/1573730567.gold"
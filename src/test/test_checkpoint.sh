@@ -0,0 +1,23 @@
+#!/bin/sh -xe
+
+# The last query of the DNSTAP file gets no response so it is saved in the
+# checkpoint, when restored the same query read again replaces it and the
+# restored one times out. The response time max seconds is large enough to
+# keep the old query when restoring.
+
+mkdir -p checkpoint
+rm -f checkpoint/checkpoint.bin checkpoint/1643283234.dscdata.xml
+
+../dsc "$srcdir/checkpoint.conf"
+test -f checkpoint/1643283234.dscdata.xml || sleep 1
+test -f checkpoint/1643283234.dscdata.xml || sleep 2
+test -f checkpoint/1643283234.dscdata.xml
+test -f checkpoint/checkpoint.bin
+test `grep -c timeouts checkpoint/1643283234.dscdata.xml` -eq 0
+rm -f checkpoint/1643283234.dscdata.xml
+
+../dsc "$srcdir/checkpoint.conf"
+test -f checkpoint/1643283234.dscdata.xml || sleep 1
+test -f checkpoint/1643283234.dscdata.xml || sleep 2
+test -f checkpoint/1643283234.dscdata.xml
+diff -u checkpoint/1643283234.dscdata.xml "$srcdir/checkpoint.gold"
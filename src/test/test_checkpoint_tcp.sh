@@ -0,0 +1,41 @@
+#!/bin/sh -xe
+
+# The first part of the pcap file ends in the middle of a TCP stream, with
+# a message length received but not its message and the next length received
+# out of order, so both are saved in the checkpoint. Once restored, the
+# second part counts the rest of the stream and both parts sum up to the
+# counts of the whole file.
+
+counts() {
+    awk '/<array / { split($0, a, "\""); array = a[2] }
+        / count="/ { split($0, a, "\""); n[array " " a[2]] += a[4] }
+        END { for (k in n) print k, n[k] }' "$@" | sort
+}
+
+sed -e 's%checkpoint_tcp"%checkpoint_tcp0"%' \
+    -e 's%dnso1tcp_1%dnso1tcp%' \
+    -e '/^checkpoint_file/d' \
+    "$srcdir/checkpoint_tcp.conf" > checkpoint_tcp0.conf
+sed -e 's%dnso1tcp_1%dnso1tcp_2%' \
+    "$srcdir/checkpoint_tcp.conf" > checkpoint_tcp2.conf
+
+mkdir -p checkpoint_tcp checkpoint_tcp0
+rm -f checkpoint_tcp/checkpoint.bin checkpoint_tcp/*.dscdata.xml checkpoint_tcp0/*.dscdata.xml
+
+../dsc "$srcdir/checkpoint_tcp.conf"
+test -f checkpoint_tcp/1515583362.dscdata.xml || sleep 1
+test -f checkpoint_tcp/1515583362.dscdata.xml || sleep 2
+test -f checkpoint_tcp/1515583362.dscdata.xml
+test -f checkpoint_tcp/checkpoint.bin
+
+../dsc checkpoint_tcp2.conf
+../dsc checkpoint_tcp0.conf
+for f in checkpoint_tcp/1515583363.dscdata.xml checkpoint_tcp0/1515583363.dscdata.xml; do
+    test -f "$f" || sleep 1
+    test -f "$f" || sleep 2
+    test -f "$f"
+done
+
+counts checkpoint_tcp/1515583362.dscdata.xml checkpoint_tcp/1515583363.dscdata.xml | grep -v pcap_stats > checkpoint_tcp.out
+counts checkpoint_tcp0/1515583363.dscdata.xml | grep -v pcap_stats > checkpoint_tcp0.out
+diff -u checkpoint_tcp0.out checkpoint_tcp.out
@@ -0,0 +1,32 @@
+#!/bin/sh -x
+
+# Read the DNSTAP test file over a UNIX socket with worker threads and
+# compare with the file input, needs the dnswire example sender or
+# bench_dnstap (make bench_dnstap) to send the two frames of the file
+
+if [ -x ~/workspace/dnswire/examples/reader_sender ]; then
+    send="$HOME/workspace/dnswire/examples/reader_sender $srcdir/test.dnstap ./dnstap_threads/dnstap.sock"
+elif [ -x ../bench_dnstap ]; then
+    send="../bench_dnstap $srcdir/test.dnstap ./dnstap_threads/dnstap.sock 2"
+else
+    exit 0
+fi
+
+mkdir -p dnstap_threads
+(cd dnstap_threads && rm -f *.xml)
+rm -f dnstap_threads/dnstap.sock
+../dsc -f "$srcdir/dnstap_threads.conf" &
+sleep 2
+$send
+sleep 2
+pkill -ou `id -un` dsc
+sleep 5
+if pgrep -ou `id -un` dsc; then
+    pkill -KILL -ou `id -un` dsc
+    exit 1
+fi
+set -e
+# the interval starts when dsc does and not at the first message
+test `ls dnstap_threads/*.dscdata.xml | wc -l` -eq 1
+sed -e 's% start_time="[0-9]*" stop_time="[0-9]*"%%' dnstap_threads/*.dscdata.xml > dnstap_threads.out
+sed -e 's% start_time="[0-9]*" stop_time="[0-9]*"%%' "$srcdir/1573730567.gold" | diff dnstap_threads.out -
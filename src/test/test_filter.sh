@@ -0,0 +1,23 @@
+#!/bin/sh -xe
+
+rm -f 1458044657.dscdata.xml
+
+../dsc "$srcdir/test_filter.conf"
+
+test -f 1458044657.dscdata.xml || sleep 1
+test -f 1458044657.dscdata.xml || sleep 2
+test -f 1458044657.dscdata.xml || sleep 3
+test -f 1458044657.dscdata.xml
+
+# datasets using filter expressions must count the same as the ones
+# using the built-in filters, and those the same as in the gold
+array() {
+    awk -v name="$2" '$0 ~ "<array name=\"" name "\"" { p = 1; next } p && /<\/array>/ { p = 0 } p' "$1"
+}
+for pair in f_qtype:qtype f_rcode_vs_replylen:rcode_vs_replylen f_qtype_vs_tld:qtype_vs_tld \
+    qtype:qtype rcode_vs_replylen:rcode_vs_replylen qtype_vs_tld:qtype_vs_tld; do
+    array 1458044657.dscdata.xml "${pair%%:*}" > test_filter.out
+    array "$srcdir/1458044657.xml_gold" "${pair#*:}" > test_filter.gold
+    test -s test_filter.gold
+    diff -u test_filter.out test_filter.gold
+done
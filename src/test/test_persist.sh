@@ -0,0 +1,22 @@
+#!/bin/sh -xe
+
+rm -f 1458044657.dscdata.xml
+
+../dsc "$srcdir/test_persist.conf"
+
+test -f 1458044657.dscdata.xml || sleep 1
+test -f 1458044657.dscdata.xml || sleep 2
+test -f 1458044657.dscdata.xml || sleep 3
+test -f 1458044657.dscdata.xml
+
+# keeping the labels between intervals does not change the output of the
+# datasets using the client, qname, second_ld and third_ld indexers
+array() {
+    awk -v name="$2" '$0 ~ "<array name=\"" name "\"" { p = 1 } p { print } p && /<\/array>/ { p = 0 }' "$1"
+}
+for name in client_addr_vs_rcode chaos_types_and_names ipv6_rsn_abusers qname second_ld_vs_rcode third_ld_vs_rcode; do
+    array 1458044657.dscdata.xml "$name" > test_persist.out
+    array "$srcdir/1458044657.xml_gold" "$name" > test_persist.gold
+    test -s test_persist.gold
+    diff -u test_persist.out test_persist.gold
+done
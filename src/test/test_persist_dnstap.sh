@@ -0,0 +1,31 @@
+#!/bin/sh -xe
+
+# persist.dnstap has a query each second for the same name and client,
+# queries for a name and client seen in two seconds only and one every
+# third second. With one interval kept the labels of the last two are
+# removed and their indexes reused, the counts of each interval must be the
+# same as without keeping labels, only the order of the labels can differ.
+
+sed -e 's%persistent_labels.*%%' -e 's%"./persist"%"./persist0"%' "$srcdir/test_persist_dnstap.conf" > test_persist_dnstap0.conf
+mkdir -p persist persist0
+rm -f persist/*.dscdata.xml persist0/*.dscdata.xml
+
+../dsc "$srcdir/test_persist_dnstap.conf"
+../dsc test_persist_dnstap0.conf
+
+sleep 1
+test `ls persist/*.dscdata.xml | wc -l` -gt 3
+for xml in persist/*.dscdata.xml; do
+    name=`basename "$xml"`
+    test -f "persist0/$name"
+    sort "$xml" > test_persist_dnstap.out
+    sort "persist0/$name" | diff -u test_persist_dnstap.out -
+done
+test `ls persist0/*.dscdata.xml | wc -l` -eq `ls persist/*.dscdata.xml | wc -l`
+
+# h6.d2.test and its client 198.51.100.7 are first seen in the interval
+# ending at 1700000007 and take the index of a removed label, so they are
+# listed before h5.d1.test and 198.51.100.6 kept from the interval before,
+# without reusing indexes they would get a higher one
+test "`grep -o 'h[56]\.d[12]\.test' persist/1700000007.dscdata.xml | head -1`" = "h6.d2.test"
+test "`grep -o '198\.51\.100\.[67]' persist/1700000007.dscdata.xml | head -1`" = "198.51.100.7"
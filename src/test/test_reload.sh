@@ -0,0 +1,35 @@
+#!/bin/sh -xe
+
+# Reload on SIGHUP, the added dataset is used from the next interval on
+# while the changed statistics_interval is kept until a restart
+
+conf() {
+    echo 'run_dir "./reload";
+minfree_bytes 5000000;
+dnstap_unixsock ./dnstap.sock;
+no_wait_interval;
+dataset qtype dns All:null Qtype:qtype queries-only;'
+    echo "$1"
+}
+
+mkdir -p reload
+rm -f reload/*.xml reload/dnstap.sock
+conf "statistics_interval 1;" > test_reload.conf
+../dsc -d -D test_reload.conf 2>test_reload.out &
+pid=$!
+sleep 2
+conf "statistics_interval 2;
+dataset rcode dns All:null Rcode:rcode replies-only;" > test_reload.conf
+kill -HUP $pid
+sleep 3
+rm -f reload/*.xml
+sleep 3
+kill $pid
+wait $pid || true
+
+grep -qF "configuration reloaded" test_reload.out
+grep -qF "statistics_interval can not be changed by a reload" test_reload.out
+test `ls reload/*.xml | wc -l` -ge 2
+for xml in reload/*.xml; do
+    grep -qF '<array name="rcode"' "$xml"
+done
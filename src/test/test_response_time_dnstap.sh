@@ -0,0 +1,12 @@
+#!/bin/sh -xe
+
+rm -f 1643283234.dscdata.xml
+
+# only responses reach the indexer, their query time comes from dnstap
+../dsc "$srcdir/response_time_dnstap.conf"
+
+test -f 1643283234.dscdata.xml || sleep 1
+test -f 1643283234.dscdata.xml || sleep 2
+test -f 1643283234.dscdata.xml || sleep 3
+test -f 1643283234.dscdata.xml
+diff -u 1643283234.dscdata.xml "$srcdir/response_time_dnstap.gold"
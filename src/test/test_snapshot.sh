@@ -0,0 +1,31 @@
+#!/bin/sh -xe
+
+rm -f 1683879752.dscdata.xml test_snapshot.bin
+
+"$srcdir/../dsc-psl-convert" --all "$srcdir/test_285.tldlist" --snapshot test_snapshot.bin --knowntlds "$srcdir/knowntlds.txt" > /dev/null
+
+../dsc -d "$srcdir/test_snapshot.conf" 2>test_snapshot.out
+
+test -f 1683879752.dscdata.xml || sleep 1
+test -f 1683879752.dscdata.xml || sleep 2
+test -f 1683879752.dscdata.xml || sleep 3
+test -f 1683879752.dscdata.xml
+diff -u 1683879752.dscdata.xml "$srcdir/test_285.xml_gold"
+
+grep -qF "loaded TLD list from snapshot ./test_snapshot.bin" test_snapshot.out
+grep -qF "loaded 6 known TLDs from snapshot ./test_snapshot.bin" test_snapshot.out
+
+# a damaged snapshot falls back to the text files
+rm -f 1683879752.dscdata.xml
+printf 'X' | dd of=test_snapshot.bin bs=1 seek=100 conv=notrunc
+
+../dsc -d "$srcdir/test_snapshot.conf" 2>test_snapshot.out
+
+test -f 1683879752.dscdata.xml || sleep 1
+test -f 1683879752.dscdata.xml || sleep 2
+test -f 1683879752.dscdata.xml || sleep 3
+test -f 1683879752.dscdata.xml
+diff -u 1683879752.dscdata.xml "$srcdir/test_285.xml_gold"
+
+grep -qF "snapshot ./test_snapshot.bin: checksum mismatch" test_snapshot.out
+grep -qF "loaded 6 known TLDs from ./knowntlds.txt.dist" test_snapshot.out
@@ -57,17 +57,19 @@ typedef struct
 
 int tld_indexer(const dns_message* m)
 {
-    const char* tld;
-    tldobj*     obj;
+    const char*  tld;
+    unsigned int hv;
+    tldobj*      obj;
     if (m->malformed)
         return -1;
     tld = dns_message_tld((dns_message*)m);
+    hv  = dns_message_nld_hash((dns_message*)m, 1);
     if (NULL == theHash) {
         theHash = hash_create(MAX_ARRAY_SZ, tld_hashfunc, tld_cmpfunc, 1, afree, afree);
         if (NULL == theHash)
             return -1;
     }
-    if ((obj = hash_find(tld, theHash)))
+    if ((obj = hash_find_hashed(tld, hv, theHash)))
         return obj->index;
     obj = acalloc(1, sizeof(*obj));
     if (NULL == obj)
@@ -78,7 +80,7 @@ int tld_indexer(const dns_message* m)
         return -1;
     }
     obj->index = next_idx;
-    if (0 != hash_add(obj->tld, obj, theHash)) {
+    if (0 != hash_add_hashed(obj->tld, hv, obj, theHash)) {
         afree(obj->tld);
         afree(obj);
         return -1;
@@ -114,7 +116,7 @@ void tld_reset()
 static unsigned int
 tld_hashfunc(const void* key)
 {
-    return hashendian(key, strlen(key), 0);
+    return hash_keyed(key, strlen(key));
 }
 
 static int
@@ -44,6 +44,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 bool have_tld_list = false;
 
@@ -59,7 +60,7 @@ typedef struct
 
 static unsigned int tldl_hashfunc(const void* key)
 {
-    return hashendian(key, strlen(key), 0);
+    return hash_keyed(key, strlen(key));
 }
 
 static int tldl_cmpfunc(const void* a, const void* b)
@@ -155,15 +156,283 @@ void tld_list_add(const char* tld)
     have_tld_list = true;
 }
 
+/*
+ * Compiled TLD list
+ *
+ * The entries of the hash are compiled into a reverse label trie held in
+ * one allocation: the header, the nodes, an open addressing table of the
+ * edges (parent node and label) and the label pool. Walking a label is a
+ * hash of only that label and a compare against it, instead of rehashing
+ * and comparing the whole suffix for every level.
+ *
+ * An entry is split into labels on every dot, so "co.uk" becomes the path
+ * "uk" -> "co" and "a..b" becomes "b" -> "" -> "a", which keeps lookups
+ * identical to looking up the suffix string in the hash.
+ */
+
+typedef struct
+{
+    uint32_t parent;
+    uint32_t label; // Offset of the label in the label pool
+    uint16_t label_len;
+    uint16_t flags; // TLD_LIST_IS_TLD and/or TLD_LIST_HAS_CHILDREN
+} tld_node;
+
+typedef struct
+{
+    uint32_t size; // Number of nodes allocated
+    uint32_t nodes;
+    uint32_t mask; // Size of the edge table minus one
+    uint32_t labels_size;
+    tld_node node[];
+    // uint32_t edge[mask + 1], node index or 0 if empty
+    // char labels[]
+} tld_trie;
+
+#define tld_trie_edges(t) ((uint32_t*)&(t)->node[(t)->size])
+#define tld_trie_labels(t) ((char*)&tld_trie_edges(t)[(t)->mask + 1])
+
+static tld_trie* theTrie       = NULL;
+static int       theTrieMapped = 0;
+
+/* Same as tolower() in the C locale */
+#define tld_lc(c) ((c) >= 'A' && (c) <= 'Z' ? (c) + ('a' - 'A') : (c))
+
+static uint32_t tld_edge_hash(uint32_t parent, const char* label, size_t len)
+{
+    uint32_t h = 2166136261U ^ (parent * 2654435761U);
+    size_t   i;
+    for (i = 0; i < len; i++) {
+        h ^= tld_lc((unsigned char)label[i]);
+        h *= 16777619U;
+    }
+    return h;
+}
+
+static tld_trie* tld_trie_create(size_t nodes, size_t labels_size)
+{
+    size_t    mask = 1;
+    tld_trie* t;
+
+    while (mask < nodes * 2)
+        mask <<= 1;
+    mask--;
+    if (nodes > UINT32_MAX || mask > UINT32_MAX || labels_size > UINT32_MAX) {
+        dsyslog(LOG_ERR, "tld_list: TLD list too large");
+        exit(1);
+    }
+    if (!(t = xcalloc(1, sizeof(*t) + nodes * sizeof(tld_node) + (mask + 1) * sizeof(uint32_t) + labels_size))) {
+        dsyslog(LOG_ERR, "tld_list: Unable to compile TLD list, out of memory");
+        exit(1);
+    }
+    t->size        = nodes;
+    t->nodes       = 1; // the root
+    t->mask        = mask;
+    t->labels_size = 0;
+    return t;
+}
+
+static uint32_t tld_trie_child(const tld_trie* t, uint32_t parent, const char* label, size_t len)
+{
+    const uint32_t* edges  = tld_trie_edges(t);
+    const char*     labels = tld_trie_labels(t);
+    uint32_t        h      = tld_edge_hash(parent, label, len) & t->mask;
+    uint32_t        i;
+    size_t          c;
+
+    while ((i = edges[h])) {
+        const tld_node* n = &t->node[i];
+        if (n->parent == parent && n->label_len == len) {
+            for (c = 0; c < len; c++) {
+                if (tld_lc((unsigned char)label[c]) != labels[n->label + c])
+                    break;
+            }
+            if (c == len)
+                return i;
+        }
+        h = (h + 1) & t->mask;
+    }
+    return 0;
+}
+
+static void tld_trie_add_edge(tld_trie* t, uint32_t i)
+{
+    uint32_t* edges = tld_trie_edges(t);
+    uint32_t  h     = tld_edge_hash(t->node[i].parent, tld_trie_labels(t) + t->node[i].label, t->node[i].label_len) & t->mask;
+    while (edges[h])
+        h = (h + 1) & t->mask;
+    edges[h] = i;
+}
+
+/*
+ * Compile the entries added so far, must be called after adding entries
+ * for them to be used, the entries are freed once compiled
+ */
+int tld_list_compile(void)
+{
+    tld_trie*   build;
+    tldlobj*    o;
+    size_t      nodes = 1, labels_size = 0;
+    const char* t;
+    uint32_t    i;
+
+    if (theTrieMapped) {
+        dsyslog(LOG_ERR, "tld_list: TLD list already loaded from a snapshot");
+        return 0;
+    }
+    if (!theHash)
+        return 1;
+
+    // Size for the worst case where no labels are shared
+    hash_iter_init(theHash);
+    while ((o = hash_iterate(theHash))) {
+        labels_size += strlen(o->tld);
+        nodes++;
+        for (t = o->tld; *t; t++) {
+            if (*t == '.')
+                nodes++;
+        }
+    }
+    build = tld_trie_create(nodes, labels_size);
+
+    hash_iter_init(theHash);
+    while ((o = hash_iterate(theHash))) {
+        uint32_t    n = 0;
+        const char* e = o->tld + strlen(o->tld);
+        t             = e;
+        for (;;) {
+            if (t == o->tld || *(t - 1) == '.') {
+                uint32_t c = tld_trie_child(build, n, t, e - t);
+                if (!c) {
+                    if (e - t > UINT16_MAX) {
+                        dsyslog(LOG_ERR, "tld_list: label too long");
+                        exit(1);
+                    }
+                    c                        = build->nodes++;
+                    build->node[c].parent    = n;
+                    build->node[c].label     = build->labels_size;
+                    build->node[c].label_len = e - t;
+                    for (; t < e; t++)
+                        tld_trie_labels(build)[build->labels_size++] = tld_lc((unsigned char)*t);
+                    t -= build->node[c].label_len;
+                    tld_trie_add_edge(build, c);
+                }
+                n = c;
+                if (t == o->tld)
+                    break;
+                e = --t;
+                continue;
+            }
+            t--;
+        }
+        build->node[n].flags = (o->is_tld ? TLD_LIST_IS_TLD : 0) | (o->has_children ? TLD_LIST_HAS_CHILDREN : 0);
+    }
+
+    // Copy into an allocation of the exact size
+    if (theTrie)
+        xfree(theTrie);
+    theTrie = tld_trie_create(build->nodes, build->labels_size);
+    memcpy(theTrie->node, build->node, build->nodes * sizeof(tld_node));
+    memcpy(tld_trie_labels(theTrie), tld_trie_labels(build), build->labels_size);
+    theTrie->nodes       = build->nodes;
+    theTrie->labels_size = build->labels_size;
+    for (i = 1; i < theTrie->nodes; i++)
+        tld_trie_add_edge(theTrie, i);
+    xfree(build);
+
+    hash_destroy(theHash);
+    theHash = NULL;
+    return 1;
+}
+
+static int tld_trie_valid(const tld_trie* t, size_t size)
+{
+    const uint32_t* edges;
+    uint64_t        expect;
+    uint32_t        i, used = 0;
+
+    if (size < sizeof(*t))
+        return 0;
+    expect = sizeof(*t) + (uint64_t)t->size * sizeof(tld_node) + ((uint64_t)t->mask + 1) * sizeof(uint32_t) + t->labels_size;
+    if (expect != size || !t->nodes || t->nodes > t->size || (((uint64_t)t->mask + 1) & t->mask) || t->mask < t->nodes)
+        return 0;
+    for (i = 1; i < t->nodes; i++) {
+        if (t->node[i].parent >= t->nodes || (uint64_t)t->node[i].label + t->node[i].label_len > t->labels_size)
+            return 0;
+    }
+    edges = tld_trie_edges(t);
+    for (i = 0; i <= t->mask; i++) {
+        if (edges[i] >= t->nodes)
+            return 0;
+        if (edges[i])
+            used++;
+    }
+    return used == t->nodes - 1;
+}
+
+/*
+ * Use a compiled TLD list from a snapshot, the data is verified before use
+ * since it is used as is
+ */
+int tld_list_load_snapshot(const void* data, size_t size)
+{
+    if (have_tld_list) {
+        dsyslog(LOG_ERR, "tld_list: TLD list already loaded");
+        return 0;
+    }
+    if (!tld_trie_valid(data, size)) {
+        dsyslog(LOG_ERR, "tld_list: invalid TLD list in snapshot");
+        return 0;
+    }
+    theTrie       = (tld_trie*)data;
+    theTrieMapped = 1;
+    have_tld_list = true;
+    return 1;
+}
+
+/*
+ * Walk one label further down the compiled TLD list from the node given,
+ * labels are walked from right to left starting at TLD_LIST_ROOT.
+ *
+ * Returns the same as tld_list_find() for the suffix walked so far, if the
+ * label is not found the node is set to TLD_LIST_NONE and all following
+ * walks return 0.
+ */
+int tld_list_walk(unsigned int* node, const char* label, size_t len)
+{
+    uint32_t i;
+
+    if (!theTrie || *node >= theTrie->nodes) {
+        *node = TLD_LIST_NONE;
+        return 0;
+    }
+    if (!(i = tld_trie_child(theTrie, *node, label, len))) {
+        *node = TLD_LIST_NONE;
+        return 0;
+    }
+    *node = i;
+    return theTrie->node[i].flags;
+}
+
+/*
+ * Find an entry of the compiled TLD list by walking all its labels, returns
+ * TLD_LIST_IS_TLD and/or TLD_LIST_HAS_CHILDREN or 0 if not found
+ */
 int tld_list_find(const char* tld)
 {
-    int      ret = 0;
-    tldlobj* found;
-    if ((found = hash_find(tld, theHash))) {
-        if (found->is_tld)
-            ret |= 1;
-        if (found->has_children)
-            ret |= 2;
+    unsigned int node = TLD_LIST_ROOT;
+    const char*  e    = tld + strlen(tld);
+    const char*  t    = e;
+    int          ret;
+
+    for (;;) {
+        if (t == tld || *(t - 1) == '.') {
+            ret = tld_list_walk(&node, t, e - t);
+            if (t == tld || node == TLD_LIST_NONE)
+                return ret;
+            e = --t;
+            continue;
+        }
+        t--;
     }
-    return ret;
 }
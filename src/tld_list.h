@@ -38,10 +38,20 @@
 #define __dsc_tld_list_h
 
 #include <stdbool.h>
+#include <stddef.h>
 
 extern bool have_tld_list;
 
+#define TLD_LIST_IS_TLD 1
+#define TLD_LIST_HAS_CHILDREN 2
+
+#define TLD_LIST_ROOT 0
+#define TLD_LIST_NONE ((unsigned int)-1)
+
 void tld_list_add(const char* tld);
+int  tld_list_compile(void);
+int  tld_list_load_snapshot(const void* data, size_t size);
 int  tld_list_find(const char* tld);
+int  tld_list_walk(unsigned int* node, const char* label, size_t len);
 
 #endif /* __dsc_tld_list_h */
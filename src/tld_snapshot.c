@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2008-2023, OARC, Inc.
+ * Copyright (c) 2007-2008, Internet Systems Consortium, Inc.
+ * Copyright (c) 2003-2007, The Measurement Factory, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include "tld_snapshot.h"
+#include "syslog_debug.h"
+#include "compat.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static uint32_t tld_snapshot_checksum(const unsigned char* data, size_t len)
+{
+    uint32_t h = 2166136261U;
+    size_t   i;
+    for (i = 0; i < len; i++) {
+        h ^= data[i];
+        h *= 16777619U;
+    }
+    return h;
+}
+
+static int tld_snapshot_section(const char* file, size_t size, uint32_t offset, uint32_t len)
+{
+    if (!offset && !len)
+        return 1;
+    if (offset < sizeof(tld_snapshot_header) || offset % 4 || offset > size || len > size - offset) {
+        dsyslogf(LOG_ERR, "snapshot %s: invalid section offset or size", file);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Map a snapshot read-only and verify it, the mapping is kept for the
+ * lifetime of the process. Returns 1 on success, 0 on error after logging
+ * why so the caller can fall back to text files.
+ */
+int tld_snapshot_open(const char* file, tld_snapshot* snapshot)
+{
+    int                        fd;
+    struct stat                st;
+    void*                      map;
+    const tld_snapshot_header* h;
+
+    memset(snapshot, 0, sizeof(*snapshot));
+
+    if ((fd = open(file, O_RDONLY)) < 0) {
+        char errbuf[512];
+        dsyslogf(LOG_ERR, "unable to open snapshot %s: %s", file, dsc_strerror(errno, errbuf, sizeof(errbuf)));
+        return 0;
+    }
+    if (fstat(fd, &st)) {
+        char errbuf[512];
+        dsyslogf(LOG_ERR, "unable to stat snapshot %s: %s", file, dsc_strerror(errno, errbuf, sizeof(errbuf)));
+        close(fd);
+        return 0;
+    }
+    if (st.st_size < (off_t)sizeof(tld_snapshot_header) || st.st_size > UINT32_MAX) {
+        dsyslogf(LOG_ERR, "snapshot %s: invalid size", file);
+        close(fd);
+        return 0;
+    }
+    map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        char errbuf[512];
+        dsyslogf(LOG_ERR, "unable to mmap snapshot %s: %s", file, dsc_strerror(errno, errbuf, sizeof(errbuf)));
+        return 0;
+    }
+
+    h = map;
+    if (memcmp(h->magic, TLD_SNAPSHOT_MAGIC, sizeof(TLD_SNAPSHOT_MAGIC))) {
+        dsyslogf(LOG_ERR, "snapshot %s: not a TLD snapshot", file);
+    } else if (h->byte_order != TLD_SNAPSHOT_BYTE_ORDER) {
+        dsyslogf(LOG_ERR, "snapshot %s: created on a host with different byte order", file);
+    } else if (h->version != TLD_SNAPSHOT_VERSION) {
+        dsyslogf(LOG_ERR, "snapshot %s: unsupported version %u", file, h->version);
+    } else if (h->checksum != tld_snapshot_checksum((const unsigned char*)map + sizeof(*h), st.st_size - sizeof(*h))) {
+        dsyslogf(LOG_ERR, "snapshot %s: checksum mismatch", file);
+    } else if (tld_snapshot_section(file, st.st_size, h->trie_offset, h->trie_size)
+               && tld_snapshot_section(file, st.st_size, h->knowntlds_offset, h->knowntlds_size)) {
+        if (h->trie_size) {
+            snapshot->trie      = (const char*)map + h->trie_offset;
+            snapshot->trie_size = h->trie_size;
+        }
+        if (h->knowntlds_size) {
+            snapshot->knowntlds       = (const char*)map + h->knowntlds_offset;
+            snapshot->knowntlds_size  = h->knowntlds_size;
+            snapshot->knowntlds_count = h->knowntlds_count;
+        }
+        return 1;
+    }
+
+    munmap(map, st.st_size);
+    return 0;
+}
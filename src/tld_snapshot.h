@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2008-2023, OARC, Inc.
+ * Copyright (c) 2007-2008, Internet Systems Consortium, Inc.
+ * Copyright (c) 2003-2007, The Measurement Factory, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __dsc_tld_snapshot_h
+#define __dsc_tld_snapshot_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Binary snapshot of the compiled TLD list and the known TLDs, as written
+ * by dsc-psl-convert --snapshot.
+ *
+ * All values are in the byte order of the host that created it and all
+ * offsets are from the start of the file, so it can be mapped read-only
+ * and used as is.
+ */
+
+#define TLD_SNAPSHOT_MAGIC "DSC-TLD"
+#define TLD_SNAPSHOT_BYTE_ORDER 0x01020304
+#define TLD_SNAPSHOT_VERSION 1
+
+typedef struct tld_snapshot_header tld_snapshot_header;
+struct tld_snapshot_header {
+    char     magic[8];
+    uint32_t byte_order;
+    uint32_t version;
+    uint32_t checksum; /* 32 bit FNV-1a of everything after the header */
+    uint32_t trie_offset;
+    uint32_t trie_size;
+    uint32_t knowntlds_offset;
+    uint32_t knowntlds_size;
+    uint32_t knowntlds_count;
+};
+
+typedef struct tld_snapshot tld_snapshot;
+struct tld_snapshot {
+    const void* trie;
+    size_t      trie_size;
+    const char* knowntlds; /* knowntlds_count 0-terminated strings */
+    size_t      knowntlds_size;
+    size_t      knowntlds_count;
+};
+
+int tld_snapshot_open(const char* file, tld_snapshot* snapshot);
+
+#endif /* __dsc_tld_snapshot_h */
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2008-2023, OARC, Inc.
+ * Copyright (c) 2007-2008, Internet Systems Consortium, Inc.
+ * Copyright (c) 2003-2007, The Measurement Factory, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include "v4_table.h"
+#include "xmalloc.h"
+
+#include <arpa/inet.h>
+#include <sys/socket.h> // For AF_ on BSDs
+
+#define V4_TABLE_SZ 65536
+
+/*
+ * Return the slot of the address, NULL if it is not an IPv4 address or no
+ * leaf can be allocated for its /16
+ */
+void** v4_table_slot(v4_table* t, const inX_addr* a)
+{
+    uint32_t addr;
+    void**   leaf;
+
+    if (a->family == AF_INET6)
+        return NULL;
+    addr = ntohl(a->in4.s_addr);
+    if (NULL == t->leaf && NULL == (t->leaf = acalloc(V4_TABLE_SZ, sizeof(*t->leaf))))
+        return NULL;
+    if (NULL == (leaf = t->leaf[addr >> 16])) {
+        if (t->leaves >= V4_TABLE_MAX_LEAVES)
+            return NULL;
+        if (NULL == (leaf = acalloc(V4_TABLE_SZ, sizeof(*leaf))))
+            return NULL;
+        t->leaf[addr >> 16] = leaf;
+        t->leaves++;
+    }
+    return &leaf[addr & 0xffff];
+}
+
+/*
+ * Called when the indexer is reset, the arena is freed after each interval
+ */
+void v4_table_reset(v4_table* t)
+{
+    t->leaf   = NULL;
+    t->leaves = 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2008-2023, OARC, Inc.
+ * Copyright (c) 2007-2008, Internet Systems Consortium, Inc.
+ * Copyright (c) 2003-2007, The Measurement Factory, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __dsc_v4_table_h
+#define __dsc_v4_table_h
+
+#include "inX_addr.h"
+
+/*
+ * Direct indexed table of IPv4 addresses for the indexers, a directory of
+ * all /16s with a leaf of one pointer per address allocated when the /16 is
+ * first seen. Finding an address is two loads without hashing or compares.
+ *
+ * The table lives in the arena and is forgotten by v4_table_reset(), it
+ * only caches what the indexer's hash holds. At most V4_TABLE_MAX_LEAVES
+ * leaves are allocated, addresses in other /16s stay on the hash path.
+ */
+
+#define V4_TABLE_MAX_LEAVES 128
+
+typedef struct v4_table v4_table;
+struct v4_table {
+    void*** leaf; /* by the upper 16 bits of the address */
+    int     leaves;
+};
+
+#define V4_TABLE_INIT { NULL, 0 }
+
+void** v4_table_slot(v4_table* t, const inX_addr* a);
+void   v4_table_reset(v4_table* t);
+
+#endif /* __dsc_v4_table_h */
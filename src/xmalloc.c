@@ -44,6 +44,9 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
 
 /********** xmalloc **********/
 
@@ -90,73 +93,160 @@ void xfree(void* p)
 
 /********** amalloc **********/
 
+/*
+ * The arena is made of chunks of CHUNK_SIZE, aligned on their size so they
+ * can be backed by huge pages, which are kept on a free list when the
+ * arena is freed and reused for the next interval. Allocations too large
+ * for a chunk get a dedicated one that is returned to malloc.
+ */
+
 typedef struct arena {
     struct arena* prevArena;
     char*         end;
     char*         nextAlloc;
+    char*         lastAlloc; /* can be grown or freed in place */
+    int           dedicated;
 } Arena;
 
-Arena* currentArena = NULL;
+Arena*        currentArena = NULL;
+static Arena* freeChunks   = NULL;
+static int    nFreeChunks  = 0;
+
+static struct {
+    size_t used;
+    size_t wasted;
+    int    chunks;
+    int    recycled;
+    int    dedicated;
+} arenaStats;
 
 #define align(size, a) (((size_t)(size) + ((a)-1)) & ~((a)-1))
-#define ALIGNMENT 4
+#define ALIGNMENT 16
 #define HEADERSIZE align(sizeof(Arena), ALIGNMENT)
-#define CHUNK_SIZE (1 * 1024 * 1024 + 1024)
+#define CHUNK_SIZE (2 * 1024 * 1024)
 
 static Arena*
-newArena(size_t size)
+newArena(void)
 {
     char   errbuf[512];
     Arena* arena;
-    size  = align(size, ALIGNMENT);
-    arena = malloc(HEADERSIZE + size);
+    int    err;
+
+    if (freeChunks) {
+        arena      = freeChunks;
+        freeChunks = arena->prevArena;
+        nFreeChunks--;
+        arenaStats.recycled++;
+    } else {
+        if ((err = posix_memalign((void**)&arena, CHUNK_SIZE, CHUNK_SIZE))) {
+            dsyslogf(LOG_CRIT, "amalloc %d: %s", CHUNK_SIZE, dsc_strerror(err, errbuf, sizeof(errbuf)));
+            return NULL;
+        }
+#if defined(HAVE_MMAP) && defined(MADV_HUGEPAGE)
+        madvise(arena, CHUNK_SIZE, MADV_HUGEPAGE);
+#endif
+    }
+    arenaStats.chunks++;
+    arena->prevArena = NULL;
+    arena->nextAlloc = (char*)arena + HEADERSIZE;
+    arena->end       = (char*)arena + CHUNK_SIZE;
+    arena->lastAlloc = NULL;
+    arena->dedicated = 0;
+    return arena;
+}
+
+static Arena*
+newDedicatedArena(size_t size)
+{
+    char   errbuf[512];
+    Arena* arena = malloc(HEADERSIZE + size);
     if (NULL == arena) {
-        dsyslogf(LOG_CRIT, "amalloc %d: %s", (int)size, dsc_strerror(errno, errbuf, sizeof(errbuf)));
+        dsyslogf(LOG_CRIT, "amalloc %zu: %s", size, dsc_strerror(errno, errbuf, sizeof(errbuf)));
         return NULL;
     }
+    arenaStats.dedicated++;
     arena->prevArena = NULL;
-    arena->nextAlloc = (char*)arena + HEADERSIZE;
-    arena->end       = arena->nextAlloc + size;
+    arena->nextAlloc = (char*)arena + HEADERSIZE + size;
+    arena->end       = arena->nextAlloc;
+    arena->lastAlloc = NULL;
+    arena->dedicated = 1;
     return arena;
 }
 
 void useArena()
 {
-    currentArena = newArena(CHUNK_SIZE);
+    memset(&arenaStats, 0, sizeof(arenaStats));
+    currentArena = newArena();
 }
 
+/*
+ * The chunks used are kept for the next interval, the free list is
+ * trimmed to that many so a peak does not hold on to memory for ever
+ */
 void freeArena()
 {
+    int used = 0;
+
     while (currentArena) {
         Arena* prev = currentArena->prevArena;
-        free(currentArena);
+        if (currentArena->dedicated) {
+            free(currentArena);
+        } else {
+            currentArena->prevArena = freeChunks;
+            freeChunks              = currentArena;
+            nFreeChunks++;
+            used++;
+        }
         currentArena = prev;
     }
+    while (nFreeChunks > used) {
+        Arena* next = freeChunks->prevArena;
+        free(freeChunks);
+        freeChunks = next;
+        nFreeChunks--;
+    }
+}
+
+/*
+ * Print the arena usage of the interval at debug level 2
+ */
+void amalloc_report(void)
+{
+    dfprintf(2, "arena: %zu bytes used, %zu bytes wasted, %d chunks (%d recycled), %d dedicated, %d free",
+        arenaStats.used, arenaStats.wasted, arenaStats.chunks, arenaStats.recycled, arenaStats.dedicated, nFreeChunks);
 }
 
 void* amalloc(size_t size)
 {
     void* p;
     size = align(size, ALIGNMENT);
-    if (currentArena->end - currentArena->nextAlloc <= size) {
-        if (size >= (CHUNK_SIZE >> 2)) {
+    if (NULL == currentArena && NULL == (currentArena = newArena()))
+        return NULL;
+    if (currentArena->end - currentArena->nextAlloc < size) {
+        if (size >= ((CHUNK_SIZE - HEADERSIZE) >> 2)) {
             /* Create a new dedicated chunk for this large allocation, and
              * continue to use the current chunk for future smaller
              * allocations. */
-            Arena* new              = newArena(size);
+            Arena* new = newDedicatedArena(size);
+            if (NULL == new)
+                return NULL;
             new->prevArena          = currentArena->prevArena;
             currentArena->prevArena = new;
-            return new->nextAlloc;
+            arenaStats.used += size;
+            return (char*)new + HEADERSIZE;
         }
         /* Move on to a new chunk. */
-        Arena* new = newArena(CHUNK_SIZE);
+        Arena* new = newArena();
         if (NULL == new)
             return NULL;
+        arenaStats.wasted += currentArena->end - currentArena->nextAlloc;
         new->prevArena = currentArena;
         currentArena   = new;
     }
     p = currentArena->nextAlloc;
     currentArena->nextAlloc += size;
+    currentArena->lastAlloc = p;
+    arenaStats.used += size;
     return p;
 }
 
@@ -165,21 +255,47 @@ void* acalloc(size_t number, size_t size)
     void* p;
     size *= number;
     p = amalloc(size);
-    return memset(p, 0, size);
+    return p ? memset(p, 0, size) : NULL;
 }
 
-void* arealloc(void* p, size_t size)
+/*
+ * The last allocation is grown in place if it fits in its chunk, anything
+ * else is copied and the old space is wasted
+ */
+void* arealloc(void* p, size_t old_size, size_t size)
 {
-    return memcpy(amalloc(size), p, size);
+    void* new;
+
+    if (p && currentArena && p == currentArena->lastAlloc && size <= (size_t)(currentArena->end - (char*)p)) {
+        size = align(size, ALIGNMENT);
+        arenaStats.used += size - ((currentArena->nextAlloc - (char*)p));
+        currentArena->nextAlloc = (char*)p + size;
+        return p;
+    }
+    if (NULL == (new = amalloc(size)))
+        return NULL;
+    if (p) {
+        memcpy(new, p, old_size < size ? old_size : size);
+        arenaStats.wasted += align(old_size, ALIGNMENT);
+    }
+    return new;
 }
 
 char* astrdup(const char* s)
 {
     size_t size = strlen(s) + 1;
-    return memcpy(amalloc(size), s, size);
+    char*  p    = amalloc(size);
+    return p ? memcpy(p, s, size) : NULL;
 }
 
+/*
+ * Only the last allocation can be given back
+ */
 void afree(void* p)
 {
-    return;
+    if (p && currentArena && p == currentArena->lastAlloc) {
+        arenaStats.used -= currentArena->nextAlloc - (char*)p;
+        currentArena->nextAlloc = p;
+        currentArena->lastAlloc = NULL;
+    }
 }
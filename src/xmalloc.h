@@ -55,14 +55,16 @@ void  xfree(void* ptr);
  * time or after calling freeArena().
  * The only way to free space allocated with these functions is with
  * freeArena(), which quickly frees _everything_ allocated by these functions.
- * afree() is actually a no-op, and arealloc() does not free the original;
- * these will waste space if used heavily.
+ * afree() and arealloc() only give back or grow the most recent allocation
+ * in place, anything else is wasted until freeArena().
+ * Allocations are aligned on 16 bytes.
  */
 void  useArena();
 void  freeArena();
+void  amalloc_report(void);
 void* amalloc(size_t size);
 void* acalloc(size_t number, size_t size);
-void* arealloc(void* ptr, size_t size);
+void* arealloc(void* ptr, size_t old_size, size_t size);
 char* astrdup(const char* s);
 void  afree(void* ptr);
 